@@ -1,53 +1,88 @@
 {
+    'variables': {
+        'native_sources': [
+            'src/audio.cc',
+            'src/audio_kernels.cc',
+            'src/audio_levels.cc',
+            'src/audio_resampler.cc',
+            'src/file_source.cc',
+            'src/module.cc',
+            'src/offline_clock.cc',
+            'src/preview.cc',
+            'src/program_cache.cc',
+            'src/software_clock.cc',
+            'src/test_pattern.cc',
+            'src/tick_dispatcher.cc',
+            'src/util.cc',
+            'src/video.cc',
+            'src/video_tap.cc',
+            'src/video_upload.cc'
+        ]
+    },
+    'target_defaults': {
+        'dependencies': [
+            'deps/aac/aac.gyp:libFDK',
+            'deps/aac/aac.gyp:libSYS',
+            'deps/aac/aac.gyp:libMpegTPEnc',
+            'deps/aac/aac.gyp:libSBRenc',
+            'deps/aac/aac.gyp:libAACenc',
+            'deps/x264/x264.gyp:libx264common',
+            'deps/x264/x264.gyp:libx264encoder'
+        ],
+        'include_dirs': [
+            '$(p1stream_include_dir)'
+        ],
+        'conditions': [
+            ['OS == "mac"', {
+                'xcode_settings': {
+                    # 'MACOSX_DEPLOYMENT_TARGET': '10.8',  # FIXME: This doesn't work
+                    'OTHER_CFLAGS': ['-mmacosx-version-min=10.8', '-std=c++11', '-stdlib=libc++']
+                },
+                'link_settings': {
+                    'libraries': [
+                        '$(SDKROOT)/System/Library/Frameworks/IOSurface.framework',
+                        '-ljpeg',
+                        '-lopus'
+                    ]
+                },
+                'sources': [
+                    'src/util_mac.cc',
+                    'src/video_mac.cc'
+                ]
+            }],
+            ['OS == "linux"', {
+                'cflags': ['-std=c++11'],
+                'ldflags': ['-Wl,-Bsymbolic'],
+                'sources': [
+                    'src/precise_clock_linux.cc',
+                    'src/shm_export_linux.cc',
+                    'src/shm_source_linux.cc',
+                    'src/util_linux.cc',
+                    'src/video_linux.cc'
+                ],
+                'libraries': [
+                    '-lEGL', '-lOpenCL', '-ljpeg', '-lopus'
+                ]
+            }]
+        ]
+    },
     'targets': [
         {
             'target_name': 'native',
-            'dependencies': [
-                'deps/aac/aac.gyp:libFDK',
-                'deps/aac/aac.gyp:libSYS',
-                'deps/aac/aac.gyp:libMpegTPEnc',
-                'deps/aac/aac.gyp:libSBRenc',
-                'deps/aac/aac.gyp:libAACenc',
-                'deps/x264/x264.gyp:libx264common',
-                'deps/x264/x264.gyp:libx264encoder'
-            ],
-            'include_dirs': [
-                '$(p1stream_include_dir)'
-            ],
             'sources': [
-                'src/audio.cc',
-                'src/module.cc',
-                'src/software_clock.cc',
-                'src/util.cc',
-                'src/video.cc'
+                '<@(native_sources)'
+            ]
+        },
+        {
+            # The complete native module, plus synthetic sources.
+            # Driven by `tools/bench.js`.
+            'target_name': 'bench',
+            'defines': [
+                'P1STREAM_BENCH=1'
             ],
-            'conditions': [
-                ['OS == "mac"', {
-                    'xcode_settings': {
-                        # 'MACOSX_DEPLOYMENT_TARGET': '10.8',  # FIXME: This doesn't work
-                        'OTHER_CFLAGS': ['-mmacosx-version-min=10.8', '-std=c++11', '-stdlib=libc++']
-                    },
-                    'link_settings': {
-                        'libraries': [
-                            '$(SDKROOT)/System/Library/Frameworks/IOSurface.framework',
-                        ]
-                    },
-                    'sources': [
-                        'src/util_mac.cc',
-                        'src/video_mac.cc'
-                    ]
-                }],
-                ['OS == "linux"', {
-                    'cflags': ['-std=c++11'],
-                    'ldflags': ['-Wl,-Bsymbolic'],
-                    'sources': [
-                        'src/util_linux.cc',
-                        'src/video_linux.cc'
-                    ],
-                    'libraries': [
-                        '-lEGL', '-lOpenCL'
-                    ]
-                }]
+            'sources': [
+                '<@(native_sources)',
+                'src/bench.cc'
             ]
         }
     ]
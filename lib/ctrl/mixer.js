@@ -29,6 +29,73 @@ module.exports = function(app) {
         stream('video/MP2T', require('../mpegts'))
     );
 
+    // Preview as a continuous MJPEG stream. Frames are shared with all other
+    // preview viewers of the mixer.
+    app.get('/api/mixers/:id.mjpeg',
+        app.resolveParam('id', 'mixer'),
+        function(req, res, next) {
+            if (!req.obj)
+                return res.status(404).end();
+
+            var boundary = 'p1stream-preview';
+            res.useChunkedEncodingByDefault = false;
+            res.set('Connection', 'close');
+            res.set('Cache-Control', 'no-cache');
+            res.set('Content-Type', 'multipart/x-mixed-replace; boundary=' + boundary);
+
+            var destroy = req.obj.addPreviewListener(function(frame) {
+                res.write(
+                    '--' + boundary + '\r\n' +
+                    'Content-Type: image/jpeg\r\n' +
+                    'Content-Length: ' + frame.buf.length + '\r\n\r\n'
+                );
+                res.write(frame.buf);
+                res.write('\r\n');
+            });
+            res.on('close', function() {
+                destroy();
+            });
+        }
+    );
+
+    // Latest preview frame as a single JPEG. If the preview is not running,
+    // this starts the mixer and waits for the first frame.
+    app.get('/api/mixers/:id.jpg',
+        app.resolveParam('id', 'mixer'),
+        function(req, res, next) {
+            if (!req.obj)
+                return res.status(404).end();
+
+            var done = false;
+            var timeout = setTimeout(function() {
+                if (finish())
+                    res.status(503).end();
+            }, 10000);
+
+            // The listener may be called before we have the cancel function.
+            var destroy = req.obj.addPreviewListener(function(frame) {
+                if (finish()) {
+                    res.set('Cache-Control', 'no-cache');
+                    res.set('Content-Type', 'image/jpeg').end(frame.buf);
+                }
+            });
+            if (done)
+                destroy();
+            res.on('close', finish);
+
+            function finish() {
+                if (done)
+                    return false;
+                done = true;
+
+                clearTimeout(timeout);
+                if (destroy)
+                    destroy();
+                return true;
+            }
+        }
+    );
+
     // HLS playlist file.
     app.get('/api/mixers/:id.m3u8',
         app.resolveParam('id', 'mixer'),
@@ -23,6 +23,7 @@ T.MaxBlockAdditionID = tag(0x55EE, 'u');
 T.CodecID = tag(0x86, 's');
 T.CodecPrivate = tag(0x63A2, 'b');
 T.CodecDecodeAll = tag(0xAA, 'u');
+T.CodecDelay = tag(0x56AA, 'u');
 T.SeekPreRoll = tag(0x56BB, 'u');
 T.Video = tag(0xE0, 'm');
 T.FlagInterlaced = tag(0x9A, 'u');
@@ -107,21 +108,44 @@ function buildHeaders(videoHeaders, audioHeaders) {
                     T.FlagForced(1),
                     T.FlagLacing(0),
                     T.MinCache(0),
-                    T.MaxBlockAdditionID(0),
-                    T.CodecID('A_AAC'),
-                    T.CodecPrivate(audioHeaders.buf),
-                    T.CodecDecodeAll(1),
-                    T.SeekPreRoll(0),
-                    T.Audio([
-                        T.SamplingFrequency(44100),
-                        T.Channels(2)
-                    ])
-                ])
+                    T.MaxBlockAdditionID(0)
+                ].concat(buildAudioCodec(audioHeaders)))
             ])
         ], true)
     ]);
 }
 
+// Codec elements of the audio track. The Opus mapping describes timing at
+// 48 kHz, with the encoder delay from the OpusHead pre-skip field.
+function buildAudioCodec(audioHeaders) {
+    if (audioHeaders.codec === 'opus') {
+        var preSkip = audioHeaders.buf.readUInt16LE(10);
+        return [
+            T.CodecID('A_OPUS'),
+            T.CodecPrivate(audioHeaders.buf),
+            T.CodecDecodeAll(1),
+            T.CodecDelay(Math.round(preSkip * 1000000000 / 48000)),
+            T.SeekPreRoll(80000000),  // 80ms
+            T.Audio([
+                T.SamplingFrequency(48000),
+                T.Channels(audioHeaders.channels)
+            ])
+        ];
+    }
+    else {
+        return [
+            T.CodecID('A_AAC'),
+            T.CodecPrivate(audioHeaders.buf),
+            T.CodecDecodeAll(1),
+            T.SeekPreRoll(0),
+            T.Audio([
+                T.SamplingFrequency(audioHeaders.sampleRate),
+                T.Channels(audioHeaders.channels)
+            ])
+        ];
+    }
+}
+
 function buildVideoFrame(frame) {
     var b;
     var block = [];
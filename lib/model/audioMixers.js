@@ -5,6 +5,9 @@ module.exports = function(app) {
     // Define the audio mixer type.
     app.store.onCreate('audio-mixer', function(obj) {
         obj._sources = [];
+        obj._encodingHeaders = Object.create(null);
+        obj.stats = null;
+        obj.levels = null;
 
         obj.setSources = function(list) {
             _.each(obj._sources, function(source) {
@@ -26,9 +29,28 @@ module.exports = function(app) {
             });
         });
 
+        // Native events carry the index of the encoding, which is mapped to
+        // the configured id. The first encoding is the primary one, which is
+        // also emitted as plain 'headers' and 'frame' events.
+        var encodingIds = [0];
+
         obj.activation('native audio mixer', {
             start: function(lg) {
+                var encodings = obj.cfg.encodings;
+                encodingIds = encodings ? _.map(encodings, function(enc, idx) {
+                    return enc.id !== undefined ? enc.id : idx;
+                }) : [0];
+
                 obj._instance = new native.AudioMixer({
+                    sampleRate: obj.cfg.sampleRate,
+                    codec: obj.cfg.codec,
+                    channels: obj.cfg.channels,
+                    bitrate: obj.cfg.bitrate,
+                    frameDuration: obj.cfg.frameDuration,
+                    encodings: encodings,
+                    interval: obj.cfg.interval,
+                    latency: obj.cfg.latency,
+                    levelsRate: obj.cfg.levelsRate,
                     onEvent: onEvent
                 });
                 app.mark();
@@ -38,25 +60,55 @@ module.exports = function(app) {
                 function updateSources(list) {
                     obj._instance.setSources(list);
                 }
+
+                // Periodically export per-source input statistics.
+                obj._statsTimer = setInterval(function() {
+                    obj.stats = obj._instance.stats();
+                    app.mark();
+                }, 1000);
             },
             stop: function() {
+                clearInterval(obj._statsTimer);
+                obj._statsTimer = null;
+                obj.stats = null;
+                obj.levels = null;
+
                 obj._instance.destroy();
                 obj._instance = null;
+                obj._encodingHeaders = Object.create(null);
                 app.mark();
             }
         });
 
         function onEvent(id, arg) {
+            var primary;
             switch (id) {
                 case native.EV_AUDIO_HEADERS:
-                    obj._headers = arg;
+                    primary = arg.encoding === 0;
+                    arg.encoding = encodingIds[arg.encoding];
+                    obj._encodingHeaders[arg.encoding] = arg;
+                    if (primary)
+                        obj._headers = arg;
                     app.mark();
 
-                    obj.emit('headers', arg);
+                    if (primary)
+                        obj.emit('headers', arg);
+                    obj.emit('encodingHeaders', arg);
                     break;
 
                 case native.EV_AUDIO_FRAME:
-                    obj.emit('frame', arg);
+                    primary = arg.encoding === 0;
+                    arg.encoding = encodingIds[arg.encoding];
+                    if (primary)
+                        obj.emit('frame', arg);
+                    obj.emit('encodingFrame', arg);
+                    break;
+
+                case native.EV_AUDIO_LEVELS:
+                    obj.levels = arg;
+                    app.mark();
+
+                    obj.emit('levels', arg);
                     break;
 
                 default:
@@ -9,7 +9,68 @@ module.exports = function(app) {
             start: function() {
                 obj._instance = new native.SoftwareClock({
                     numerator: obj.cfg.numerator || 1,
-                    denominator: obj.cfg.denominator || 30
+                    denominator: obj.cfg.denominator || 30,
+                    threads: obj.cfg.threads
+                });
+                app.mark();
+            },
+            stop: function() {
+                obj._instance.destroy();
+                obj._instance = null;
+                app.mark();
+            }
+        });
+    });
+
+    // Define the high-precision clock type. Only available on Linux.
+    if (native.PreciseClock) {
+        app.store.onCreate('clock:p1stream:precise-clock', function(obj) {
+            obj._instance = null;
+            obj.stats = null;
+
+            obj.activation('native precise clock', {
+                start: function() {
+                    obj._instance = new native.PreciseClock({
+                        numerator: obj.cfg.numerator || 1,
+                        denominator: obj.cfg.denominator || 30,
+                        realtimePriority: obj.cfg.realtimePriority,
+                        cpu: obj.cfg.cpu,
+                        threads: obj.cfg.threads
+                    });
+                    app.mark();
+
+                    // Periodically export jitter and dispatch statistics.
+                    obj._statsTimer = setInterval(function() {
+                        obj.stats = obj._instance.stats();
+                        app.mark();
+                    }, 1000);
+                },
+                stop: function() {
+                    clearInterval(obj._statsTimer);
+                    obj._statsTimer = null;
+
+                    obj._instance.destroy();
+                    obj._instance = null;
+                    obj.stats = null;
+                    app.mark();
+                }
+            });
+        });
+    }
+
+    // Define the offline clock type. This ticks as fast as the mixers can
+    // keep up, for faster than realtime rendering.
+    app.store.onCreate('clock:p1stream:offline-clock', function(obj) {
+        obj._instance = null;
+
+        obj.activation('native offline clock', {
+            start: function() {
+                obj._instance = new native.OfflineClock({
+                    numerator: obj.cfg.numerator || 1,
+                    denominator: obj.cfg.denominator || 30,
+                    limit: obj.cfg.limit,
+                    maxPending: obj.cfg.maxPending,
+                    threads: obj.cfg.threads
                 });
                 app.mark();
             },
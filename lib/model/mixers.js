@@ -1,10 +1,13 @@
 var _ = require('lodash');
 var ListenerGroup = require('../listenerGroup');
+var native = require('../../build/Release/native.node');
 
 module.exports = function(app) {
     app.store.onCreate('mixer', function(obj) {
         obj._videoHooks = [];
+        obj._audioEncodingHeaders = Object.create(null);
         obj.numFrameListeners = 0;
+        obj.numPreviewListeners = 0;
         obj.resolve('scene');
 
         // Activate when we have listeners.
@@ -46,6 +49,9 @@ module.exports = function(app) {
                 }, function(list) {
                     obj._videoMixer.setHooks(list);
                 }, 1);
+
+                // Connect taps.
+                updateVideoTaps();
             },
             stop: function() {
                 obj._videoMixer.unref(obj);
@@ -76,6 +82,16 @@ module.exports = function(app) {
                     obj.emit('audioFrame', frame);
                 });
 
+                // All encodings, for consumers that pick one by id.
+                lg.listen(obj._audioMixer, 'encodingHeaders', function(headers) {
+                    obj._audioEncodingHeaders[headers.encoding] = headers;
+                    obj.emit('audioEncodingHeaders', headers);
+                });
+
+                lg.listen(obj._audioMixer, 'encodingFrame', function(frame) {
+                    obj.emit('audioEncodingFrame', frame);
+                });
+
                 // Connect sources.
                 lg.watchValue(function() {
                     return obj._scene && obj._scene._nativeAudioList;
@@ -88,9 +104,120 @@ module.exports = function(app) {
                 obj._audioMixer = null;
 
                 obj._audioHeaders = null;
+                obj._audioEncodingHeaders = Object.create(null);
+            }
+        });
+
+        // Preview generator activation. One generator is shared by all
+        // preview viewers of this mixer.
+        obj.activation('preview generator', {
+            cond: function() {
+                return this.activationCond() && this.numPreviewListeners;
+            },
+            start: function() {
+                var cfg = obj.cfg.preview || {};
+                obj._preview = new native.PreviewGenerator({
+                    width: cfg.width || 320,
+                    height: cfg.height || 180,
+                    numerator: 1,
+                    denominator: cfg.fps || 2,
+                    quality: cfg.quality,
+                    onEvent: onPreviewEvent
+                });
+                updateVideoTaps();
+                app.mark();
+            },
+            stop: function() {
+                // Detach before the native object goes.
+                var preview = obj._preview;
+                obj._preview = null;
+                updateVideoTaps();
+
+                preview.destroy();
+                obj._previewFrame = null;
+                app.mark();
+            }
+        });
+
+        // Shared-memory export activation, if configured and supported. This
+        // keeps the mixer running, because consumers are outside our view.
+        obj.activation('shared memory export', {
+            cond: function() {
+                return this.activationCond() && this.cfg.export && native.ShmExporter;
+            },
+            start: function() {
+                obj._exportListener = obj.addFrameListener({});
+
+                obj._export = new native.ShmExporter({
+                    path: obj.cfg.export.path,
+                    slots: obj.cfg.export.slots,
+                    onEvent: function(id, arg) {
+                        obj.handleNativeEvent(id, arg);
+                    }
+                });
+                updateVideoTaps();
+                app.mark();
+            },
+            stop: function() {
+                var exporter = obj._export;
+                obj._export = null;
+                updateVideoTaps();
+
+                exporter.destroy();
+                obj._exportListener();
+                obj._exportListener = null;
+                app.mark();
             }
         });
 
+        // Apply the list of native taps to the video mixer. This happens
+        // right away, so taps can be destroyed after.
+        function updateVideoTaps() {
+            if (!obj._videoMixer)
+                return;
+
+            var list = [];
+            if (obj._preview)
+                list.push({ tap: obj._preview });
+            if (obj._export)
+                list.push({ tap: obj._export });
+            obj._videoMixer.setTaps(list);
+        }
+
+        function onPreviewEvent(id, arg) {
+            switch (id) {
+                case native.EV_PREVIEW_FRAME:
+                    obj._previewFrame = arg;
+                    obj.emit('previewFrame', arg);
+                    break;
+
+                default:
+                    obj.handleNativeEvent(id, arg);
+                    break;
+            }
+        }
+
+        // Listen for preview frames, which are JPEG stills at a low rate.
+        // Calls the listener with the latest frame right away, if there is
+        // one. Returns a function to cancel listening. This also counts as
+        // a frame listener, so the mixer starts running.
+        obj.addPreviewListener = function(fn) {
+            obj.numPreviewListeners++;
+            var destroy = obj.addFrameListener({ previewFrame: fn });
+
+            if (obj._previewFrame)
+                fn(obj._previewFrame, obj);
+
+            return function() {
+                if (!destroy)
+                    return;
+
+                obj.numPreviewListeners--;
+                destroy();
+                destroy = null;
+            };
+        };
+
         // Listen for frame events. Takes a map of events to listener
         // functions. Returns a function to cancel listening. Will also
         // increase numFrameListeners and cause the mixer to start running.
@@ -114,6 +241,11 @@ module.exports = function(app) {
             if (options && options.emitInitHeaders) {
                 if (events.audioHeaders && obj._audioHeaders)
                     events.audioHeaders(obj._audioHeaders, obj);
+                if (events.audioEncodingHeaders) {
+                    _.each(obj._audioEncodingHeaders, function(headers) {
+                        events.audioEncodingHeaders(headers, obj);
+                    });
+                }
                 if (events.videoHeaders && obj._videoHeaders)
                     events.videoHeaders(obj._videoHeaders, obj);
             }
@@ -20,9 +20,40 @@ module.exports = function(app) {
             obj._nativeAudioList = list;
         }, 2);
 
+        // Video elements may define a source inline, with a full source
+        // config in `source` instead of a `sourceId`. For example:
+        // `{ source: { type: 'source:video:p1stream:shm', path: '...' } }`.
+        // These are ephemeral objects owned by the scene, and are recreated
+        // when any inline config changes.
+        obj._inlineVideoSources = [];
+        obj.watchValue(function() {
+            return _.pluck(obj.cfg.video, 'source');
+        }, function(cfgs) {
+            releaseInlineVideoSources();
+            obj._inlineVideoSources = _.map(cfgs, function(cfg) {
+                if (!cfg)
+                    return null;
+
+                var source = app.store.create(_.cloneDeep(cfg));
+                source._ephemeral = true;
+                source.ref(obj);
+                return source;
+            });
+        }, 10);
+        obj.on('destroy', releaseInlineVideoSources);
+        function releaseInlineVideoSources() {
+            _.each(obj._inlineVideoSources, function(source) {
+                if (source)
+                    source.unref(obj);
+            });
+            obj._inlineVideoSources = [];
+        }
+
         // Resolve and build a native list of video sources.
         obj.resolveAll('videoSources', function() {
-            return _.pluck(obj.cfg.video, 'sourceId');
+            return _.map(obj.cfg.video, function(el, idx) {
+                return el.sourceId || obj._inlineVideoSources[idx];
+            });
         });
         obj.watchValue(function() {
             return _.map(obj._videoSources, function(source, idx) {
@@ -37,7 +68,8 @@ module.exports = function(app) {
                     u1: el.u1 || 0,
                     v1: el.v1 || 0,
                     u2: el.u2 || 0,
-                    v2: el.v2 || 0
+                    v2: el.v2 || 0,
+                    latency: el.latency || 0
                 };
             });
         }, function(list) {
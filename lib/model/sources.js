@@ -1,4 +1,5 @@
 var _ = require('lodash');
+var native = require('../../build/Release/native.node');
 
 module.exports = function(app) {
     // Define a generic source category.
@@ -43,4 +44,140 @@ module.exports = function(app) {
             app.mark();
         });
     });
+
+    // Define the shared-memory video source type, which reads frames from
+    // another process. Only available on Linux.
+    if (native.ShmSource) {
+        app.store.onCreate('source:video:p1stream:shm', function(obj) {
+            obj._instance = null;
+            obj.stats = null;
+
+            obj.activation('native shared memory source', {
+                start: function() {
+                    obj._instance = new native.ShmSource({
+                        path: obj.cfg.path,
+                        onEvent: function(id, arg) {
+                            obj.handleNativeEvent(id, arg);
+                        }
+                    });
+                    app.mark();
+
+                    // Periodically export attach state and lag statistics.
+                    obj._statsTimer = setInterval(function() {
+                        obj.stats = obj._instance.stats();
+                        app.mark();
+                    }, 1000);
+                },
+                stop: function() {
+                    clearInterval(obj._statsTimer);
+                    obj._statsTimer = null;
+
+                    obj._instance.destroy();
+                    obj._instance = null;
+                    obj.stats = null;
+                    app.mark();
+                }
+            });
+        });
+    }
+
+    // Define the file video source type, which plays a Y4M or raw BGRA file
+    // for reproducible tests.
+    app.store.onCreate('source:video:p1stream:file', function(obj) {
+        obj._instance = null;
+        obj.stats = null;
+
+        obj.activation('native file video source', {
+            start: function() {
+                obj._instance = new native.FileVideoSource({
+                    path: obj.cfg.path,
+                    width: obj.cfg.width,
+                    height: obj.cfg.height,
+                    numerator: obj.cfg.numerator,
+                    denominator: obj.cfg.denominator,
+                    loop: obj.cfg.loop
+                });
+                app.mark();
+
+                // Periodically export playback statistics.
+                obj._statsTimer = setInterval(function() {
+                    obj.stats = obj._instance.stats();
+                    app.mark();
+                }, 1000);
+            },
+            stop: function() {
+                clearInterval(obj._statsTimer);
+                obj._statsTimer = null;
+
+                obj._instance.destroy();
+                obj._instance = null;
+                obj.stats = null;
+                app.mark();
+            }
+        });
+    });
+
+    // Define the file audio source type, which streams a WAV file.
+    app.store.onCreate('source:audio:p1stream:file', function(obj) {
+        obj._instance = null;
+
+        obj.activation('native file audio source', {
+            start: function() {
+                obj._instance = new native.FileAudioSource({
+                    path: obj.cfg.path,
+                    loop: obj.cfg.loop
+                });
+                app.mark();
+            },
+            stop: function() {
+                obj._instance.destroy();
+                obj._instance = null;
+                app.mark();
+            }
+        });
+    });
+
+    // Define the test pattern video source type. Patterns are 'bars',
+    // 'zoneplate', 'gradient' and 'noise'.
+    app.store.onCreate('source:video:p1stream:testpattern', function(obj) {
+        obj._instance = null;
+
+        obj.activation('native test pattern source', {
+            start: function() {
+                obj._instance = new native.TestPatternSource({
+                    width: obj.cfg.width || 1280,
+                    height: obj.cfg.height || 720,
+                    type: obj.cfg.pattern,
+                    entropy: obj.cfg.entropy
+                });
+                app.mark();
+            },
+            stop: function() {
+                obj._instance.destroy();
+                obj._instance = null;
+                app.mark();
+            }
+        });
+    });
+
+    // Define the tone audio source type. Waveforms are 'sine', 'sweep' and
+    // 'pink'.
+    app.store.onCreate('source:audio:p1stream:tone', function(obj) {
+        obj._instance = null;
+
+        obj.activation('native tone source', {
+            start: function() {
+                obj._instance = new native.ToneSource({
+                    type: obj.cfg.waveform,
+                    frequency: obj.cfg.frequency
+                });
+                app.mark();
+            },
+            stop: function() {
+                obj._instance.destroy();
+                obj._instance = null;
+                app.mark();
+            }
+        });
+    });
 };
@@ -1,11 +1,14 @@
 var _ = require('lodash');
+var path = require('path');
 var native = require('../../build/Release/native.node');
+var userPaths = require('../userPaths');
 
 module.exports = function(app) {
     // Define the video mixer type.
     app.store.onCreate('video-mixer', function(obj) {
         obj._sources = [];
         obj._hooks = [];
+        obj._taps = [];
 
         obj.setSources = function(list) {
             _.each(obj._sources, function(source) {
@@ -26,6 +29,11 @@ module.exports = function(app) {
             obj.emit('hooksChanged', obj._hooks);
         };
 
+        obj.setTaps = function(list) {
+            obj._taps = list || [];
+            obj.emit('tapsChanged', obj._taps);
+        };
+
         obj.on('destroy', function() {
             _.each(obj._sources, function(source) {
                 source._obj.unref(obj);
@@ -54,6 +62,7 @@ module.exports = function(app) {
                     width: 1280,
                     height: 720,
                     clock: obj._clock._instance,
+                    cacheDir: path.join(userPaths.cachePath(), 'programs'),
                     onEvent: onEvent
                 });
                 app.mark();
@@ -69,6 +78,12 @@ module.exports = function(app) {
                 function updateHooks(list) {
                     obj._instance.setHooks(list);
                 }
+
+                updateTaps(obj._taps);
+                lg.listen(obj, 'tapsChanged', updateTaps);
+                function updateTaps(list) {
+                    obj._instance.setTaps(list);
+                }
             },
             stop: function() {
                 obj._instance.destroy();
@@ -26,6 +26,12 @@ function padPacket(b, i, num) {
     return i + 4 + (b[i+3] & 0x20 ? b[i+4] + 1 : 0);
 }
 
+// ADTS sampling frequency indices.
+var adtsSampleRates = [
+    96000, 88200, 64000, 48000, 44100, 32000,
+    24000, 22050, 16000, 12000, 11025, 8000
+];
+
 module.exports = function(mixer, dataCb) {
     var lastPcr = 0;
     var seqs = Object.create(null);
@@ -35,8 +41,10 @@ module.exports = function(mixer, dataCb) {
         videoFrame: onVideoFrame
     });
 
+    // ADTS only carries AAC, so other codecs are left out of the stream.
     function onAudioFrame(frame) {
-        dataCb(buildAudioFrame(frame));
+        if (mixer._audioHeaders && mixer._audioHeaders.codec !== 'opus')
+            dataCb(buildAudioFrame(frame, mixer._audioHeaders));
     }
 
     function onVideoFrame(frame) {
@@ -154,14 +162,16 @@ module.exports = function(mixer, dataCb) {
         return packFrame(b, 0x23, 0xE0, frame.dts, 0);
     }
 
-    function buildAudioFrame(frame) {
+    function buildAudioFrame(frame, headers) {
         // ADTS header
         var length = 7 + frame.buf.length;
+        var freq = adtsSampleRates.indexOf(headers.sampleRate);
+        var channels = headers.channels;
         var b = new Buffer(length);
         b[0] = 0xFF;
         b[1] = 0xF1;  // MPEG-4, no CRC
-        b[2] = 0x50;  // AAC LC, 44.1kHz
-        b[3] = 0x80 | ((length & 0x1800) >> 11);  // Stereo
+        b[2] = 0x40 | (freq << 2) | (channels >> 2);  // AAC LC
+        b[3] = ((channels & 0x03) << 6) | ((length & 0x1800) >> 11);
         b[4] = (length & 0x07F8) >> 3;
         b[5] = ((length & 0x0007) << 5) | 0x1F;
         b[6] = 0xFC;  // 1 frame
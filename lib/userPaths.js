@@ -40,6 +40,19 @@ exports.dataPath = function() {
     }
 };
 
+// Path to our writeable cache directory. Contents may be deleted at any time.
+exports.cachePath = function() {
+    switch (process.platform) {
+        case 'darwin':
+            return path.join(process.env.HOME,
+                'Library', 'Caches', 'P1stream');
+        default:
+            var cacheHome = process.env.XDG_CACHE_HOME ||
+                path.join(process.env.HOME, '.cache');
+            return path.join(cacheHome, 'p1stream');
+    }
+};
+
 // Paths to data directories.
 exports.dataReadPaths = function() {
     switch (process.platform) {
@@ -74,7 +87,8 @@ exports.pluginSearchPaths = function() {
 exports.createWriteableDirsSync = function() {
     var dirs = [
         exports.logPath(),
-        exports.dataPath()
+        exports.dataPath(),
+        exports.cachePath()
     ];
     dirs.forEach(function(dir) {
         try {
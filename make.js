@@ -84,6 +84,12 @@ bu.taskRunner({
     // Incremental build of just the core native module.
     'native': function(cb) {
         bu.run('p1-build node-gyp build', cb);
+    },
+
+    // Run the headless pipeline benchmark with default settings. Requires a
+    // native build, which includes the bench target.
+    'bench': function(cb) {
+        bu.run('iojs tools/bench.js', cb);
     }
 
 });
@@ -1,55 +1,113 @@
 #include "p1stream_priv.h"
 
 #include <vector>
+#include <algorithm>
 #include <utility>
+#include <math.h>
 #include <string.h>
 #include <node_buffer.h>
 
 namespace p1stream {
 
-// Audio frame event. One of these is created per aacEncEncode call. The struct
-// is directly followed by the payload.
+// Audio frame event. One of these is created per encoded frame, and is tagged
+// with the index of the encoding. The struct is directly followed by
+// the payload.
 struct audio_frame_data {
+    uint32_t encoding;
     int64_t pts;
 
     size_t size;
     uint8_t data[0];
 };
 
-// Hardcoded format parameters.
-static const int sample_rate = 44100;
-static const int num_channels = 2;
+// Audio headers event. The struct is directly followed by the encoder
+// configuration, AudioSpecificConfig for AAC or the OpusHead packet for Opus.
+struct audio_headers_data {
+    uint32_t encoding;
+    audio_codec_t codec;
+    uint32_t sample_rate;
+    uint32_t num_channels;
+    uint32_t bit_rate;
 
-// We have a mix buffer of one second, but 'now' is roughly the center. This
-// allows sources to write to the buffer going back slightly, but also
-// forward. The latter happens because the mix thread only processes at an
-// interval, and the source may have lower latency.
-static const int mix_samples = num_channels * sample_rate;
-static const int mix_half_samples = mix_samples / 2;
-static const int mix_interval = 300000000;  // 300ms
+    size_t size;
+    uint8_t data[0];
+};
+
+// Audio levels event. Peaks and RMS are linear and per channel, for the master
+// followed by each source. Loudness of the master is in LUFS.
+struct audio_level {
+    float peak[2];
+    float rms[2];
+};
+
+struct audio_levels_data {
+    int64_t time;
+    float momentary;
+    float short_term;
+    uint32_t num_sources;
+    audio_level master;
+    audio_level sources[0];
+};
+
+// Sources render, and we mix, interleaved stereo at the mixer sample rate.
+// Mono output is downmixed just before encoding.
+static const int mix_channels = 2;
+
+// Sample rates supported by AAC, and the subset supported by Opus.
+static const uint32_t valid_sample_rates[] = {
+    8000, 11025, 12000, 16000, 22050, 24000, 32000, 44100, 48000, 64000, 88200, 96000
+};
+static const uint32_t opus_sample_rates[] = {
+    8000, 12000, 16000, 24000, 48000
+};
+
+// The mix buffer is a ring addressed by absolute sample position. Frames are
+// encoded as soon as all sources delivered them, but wait at most the latency
+// for late sources, 500ms by default. The mix thread runs at least every
+// interval, 300ms by default. Both can be lowered to a single encoder frame.
+// The buffer holds twice their sum, so sources can write to it going back
+// slightly, but also forward, because sources may have lower latency.
+static const int64_t default_mix_interval = 300000000;  // 300ms
+static const int64_t default_mix_latency = 500000000;  // 500ms
+static const int64_t max_mix_timing = 5000000000;  // 5s
 
-// Hardcoded encoder paramters.
-static const int enc_bit_rate = 128 * 1024;
-static const int enc_frame_size = 1024;
-static const int enc_frame_samples = enc_frame_size * num_channels;
-static const int enc_out_bytes = 6144 / 8 * num_channels;
+static_assert(sizeof(INT_PCM) == sizeof(int16_t), "Expected 16-bit PCM input to the encoder");
+
+// Encoder parameters. The mix buffer size is a power of two, and at least a
+// frame, so encoder frames never wrap.
+static const int default_bit_rate = 128 * 1024;
+static const uint32_t max_encodings = 8;
+static const int enc_frame_size = audio_encoder::frame_size;
+static const int enc_frame_samples = enc_frame_size * mix_channels;
+
+// Highest rate of level events, and the floor of levels in dB.
+static const double max_levels_rate = 100;
+static const double min_level_db = -100;
+
+// Opus always describes timing at 48 kHz, regardless of the input rate.
+static const uint32_t opus_rate = 48000;
 
 // Helper functions.
+static bool parse_encoding_params(Isolate *isolate, Handle<Object> obj, audio_encoding_params &params);
+static bool check_encoding_params(Isolate *isolate, audio_encoding_params &params, uint32_t sample_rate);
 static Local<Value> audio_events_transform(Isolate *isolate, event &ev, buffer_slicer &slicer);
 static Local<Value> audio_frame_to_js(Isolate *isolate, audio_frame_data &frame, buffer_slicer &slicer);
+static Local<Value> audio_headers_to_js(Isolate *isolate, audio_headers_data &headers, buffer_slicer &slicer);
+static Local<Value> audio_levels_to_js(Isolate *isolate, audio_levels_data &levels);
 
 
 audio_mixer_full::audio_mixer_full() :
     buffer(this, audio_events_transform, 196608),  // 192 KiB event buffer
-    mix_buffer(), enc(), running()
+    sample_rate(), mix_interval(), mix_latency(),
+    mix_buffer(), mix_samples(), mix_mask(), mix_latency_samples(),
+    mix_start_time(), mix_pos(), mix_time(),
+    kernels(&best_audio_kernels()), running(), wake_pending(), wake_time(0),
+    levels_rate(), levels_frames()
 {
 }
 
 void audio_mixer_full::init(const FunctionCallbackInfo<Value>& args)
 {
-    bool ok;
-    AACENC_ERROR aac_err;
-    AACENC_InfoStruct aac_info;
     isolate = args.GetIsolate();
     Handle<Value> val;
 
@@ -60,6 +118,100 @@ void audio_mixer_full::init(const FunctionCallbackInfo<Value>& args)
     }
     auto params = args[0].As<Object>();
 
+    sample_rate = 44100;
+    val = params->Get(sample_rate_sym.Get(isolate));
+    if (!val->IsUndefined()) {
+        sample_rate = val->IsUint32() ? val->Uint32Value() : 0;
+        auto *end = valid_sample_rates + sizeof(valid_sample_rates) / sizeof(valid_sample_rates[0]);
+        if (std::find(valid_sample_rates, end, sample_rate) == end) {
+            isolate->ThrowException(Exception::TypeError(
+                String::NewFromUtf8(isolate, "Invalid sample rate")));
+            return;
+        }
+    }
+
+    // Top-level encoding parameters are the defaults for the list. Without
+    // a list, they describe the only encoding.
+    audio_encoding_params defaults = { AUDIO_CODEC_AAC, 2, default_bit_rate, 20 };
+    if (!parse_encoding_params(isolate, params, defaults))
+        return;
+
+    std::vector<audio_encoding_params> encoding_params;
+    val = params->Get(encodings_sym.Get(isolate));
+    if (val->IsUndefined()) {
+        encoding_params.push_back(defaults);
+    }
+    else {
+        if (!val->IsArray()) {
+            isolate->ThrowException(Exception::TypeError(
+                String::NewFromUtf8(isolate, "Expected an array of encodings")));
+            return;
+        }
+        auto arr = val.As<Array>();
+        uint32_t len = arr->Length();
+        if (len == 0 || len > max_encodings) {
+            isolate->ThrowException(Exception::TypeError(
+                String::NewFromUtf8(isolate, "Invalid number of encodings")));
+            return;
+        }
+        for (uint32_t i = 0; i < len; i++) {
+            auto el = arr->Get(i);
+            if (!el->IsObject()) {
+                isolate->ThrowException(Exception::TypeError(
+                    String::NewFromUtf8(isolate, "Expected only objects in the encodings array")));
+                return;
+            }
+            encoding_params.push_back(defaults);
+            if (!parse_encoding_params(isolate, el.As<Object>(), encoding_params.back()))
+                return;
+        }
+    }
+
+    // The codec may come from either level, so check the combination last.
+    for (auto &p : encoding_params) {
+        if (!check_encoding_params(isolate, p, sample_rate))
+            return;
+    }
+
+    // Timing is given in milliseconds, and raised to at least one frame.
+    int64_t frame_time = (int64_t) enc_frame_size * 1000000000 / sample_rate;
+
+    mix_interval = default_mix_interval;
+    val = params->Get(interval_sym.Get(isolate));
+    if (!val->IsUndefined()) {
+        mix_interval = val->IsNumber() ? (int64_t) (val->NumberValue() * 1000000) : 0;
+        if (mix_interval <= 0 || mix_interval > max_mix_timing) {
+            isolate->ThrowException(Exception::TypeError(
+                String::NewFromUtf8(isolate, "Invalid interval")));
+            return;
+        }
+    }
+    mix_interval = std::max(mix_interval, frame_time);
+
+    mix_latency = default_mix_latency;
+    val = params->Get(latency_sym.Get(isolate));
+    if (!val->IsUndefined()) {
+        mix_latency = val->IsNumber() ? (int64_t) (val->NumberValue() * 1000000) : 0;
+        if (mix_latency <= 0 || mix_latency > max_mix_timing) {
+            isolate->ThrowException(Exception::TypeError(
+                String::NewFromUtf8(isolate, "Invalid latency")));
+            return;
+        }
+    }
+    mix_latency = std::max(mix_latency, frame_time);
+
+    levels_rate = 0;
+    val = params->Get(levels_rate_sym.Get(isolate));
+    if (!val->IsUndefined()) {
+        double rate = val->IsNumber() ? val->NumberValue() : -1;
+        if (!(rate >= 0 && rate <= max_levels_rate)) {
+            isolate->ThrowException(Exception::TypeError(
+                String::NewFromUtf8(isolate, "Invalid levels rate")));
+            return;
+        }
+        levels_rate = (uint32_t) rate;
+    }
+
     val = params->Get(on_event_sym.Get(isolate));
     if (!val->IsFunction()) {
         isolate->ThrowException(Exception::TypeError(
@@ -74,52 +226,32 @@ void audio_mixer_full::init(const FunctionCallbackInfo<Value>& args)
 
     buffer.set_callback(isolate->GetCurrentContext(), val.As<Function>());
 
-    aac_err = aacEncOpen(&enc, 0x01, 2);
-    if (!(ok = (aac_err == AACENC_OK)))
-        buffer.emitf(EV_LOG_ERROR, "aacEncOpen error 0x%x", aac_err);
-
-    if (ok) {
-        std::vector<std::pair<AACENC_PARAM, UINT>> params = {
-            { AACENC_AOT, AOT_AAC_LC },
-            { AACENC_SAMPLERATE, sample_rate },
-            { AACENC_CHANNELMODE, MODE_2 },
-            { AACENC_BITRATE, enc_bit_rate },
-            { AACENC_TRANSMUX, TT_MP4_RAW },
-            { AACENC_GRANULE_LENGTH, enc_frame_size }
-        };
-        for (auto &param : params) {
-            aac_err = aacEncoder_SetParam(enc, param.first, param.second);
-            if (!(ok = (aac_err == AACENC_OK))) {
-                buffer.emitf(EV_LOG_ERROR, "aacEncoder_SetParam error 0x%x", aac_err);
-                break;
-            }
-        }
-    }
-
-    if (ok) {
-        aac_err = aacEncEncode(enc, NULL, NULL, NULL, NULL);
-        if (!(ok = (aac_err == AACENC_OK)))
-            buffer.emitf(EV_LOG_ERROR, "aacEncEncode error 0x%x", aac_err);
-    }
-
-    if (ok) {
-        mix_buffer = new float[mix_samples];
-        mix_time = system_time() - samples_to_time(mix_half_samples);
-
-        aac_err = aacEncInfo(enc, &aac_info);
-        if (!(ok = (aac_err == AACENC_OK)))
-            buffer.emitf(EV_LOG_ERROR, "aacEncInfo error 0x%x", aac_err);
+    // Sources may call wake as soon as they are linked, even if we fail.
+    uv_cond_init(&wake_cond);
+
+    mix_latency_samples = time_to_samples(mix_latency);
+    size_t min_samples = time_to_samples(2 * (mix_interval + mix_latency)) + enc_frame_samples;
+    mix_samples = enc_frame_samples;
+    while (mix_samples < min_samples)
+        mix_samples *= 2;
+    mix_mask = mix_samples - 1;
+
+    mix_buffer = new float[mix_samples]();
+    mix_start_time = system_time() - samples_to_time(mix_latency_samples);
+    mix_pos = 0;
+    mix_time = mix_start_time;
+    wake_time = position_time(enc_frame_samples);
+
+    if (levels_rate != 0) {
+        levels_frames = (sample_rate + levels_rate - 1) / levels_rate;
+        loudness.init(sample_rate);
     }
 
-    if (ok) {
-        size_t claim = sizeof(audio_frame_data) + aac_info.confSize;
-        auto *ev = buffer.emit(EV_AUDIO_HEADERS, claim);
-        if (ev != NULL) {
-            auto &headers = *(audio_frame_data *) ev->data;
-            headers.pts = 0;
-            headers.size = aac_info.confSize;
-            memcpy(headers.data, aac_info.confBuf, aac_info.confSize);
-        }
+    bool ok = true;
+    for (uint32_t i = 0; ok && i < encoding_params.size(); i++) {
+        auto &p = encoding_params[i];
+        encoders.emplace_back(new audio_encoder());
+        ok = encoders.back()->init(this, i, sample_rate, p);
     }
 
     if (ok) {
@@ -135,23 +267,26 @@ void audio_mixer_full::destroy()
 {
     if (running) {
         running = false;
+        wake();
         thread.destroy();
     }
 
-    clear_sources();
+    // Sources may wake us until unlinked, so the condition outlives them.
+    {
+        lock_handle lock(thread);
+        clear_sources();
+    }
+    uv_cond_destroy(&wake_cond);
+
+    for (auto &encoder : encoders)
+        encoder->destroy();
+    encoders.clear();
 
     if (mix_buffer != nullptr) {
         delete[] mix_buffer;
         mix_buffer = nullptr;
     }
 
-    if (enc != NULL) {
-        AACENC_ERROR aac_err = aacEncClose(&enc);
-        enc = NULL;
-        if (aac_err != AACENC_OK)
-            buffer.emitf(EV_LOG_ERROR, "aacEncClose error 0x%x\n", aac_err);
-    }
-
     buffer.flush();
 
     Unref();
@@ -165,7 +300,7 @@ lockable *audio_mixer_full::lock()
 void audio_mixer_full::clear_sources()
 {
     for (auto &ctx : source_ctxes)
-        ctx.source()->unlink_audio_source(ctx);
+        ctx->source()->unlink_audio_source(*ctx);
     source_ctxes.clear();
 }
 
@@ -182,7 +317,7 @@ void audio_mixer_full::set_sources(const FunctionCallbackInfo<Value>& args)
     auto l_source_sym = source_sym.Get(isolate);
     auto l_volume_sym = volume_sym.Get(isolate);
 
-    std::vector<audio_source_context_full> new_ctxes;
+    std::vector<std::pair<audio_source *, float>> entries;
     for (uint32_t i = 0; i < len; i++) {
         auto val = arr->Get(i);
         if (!val->IsObject()) {
@@ -197,57 +332,208 @@ void audio_mixer_full::set_sources(const FunctionCallbackInfo<Value>& args)
             continue;
         auto *source = ObjectWrap::Unwrap<audio_source>(source_obj.As<Object>());
 
-        new_ctxes.emplace_back(this, source);
-        auto &ctx = new_ctxes.back();
-
-        ctx.volume = obj->Get(l_volume_sym)->NumberValue();
+        entries.emplace_back(source, obj->Get(l_volume_sym)->NumberValue());
     }
 
-    len = new_ctxes.size();
-
     // Parameters checked, from here on we no longer throw exceptions.
     lock_handle lock(thread);
 
     if (!running)
         return;
 
-    clear_sources();
-    source_ctxes = new_ctxes;
+    // Sources already in the list keep their context, so blocks not yet
+    // mixed and resampler state survive. Only the volume changes.
+    std::vector<std::unique_ptr<audio_source_context_full>> new_ctxes;
+    std::vector<audio_source_context_full *> added;
+    for (auto &entry : entries) {
+        auto it = std::find_if(source_ctxes.begin(), source_ctxes.end(),
+            [&](const std::unique_ptr<audio_source_context_full> &ctx) {
+                return ctx && ctx->source() == entry.first;
+            });
+        if (it != source_ctxes.end()) {
+            new_ctxes.push_back(std::move(*it));
+        }
+        else {
+            new_ctxes.emplace_back(new audio_source_context_full(this, entry.first));
+            added.push_back(new_ctxes.back().get());
+        }
+        new_ctxes.back()->volume = entry.second;
+    }
 
-    for (auto &ctx : source_ctxes)
-        ctx.source()->link_audio_source(ctx);
+    for (auto &ctx : source_ctxes) {
+        if (ctx)
+            ctx->source()->unlink_audio_source(*ctx);
+    }
+    source_ctxes.swap(new_ctxes);
+
+    for (auto *ctx : added)
+        ctx->source()->link_audio_source(*ctx);
 }
 
+bool audio_input_ring::write(int64_t time, const float *in, size_t samples, uint32_t rate)
+{
+    uint32_t h = head.load(std::memory_order_relaxed);
+    uint32_t t = tail.load(std::memory_order_acquire);
+
+    // The oldest unread block marks the start of used sample space. Only we
+    // write blocks, so it's safe to read one the consumer hasn't released.
+    uint32_t used = h == t ? 0 : write_pos - blocks[t % num_blocks].pos;
+    if (h - t == num_blocks || samples > num_samples - used) {
+        overruns.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    uint32_t start = write_pos & (num_samples - 1);
+    size_t first = std::min<size_t>(samples, num_samples - start);
+    memcpy(&data[start], in, first * sizeof(float));
+    if (samples > first)
+        memcpy(&data[0], in + first, (samples - first) * sizeof(float));
+
+    auto &b = blocks[h % num_blocks];
+    b.time = time;
+    b.pos = write_pos;
+    b.samples = samples;
+    b.rate = rate;
+    write_pos += samples;
+
+    head.store(h + 1, std::memory_order_release);
+    return true;
+}
+
+// Samples are interleaved stereo, at the sample rate of the mixer.
 void audio_source_context::render_buffer(int64_t time, float *in, size_t samples)
 {
-    auto &m = *((audio_mixer_full *) mixer_);
-    lock_handle lock(m.thread);
+    ((audio_source_context_full *) this)->render_buffer(time, in, samples, 0);
+}
 
-    if (!m.running)
+// Samples are interleaved stereo, at the given sample rate, or that of the
+// mixer if zero.
+void audio_source_context_full::render_buffer(int64_t time, float *in, size_t samples, uint32_t rate)
+{
+    // Wait-free, apart from a brief lock to wake the mixer thread once we've
+    // written past the end of the next frame it is to encode.
+    if (!ring->write(time, in, samples, rate))
         return;
 
+    auto *mixer = (audio_mixer_full *) mixer_;
+    int64_t end_time = time + (int64_t) (samples / mix_channels) * 1000000000 /
+        (rate != 0 ? rate : mixer->sample_rate);
+    if (end_time >= mixer->wake_time.load(std::memory_order_relaxed))
+        mixer->wake();
+}
+
+void audio_mixer_full::wake()
+{
+    lock_handle lock(wake_mutex);
+    wake_pending = true;
+    uv_cond_signal(&wake_cond);
+}
+
+// Wait for a wake-up or the timeout, with the main lock released. Returns
+// false if the thread should stop.
+bool audio_mixer_full::sleep(int64_t timeout)
+{
+    thread.unlock();
+    {
+        lock_handle lock(wake_mutex);
+        if (!wake_pending && running)
+            uv_cond_timedwait(&wake_cond, &wake_mutex.mutex, timeout);
+        wake_pending = false;
+    }
+    thread.lock();
+    return running;
+}
+
+// Mix all blocks sources have written since the last pass. Called from the
+// mixer thread, with the lock held. Returns the time up to which all sources
+// have delivered, or INT64_MIN if none have yet.
+int64_t audio_mixer_full::drain_inputs()
+{
+    typedef audio_input_ring r;
+    int64_t ready_time = INT64_MAX;
+
+    for (auto &ctx : source_ctxes) {
+        auto &ring = *ctx->ring;
+        uint32_t tail = ring.tail.load(std::memory_order_relaxed);
+        uint32_t head = ring.head.load(std::memory_order_acquire);
+
+        if (tail == head) {
+            if (ring.started) {
+                ring.underruns++;
+                ready_time = std::min(ready_time, ring.end_time);
+            }
+            continue;
+        }
+        ring.started = true;
+
+        for (; tail != head; tail++) {
+            auto &b = ring.blocks[tail % r::num_blocks];
+            ring.blocks_read++;
+            ring.samples_read += b.samples;
+
+            // The block is in two parts if it wraps around the end of the
+            // input ring.
+            uint32_t start = b.pos & (r::num_samples - 1);
+            size_t first = std::min<size_t>(b.samples, r::num_samples - start);
+            const float *part1 = &ring.data[start];
+            const float *part2 = &ring.data[0];
+            size_t rest = b.samples - first;
+
+            if (b.rate == 0 || b.rate == sample_rate) {
+                mix_input(b.time, part1, first, part2, rest, ctx->volume);
+                ring.end_time = b.time + samples_to_time(b.samples);
+                if (levels_rate != 0) {
+                    ring.meter.add(*kernels, part1, first);
+                    ring.meter.add(*kernels, part2, rest);
+                }
+            }
+            else {
+                auto &rs = ring.resampler;
+                size_t samples = rs.process(b.time, part1, first, part2, rest,
+                                            b.rate, sample_rate, *kernels);
+                if (samples != 0)
+                    mix_input(rs.out_time, rs.out.data(), samples, NULL, 0, ctx->volume);
+                ring.end_time = rs.output_time(rs.out_count);
+                if (levels_rate != 0)
+                    ring.meter.add(*kernels, rs.out.data(), samples);
+            }
+        }
+
+        ring.tail.store(tail, std::memory_order_release);
+        ready_time = std::min(ready_time, ring.end_time);
+    }
+
+    return ready_time == INT64_MAX ? INT64_MIN : ready_time;
+}
+
+// Mix samples starting at the given time, which may be given in two parts.
+// Samples outside the mix buffer are dropped.
+void audio_mixer_full::mix_input(int64_t time, const float *a, size_t a_len, const float *b, size_t b_len, float volume)
+{
+    size_t samples = a_len + b_len;
+
     // Check the lower bound of the mix buffer, and determine the start
     // position we're going to write samples to.
-    size_t mix_pos = 0;
-    if (time < m.mix_time) {
-        m.buffer.emitf(EV_LOG_WARN, "audio mixer underflow, dropping audio frames");
+    size_t skip = 0;
+    size_t offset = 0;
+    if (time < mix_time) {
+        buffer.emitf(EV_LOG_WARN, "audio mixer underflow, dropping audio frames");
 
-        size_t to_drop = m.time_to_samples(m.mix_time - time);
-        if (to_drop >= samples)
+        skip = time_to_samples(mix_time - time);
+        if (skip >= samples)
             return;
 
-        in += to_drop;
-        samples -= to_drop;
+        samples -= skip;
     }
     else {
-        mix_pos = m.time_to_samples(time - m.mix_time);
+        offset = time_to_samples(time - mix_time);
     }
 
     // Check the upperbound of the mix buffer, and determine the end
     // position we're going to write samples to.
-    size_t mix_end = mix_pos + samples;
+    size_t mix_end = offset + samples;
     if (mix_end > mix_samples) {
-        m.buffer.emitf(EV_LOG_WARN, "audio mixer overflow, dropping audio frames");
+        buffer.emitf(EV_LOG_WARN, "audio mixer overflow, dropping audio frames");
 
         size_t to_drop = mix_end - mix_samples;
         if (to_drop >= samples)
@@ -256,23 +542,366 @@ void audio_source_context::render_buffer(int64_t time, float *in, size_t samples
         samples -= to_drop;
     }
 
-    // Mix samples into the buffer.
-    float *p = m.mix_buffer + mix_pos;
-    float v = ((audio_source_context_full *) this)->volume;
-    while (samples--)
-        *(p++) += *(in++) * v;
+    // Apply the skip and truncation to the parts.
+    if (skip >= a_len) {
+        b += skip - a_len;
+        a_len = 0;
+    }
+    else {
+        a += skip;
+        a_len -= skip;
+    }
+    a_len = std::min(a_len, samples);
+    b_len = samples - a_len;
+
+    mix_into(offset, a, a_len, volume);
+    if (b_len != 0)
+        mix_into(offset + a_len, b, b_len, volume);
+}
+
+// Mix samples at an offset from the read position, in two parts if they wrap
+// around the end of the mix buffer. The caller checks bounds.
+void audio_mixer_full::mix_into(size_t offset, const float *in, size_t samples, float volume)
+{
+    size_t start = (mix_pos + offset) & mix_mask;
+    size_t first = std::min(samples, mix_samples - start);
+    kernels->mix(mix_buffer + start, in, first, volume);
+    if (samples > first)
+        kernels->mix(mix_buffer, in + first, samples - first, volume);
+}
+
+// Zero samples starting at an absolute position, so they can be reused.
+void audio_mixer_full::clear_mix(uint64_t pos, size_t samples)
+{
+    if (samples >= mix_samples) {
+        memset(mix_buffer, 0, mix_samples * sizeof(float));
+        return;
+    }
+
+    size_t start = pos & mix_mask;
+    size_t first = std::min(samples, mix_samples - start);
+    memset(mix_buffer + start, 0, first * sizeof(float));
+    if (samples > first)
+        memset(mix_buffer, 0, (samples - first) * sizeof(float));
+}
+
+void audio_mixer_full::stats(const FunctionCallbackInfo<Value>& args)
+{
+    lock_handle lock(thread);
+
+    auto arr = Array::New(isolate);
+    uint32_t i = 0;
+    for (auto &ctx : source_ctxes) {
+        auto &ring = *ctx->ring;
+        auto obj = Object::New(isolate);
+        obj->Set(String::NewFromUtf8(isolate, "blocks"), Number::New(isolate, ring.blocks_read));
+        obj->Set(String::NewFromUtf8(isolate, "samples"), Number::New(isolate, ring.samples_read));
+        obj->Set(String::NewFromUtf8(isolate, "overruns"), Number::New(isolate,
+            ring.overruns.load(std::memory_order_relaxed)));
+        obj->Set(String::NewFromUtf8(isolate, "underruns"), Number::New(isolate, ring.underruns));
+        arr->Set(i++, obj);
+    }
+
+    auto obj = Object::New(isolate);
+    obj->Set(String::NewFromUtf8(isolate, "sources"), arr);
+    obj->Set(String::NewFromUtf8(isolate, "latency"), latency.to_js(isolate));
+    auto encoder_arr = Array::New(isolate, encoders.size());
+    for (uint32_t i = 0; i < encoders.size(); i++)
+        encoder_arr->Set(i, encoders[i]->stats_to_js(isolate));
+    obj->Set(String::NewFromUtf8(isolate, "encoders"), encoder_arr);
+    args.GetReturnValue().Set(obj);
 }
 
 // The mixer thread loop.
 void audio_mixer_full::loop()
 {
-    int64_t enc_frame_time = samples_to_time(enc_frame_samples);
-    INT_PCM resbuf[enc_frame_samples];
-    UCHAR outbuf[enc_out_bytes];
+    // Continue until the thread is stopped.
+    while (sleep(mix_interval)) {
+        // If we fell behind by more than the mix buffer holds, the samples
+        // we'd process were dropped anyway. Skip ahead in whole encoder
+        // frames, so that the latency remains.
+        int64_t deadline_time = system_time() - mix_latency;
+        if (deadline_time > mix_time) {
+            size_t behind = time_to_samples(deadline_time - mix_time);
+            if (behind > mix_samples) {
+                size_t skip = (behind - mix_latency_samples) / enc_frame_samples * enc_frame_samples;
+                buffer.emitf(EV_LOG_WARN, "audio mixer lagging, skipping %d ms of audio",
+                             (int) (samples_to_time(skip) / 1000000));
+
+                clear_mix(mix_pos, skip);
+                mix_pos += skip;
+                mix_time = position_time(mix_pos);
+            }
+        }
+
+        // Encode frames every source has delivered, and those past the
+        // deadline for late sources.
+        int64_t target_time = std::max(drain_inputs(), deadline_time);
+        while (position_time(mix_pos + enc_frame_samples) <= target_time) {
+            // Hand the frame to the encoders, and clear the samples for reuse.
+            float *mixp = mix_buffer + (mix_pos & mix_mask);
+            for (auto &encoder : encoders)
+                encoder->push(mix_time, mixp);
+            if (levels_rate != 0) {
+                master_meter.add(*kernels, mixp, enc_frame_samples);
+                loudness.add(mixp, enc_frame_size);
+            }
+            memset(mixp, 0, enc_frame_samples * sizeof(float));
+
+            mix_pos += enc_frame_samples;
+            mix_time = position_time(mix_pos);
+            latency.record(system_time() - mix_time);
+
+            if (levels_rate != 0 && master_meter.frames >= levels_frames)
+                emit_levels();
+        }
+
+        // Sources wake us once they've written past the next frame.
+        wake_time.store(position_time(mix_pos + enc_frame_samples), std::memory_order_relaxed);
+    }
+}
+
+bool audio_encoder::init(audio_mixer_full *mixer_, uint32_t id_, uint32_t sample_rate_,
+                         const audio_encoding_params &params)
+{
+    bool ok;
+
+    mixer = mixer_;
+    id = id_;
+    codec = params.codec;
+    sample_rate = sample_rate_;
+    num_channels = params.num_channels;
+
+    if (codec == AUDIO_CODEC_OPUS)
+        ok = init_opus(params.bit_rate, params.frame_duration);
+    else
+        ok = init_aac(params.bit_rate);
 
-    void *in_desc_bufs[] = { resbuf };
+    if (ok) {
+        queue.resize(queue_size);
+        running = true;
+        uv_cond_init(&cond);
+        uv_thread_create(&thread, thread_cb, this);
+    }
+
+    return ok;
+}
+
+bool audio_encoder::init_aac(uint32_t bit_rate)
+{
+    bool ok;
+    AACENC_ERROR aac_err;
+    AACENC_InfoStruct aac_info;
+    auto &buffer = mixer->buffer;
+
+    aac_err = aacEncOpen(&enc, 0x01, num_channels);
+    if (!(ok = (aac_err == AACENC_OK)))
+        buffer.emitf(EV_LOG_ERROR, "aacEncOpen error 0x%x", aac_err);
+
+    if (ok) {
+        std::vector<std::pair<AACENC_PARAM, UINT>> params = {
+            { AACENC_AOT, AOT_AAC_LC },
+            { AACENC_SAMPLERATE, sample_rate },
+            { AACENC_CHANNELMODE, num_channels == 1 ? MODE_1 : MODE_2 },
+            { AACENC_BITRATE, bit_rate },
+            { AACENC_TRANSMUX, TT_MP4_RAW },
+            { AACENC_GRANULE_LENGTH, frame_size }
+        };
+        for (auto &param : params) {
+            aac_err = aacEncoder_SetParam(enc, param.first, param.second);
+            if (!(ok = (aac_err == AACENC_OK))) {
+                buffer.emitf(EV_LOG_ERROR, "aacEncoder_SetParam error 0x%x", aac_err);
+                break;
+            }
+        }
+    }
+
+    if (ok) {
+        aac_err = aacEncEncode(enc, NULL, NULL, NULL, NULL);
+        if (!(ok = (aac_err == AACENC_OK)))
+            buffer.emitf(EV_LOG_ERROR, "aacEncEncode error 0x%x", aac_err);
+    }
+
+    if (ok) {
+        aac_err = aacEncInfo(enc, &aac_info);
+        if (!(ok = (aac_err == AACENC_OK)))
+            buffer.emitf(EV_LOG_ERROR, "aacEncInfo error 0x%x", aac_err);
+    }
+
+    if (ok)
+        emit_headers(aac_info.confBuf, aac_info.confSize, bit_rate);
+
+    return ok;
+}
+
+bool audio_encoder::init_opus(uint32_t bit_rate, uint32_t frame_duration)
+{
+    bool ok;
+    int opus_err;
+    opus_int32 lookahead = 0;
+    auto &buffer = mixer->buffer;
+
+    opus = opus_encoder_create(sample_rate, num_channels, OPUS_APPLICATION_AUDIO, &opus_err);
+    if (!(ok = (opus_err == OPUS_OK)))
+        buffer.emitf(EV_LOG_ERROR, "opus_encoder_create error: %s", opus_strerror(opus_err));
+
+    if (ok) {
+        opus_err = opus_encoder_ctl(opus, OPUS_SET_BITRATE((opus_int32) bit_rate));
+        if (!(ok = (opus_err == OPUS_OK)))
+            buffer.emitf(EV_LOG_ERROR, "opus_encoder_ctl error: %s", opus_strerror(opus_err));
+    }
+
+    if (ok) {
+        opus_err = opus_encoder_ctl(opus, OPUS_GET_LOOKAHEAD(&lookahead));
+        if (!(ok = (opus_err == OPUS_OK)))
+            buffer.emitf(EV_LOG_ERROR, "opus_encoder_ctl error: %s", opus_strerror(opus_err));
+    }
+
+    if (ok) {
+        opus_frame_size = sample_rate * frame_duration / 1000;
+        opus_pcm.resize(opus_frame_size * num_channels);
+        opus_pcm_frames = 0;
+
+        // OpusHead, as used by Ogg and Matroska. Pre-skip is always in
+        // 48 kHz samples. All fields are little-endian.
+        uint32_t pre_skip = lookahead * opus_rate / sample_rate;
+        uint8_t head[19] = {
+            'O', 'p', 'u', 's', 'H', 'e', 'a', 'd',
+            1, (uint8_t) num_channels,
+            (uint8_t) pre_skip, (uint8_t) (pre_skip >> 8),
+            (uint8_t) sample_rate, (uint8_t) (sample_rate >> 8),
+            (uint8_t) (sample_rate >> 16), (uint8_t) (sample_rate >> 24),
+            0, 0,  // Output gain
+            0      // Channel mapping family
+        };
+        emit_headers(head, sizeof(head), bit_rate);
+    }
+
+    return ok;
+}
+
+void audio_encoder::emit_headers(const uint8_t *data, size_t size, uint32_t bit_rate)
+{
+    size_t claim = sizeof(audio_headers_data) + size;
+    auto *ev = mixer->buffer.emit(EV_AUDIO_HEADERS, claim);
+    if (ev != NULL) {
+        auto &headers = *(audio_headers_data *) ev->data;
+        headers.encoding = id;
+        headers.codec = codec;
+        headers.sample_rate = sample_rate;
+        headers.num_channels = num_channels;
+        headers.bit_rate = bit_rate;
+        headers.size = size;
+        memcpy(headers.data, data, size);
+    }
+}
+
+void audio_encoder::destroy()
+{
+    if (running) {
+        {
+            lock_handle lock(mutex);
+            running = false;
+            uv_cond_signal(&cond);
+        }
+
+        uv_thread_join(&thread);
+        uv_cond_destroy(&cond);
+    }
+
+    if (enc != NULL) {
+        AACENC_ERROR aac_err = aacEncClose(&enc);
+        enc = NULL;
+        if (aac_err != AACENC_OK)
+            mixer->buffer.emitf(EV_LOG_ERROR, "aacEncClose error 0x%x\n", aac_err);
+    }
+
+    if (opus != NULL) {
+        opus_encoder_destroy(opus);
+        opus = NULL;
+    }
+}
+
+void audio_encoder::push(int64_t pts, const float *in)
+{
+    lock_handle lock(mutex);
+
+    uint32_t depth = head - tail;
+    if (depth == queue_size) {
+        dropped++;
+        mixer->buffer.emitf(EV_LOG_WARN, "audio encoder queue full, dropping a frame");
+        return;
+    }
+
+    // Convert to signed integer. For mono, first downmix.
+    auto &frame = queue[head % queue_size];
+    frame.pts = pts;
+    if (num_channels == 1) {
+        for (int i = 0; i < frame_size; i++)
+            downmix[i] = (in[i * 2] + in[i * 2 + 1]) * 0.5f;
+        in = downmix;
+    }
+    mixer->kernels->to_s16(frame.samples, in, frame_size * num_channels);
+
+    head++;
+    if (++depth > max_depth)
+        max_depth = depth;
+    uv_cond_signal(&cond);
+}
+
+Local<Object> audio_encoder::stats_to_js(Isolate *isolate)
+{
+    lock_handle lock(mutex);
+
+    auto obj = Object::New(isolate);
+    obj->Set(String::NewFromUtf8(isolate, "frames"), Number::New(isolate, frames));
+    obj->Set(String::NewFromUtf8(isolate, "dropped"), Number::New(isolate, dropped));
+    obj->Set(String::NewFromUtf8(isolate, "depth"), Number::New(isolate, head - tail));
+    obj->Set(String::NewFromUtf8(isolate, "maxDepth"), Number::New(isolate, max_depth));
+    obj->Set(String::NewFromUtf8(isolate, "encode"), encode_latency.to_js(isolate));
+    return obj;
+}
+
+void audio_encoder::thread_cb(void *arg)
+{
+    ((audio_encoder *) arg)->loop();
+}
+
+// The encoder thread loop.
+void audio_encoder::loop()
+{
+    lock_handle lock(mutex);
+    while (true) {
+        while (running && head == tail)
+            uv_cond_wait(&cond, &mutex.mutex);
+        if (!running)
+            break;
+
+        // Encode without the lock. The mixer doesn't touch the tail frame.
+        auto &frame = queue[tail % queue_size];
+        mutex.unlock();
+
+        int64_t start = system_time();
+        if (codec == AUDIO_CODEC_OPUS)
+            encode_opus(frame);
+        else
+            encode_aac(frame);
+        int64_t end = system_time();
+
+        mutex.lock();
+        tail++;
+        frames++;
+        encode_latency.record(end - start);
+    }
+}
+
+void audio_encoder::encode_aac(queued_frame &frame)
+{
+    UCHAR outbuf[out_bytes];
+
+    void *in_desc_bufs[] = { frame.samples };
     INT in_desc_ids[] = { IN_AUDIO_DATA };
-    INT in_desc_sizes[] = { enc_frame_samples * sizeof(INT_PCM) };
+    INT in_desc_sizes[] = { (INT) (frame_size * num_channels * sizeof(INT_PCM)) };
     INT in_desc_el_sizes[] = { sizeof(INT_PCM) };
     AACENC_BufDesc in_desc = {
         .numBufs           = 1,
@@ -284,7 +913,7 @@ void audio_mixer_full::loop()
 
     void *out_desc_bufs[] = { outbuf };
     INT out_desc_ids[] = { OUT_BITSTREAM_DATA };
-    INT out_desc_sizes[] = { enc_out_bytes };
+    INT out_desc_sizes[] = { out_bytes };
     INT out_desc_el_sizes[] = { sizeof(UCHAR) };
     AACENC_BufDesc out_desc = {
         .numBufs           = 1,
@@ -295,79 +924,119 @@ void audio_mixer_full::loop()
     };
 
     AACENC_InArgs in_args = {
-        .numInSamples = enc_frame_samples,
+        .numInSamples = (INT) (frame_size * num_channels),
         .numAncBytes  = 0
     };
 
     AACENC_OutArgs out_args;
 
-    // Continue until the thread is stopped.
-    while (!thread.wait(mix_interval) && running) {
-        // Process mixed samples until the mix buffer is roughly recentered.
-        // Take steps forward in encoder frame sized chunks.
-        float *mixp = mix_buffer;
-        size_t processed = 0;
-        int64_t target_mix_time = system_time() - samples_to_time(mix_half_samples);
-        int64_t mixp_time = mix_time;
-        while (target_mix_time > mixp_time) {
-            // Resample to signed integer.
-            INT_PCM *resp = resbuf;
-            int count = enc_frame_samples;
-            while (count--) {
-                float sample = *(mixp++);
-                if (sample > +1.0) sample = +1.0;
-                if (sample < -1.0) sample = -1.0;
-                *(resp++) = (INT_PCM) (sample * SAMPLE_MAX);
-            }
-
-            // Encode the integer samples.
-            AACENC_ERROR err = aacEncEncode(enc, &in_desc, &out_desc, &in_args, &out_args);
-            if (err != AACENC_OK) {
-                buffer.emitf(EV_LOG_ERROR, "aacEncEncode error 0x%x", err);
-                out_args.numOutBytes = 0;
-            }
+    AACENC_ERROR err = aacEncEncode(enc, &in_desc, &out_desc, &in_args, &out_args);
+    if (err != AACENC_OK) {
+        lock_handle mixer_lock(mixer->thread);
+        mixer->buffer.emitf(EV_LOG_ERROR, "aacEncEncode error 0x%x", err);
+    }
+    else if (out_args.numOutBytes != 0) {
+        emit_frame(frame.pts, outbuf, out_args.numOutBytes);
+    }
+}
 
-            // Push output frame to the buffer.
-            if (out_args.numOutBytes != 0) {
-                size_t claim = sizeof(audio_frame_data) + out_args.numOutBytes;
-                auto *ev = buffer.emit(EV_AUDIO_FRAME, claim);
-                if (ev != NULL) {
-                    auto &frame = *(audio_frame_data *) ev->data;
-                    frame.pts = mixp_time;
-                    frame.size = out_args.numOutBytes;
-                    memcpy(frame.data, outbuf, out_args.numOutBytes);
-                }
-            }
+// Opus frames don't line up with queued frames, so samples are collected until
+// a full Opus frame is available. Each takes the time of its first sample.
+void audio_encoder::encode_opus(queued_frame &frame)
+{
+    unsigned char outbuf[out_bytes];
+
+    uint32_t pos = 0;
+    while (pos < (uint32_t) frame_size) {
+        if (opus_pcm_frames == 0)
+            opus_pcm_pts = frame.pts + (int64_t) pos * 1000000000 / sample_rate;
+
+        uint32_t count = std::min((uint32_t) frame_size - pos, opus_frame_size - opus_pcm_frames);
+        memcpy(&opus_pcm[opus_pcm_frames * num_channels], &frame.samples[pos * num_channels],
+               count * num_channels * sizeof(int16_t));
+        pos += count;
+        opus_pcm_frames += count;
+        if (opus_pcm_frames != opus_frame_size)
+            continue;
 
-            mixp_time += enc_frame_time;
-            processed += enc_frame_samples;
+        opus_pcm_frames = 0;
+        opus_int32 len = opus_encode(opus, opus_pcm.data(), opus_frame_size, outbuf, out_bytes);
+        if (len < 0) {
+            lock_handle mixer_lock(mixer->thread);
+            mixer->buffer.emitf(EV_LOG_ERROR, "opus_encode error: %s", opus_strerror(len));
+        }
+        else if (len != 0) {
+            emit_frame(opus_pcm_pts, outbuf, len);
         }
+    }
+}
 
-        // FIXME: Handle lag, where processed >= mix_samples
+// Push an output frame to the buffer. Takes the mixer lock.
+void audio_encoder::emit_frame(int64_t pts, const uint8_t *data, size_t size)
+{
+    lock_handle mixer_lock(mixer->thread);
+    auto *ev = mixer->buffer.emit(EV_AUDIO_FRAME, sizeof(audio_frame_data) + size);
+    if (ev != NULL) {
+        auto &frame = *(audio_frame_data *) ev->data;
+        frame.encoding = id;
+        frame.pts = pts;
+        frame.size = size;
+        memcpy(frame.data, data, size);
+    }
+}
 
-        if (processed > 0) {
-            // Shift processed samples off the mix buffer.
-            size_t mix_remaining = mix_samples - processed;
-            if (mix_remaining)
-                memmove(mix_buffer, mixp, mix_remaining * sizeof(float));
-            memset(mix_buffer + mix_remaining, 0, processed * sizeof(float));
+static void meter_to_level(audio_meter &meter, audio_level &level)
+{
+    for (int c = 0; c < 2; c++) {
+        level.peak[c] = meter.peak[c];
+        level.rms[c] = meter.frames == 0 ? 0 : (float) sqrt(meter.sum[c] / meter.frames);
+    }
+    meter.reset();
+}
 
-            // Adjust mix buffer time.
-            mix_time = mixp_time;
-        }
+// Emit levels for the period that ends at the read position, and start the
+// next period.
+void audio_mixer_full::emit_levels()
+{
+    uint32_t num_sources = source_ctxes.size();
+    size_t claim = sizeof(audio_levels_data) + num_sources * sizeof(audio_level);
+    auto *ev = buffer.emit(EV_AUDIO_LEVELS, claim);
+    if (ev == NULL) {
+        master_meter.reset();
+        for (auto &ctx : source_ctxes)
+            ctx->ring->meter.reset();
+        return;
     }
+
+    auto &levels = *(audio_levels_data *) ev->data;
+    levels.time = mix_time;
+    levels.momentary = (float) loudness.momentary();
+    levels.short_term = (float) loudness.short_term();
+    levels.num_sources = num_sources;
+    meter_to_level(master_meter, levels.master);
+    for (uint32_t i = 0; i < num_sources; i++)
+        meter_to_level(source_ctxes[i]->ring->meter, levels.sources[i]);
+}
+
+// Time of an absolute position in the mix buffer. Split to avoid overflow.
+int64_t audio_mixer_full::position_time(uint64_t pos)
+{
+    uint64_t frames = pos / mix_channels;
+    return mix_start_time +
+        (int64_t) (frames / sample_rate) * 1000000000 +
+        (int64_t) (frames % sample_rate) * 1000000000 / sample_rate;
 }
 
 // Convert amount of samples to relative time they represent.
 size_t audio_mixer_full::time_to_samples(int64_t time)
 {
-    return time * sample_rate / 1000000000 * num_channels;
+    return time * sample_rate / 1000000000 * mix_channels;
 }
 
 // Convert amount of samples to relative time they represent.
 int64_t audio_mixer_full::samples_to_time(size_t samples)
 {
-    return samples / num_channels * 1000000000 / sample_rate;
+    return samples / mix_channels * 1000000000 / sample_rate;
 }
 
 void audio_mixer_full::init_prototype(Handle<FunctionTemplate> func)
@@ -380,14 +1049,98 @@ void audio_mixer_full::init_prototype(Handle<FunctionTemplate> func)
         auto mixer = ObjectWrap::Unwrap<audio_mixer_full>(args.This());
         mixer->set_sources(args);
     });
+    NODE_SET_PROTOTYPE_METHOD(func, "stats", [](const FunctionCallbackInfo<Value>& args) {
+        auto mixer = ObjectWrap::Unwrap<audio_mixer_full>(args.This());
+        mixer->stats(args);
+    });
+}
+
+static bool parse_encoding_params(Isolate *isolate, Handle<Object> obj, audio_encoding_params &params)
+{
+    Handle<Value> val;
+
+    val = obj->Get(codec_sym.Get(isolate));
+    if (!val->IsUndefined()) {
+        String::Utf8Value v(val);
+        if (val->IsString() && *v != NULL && strcmp(*v, "aac") == 0) {
+            params.codec = AUDIO_CODEC_AAC;
+        }
+        else if (val->IsString() && *v != NULL && strcmp(*v, "opus") == 0) {
+            params.codec = AUDIO_CODEC_OPUS;
+        }
+        else {
+            isolate->ThrowException(Exception::TypeError(
+                String::NewFromUtf8(isolate, "Invalid codec")));
+            return false;
+        }
+    }
+
+    val = obj->Get(channels_sym.Get(isolate));
+    if (!val->IsUndefined()) {
+        params.num_channels = val->IsUint32() ? val->Uint32Value() : 0;
+        if (params.num_channels != 1 && params.num_channels != 2) {
+            isolate->ThrowException(Exception::TypeError(
+                String::NewFromUtf8(isolate, "Invalid number of channels")));
+            return false;
+        }
+    }
+
+    val = obj->Get(bitrate_sym.Get(isolate));
+    if (!val->IsUndefined()) {
+        params.bit_rate = val->IsUint32() ? val->Uint32Value() : 0;
+        if (params.bit_rate == 0) {
+            isolate->ThrowException(Exception::TypeError(
+                String::NewFromUtf8(isolate, "Invalid bitrate")));
+            return false;
+        }
+    }
+
+    val = obj->Get(frame_duration_sym.Get(isolate));
+    if (!val->IsUndefined()) {
+        params.frame_duration = val->IsUint32() ? val->Uint32Value() : 0;
+        if (params.frame_duration != 10 && params.frame_duration != 20) {
+            isolate->ThrowException(Exception::TypeError(
+                String::NewFromUtf8(isolate, "Invalid frame duration")));
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool check_encoding_params(Isolate *isolate, audio_encoding_params &params, uint32_t sample_rate)
+{
+    uint32_t min_bit_rate = 8000, max_bit_rate = 576000;
+
+    if (params.codec == AUDIO_CODEC_OPUS) {
+        auto *end = opus_sample_rates + sizeof(opus_sample_rates) / sizeof(opus_sample_rates[0]);
+        if (std::find(opus_sample_rates, end, sample_rate) == end) {
+            isolate->ThrowException(Exception::TypeError(
+                String::NewFromUtf8(isolate, "Opus requires a sample rate of 8, 12, 16, 24 or 48 kHz")));
+            return false;
+        }
+        min_bit_rate = 6000;
+        max_bit_rate = 510000;
+    }
+
+    if (params.bit_rate < min_bit_rate || params.bit_rate > max_bit_rate) {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "Invalid bitrate")));
+        return false;
+    }
+
+    return true;
 }
 
 static Local<Value> audio_events_transform(Isolate *isolate, event &ev, buffer_slicer &slicer)
 {
     switch (ev.id) {
         case EV_AUDIO_HEADERS:
+            return audio_headers_to_js(isolate, *(audio_headers_data *) ev.data, slicer);
         case EV_AUDIO_FRAME:
             return audio_frame_to_js(isolate, *(audio_frame_data *) ev.data, slicer);
+        case EV_AUDIO_LEVELS:
+            return audio_levels_to_js(isolate, *(audio_levels_data *) ev.data);
         default:
             return Undefined(isolate);
     }
@@ -396,10 +1149,62 @@ static Local<Value> audio_events_transform(Isolate *isolate, event &ev, buffer_s
 static Local<Value> audio_frame_to_js(Isolate *isolate, audio_frame_data &frame, buffer_slicer &slicer)
 {
     auto obj = Object::New(isolate);
+    obj->Set(encoding_sym.Get(isolate), Number::New(isolate, frame.encoding));
     obj->Set(pts_sym.Get(isolate), Number::New(isolate, frame.pts));
     obj->Set(buf_sym.Get(isolate), slicer.slice((char *) frame.data, frame.size));
     return obj;
 }
 
+static Local<Value> audio_headers_to_js(Isolate *isolate, audio_headers_data &headers, buffer_slicer &slicer)
+{
+    auto obj = Object::New(isolate);
+    obj->Set(encoding_sym.Get(isolate), Number::New(isolate, headers.encoding));
+    obj->Set(codec_sym.Get(isolate), String::NewFromUtf8(isolate,
+        headers.codec == AUDIO_CODEC_OPUS ? "opus" : "aac"));
+    obj->Set(sample_rate_sym.Get(isolate), Number::New(isolate, headers.sample_rate));
+    obj->Set(channels_sym.Get(isolate), Number::New(isolate, headers.num_channels));
+    obj->Set(bitrate_sym.Get(isolate), Number::New(isolate, headers.bit_rate));
+    obj->Set(buf_sym.Get(isolate), slicer.slice((char *) headers.data, headers.size));
+    return obj;
+}
+
+// Convert to dB, with a floor. Linear levels of zero, and loudness of negative
+// infinity, end up at the floor.
+static Local<Value> level_db_to_js(Isolate *isolate, double db)
+{
+    return Number::New(isolate, db > min_level_db ? db : min_level_db);
+}
+
+static Local<Value> level_pair_to_js(Isolate *isolate, const float *values)
+{
+    auto arr = Array::New(isolate, 2);
+    for (uint32_t c = 0; c < 2; c++)
+        arr->Set(c, level_db_to_js(isolate, 20.0 * log10(values[c])));
+    return arr;
+}
+
+static Local<Value> audio_level_to_js(Isolate *isolate, audio_level &level)
+{
+    auto obj = Object::New(isolate);
+    obj->Set(String::NewFromUtf8(isolate, "peak"), level_pair_to_js(isolate, level.peak));
+    obj->Set(String::NewFromUtf8(isolate, "rms"), level_pair_to_js(isolate, level.rms));
+    return obj;
+}
+
+static Local<Value> audio_levels_to_js(Isolate *isolate, audio_levels_data &levels)
+{
+    auto sources = Array::New(isolate, levels.num_sources);
+    for (uint32_t i = 0; i < levels.num_sources; i++)
+        sources->Set(i, audio_level_to_js(isolate, levels.sources[i]));
+
+    auto obj = Object::New(isolate);
+    obj->Set(String::NewFromUtf8(isolate, "time"), Number::New(isolate, levels.time));
+    obj->Set(String::NewFromUtf8(isolate, "momentary"), level_db_to_js(isolate, levels.momentary));
+    obj->Set(String::NewFromUtf8(isolate, "shortTerm"), level_db_to_js(isolate, levels.short_term));
+    obj->Set(String::NewFromUtf8(isolate, "master"), audio_level_to_js(isolate, levels.master));
+    obj->Set(String::NewFromUtf8(isolate, "sources"), sources);
+    return obj;
+}
+
 
 } // namespace p1stream
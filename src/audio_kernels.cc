@@ -0,0 +1,251 @@
+#include "p1stream_priv.h"
+
+#include <math.h>
+
+#if __x86_64__ || __i386__
+#   define P1_AUDIO_X86 1
+#   include <immintrin.h>
+#endif
+
+// The scalar kernels are the reference the others are measured against, so
+// keep the compiler from vectorizing them.
+#if __clang__
+#   define P1_SCALAR
+#   define P1_SCALAR_LOOP _Pragma("clang loop vectorize(disable) interleave(disable)")
+#else
+#   define P1_SCALAR __attribute__((optimize("no-tree-vectorize")))
+#   define P1_SCALAR_LOOP
+#endif
+
+namespace p1stream {
+
+
+// ----- Scalar -----
+
+P1_SCALAR static void mix_scalar(float *out, const float *in, size_t samples, float volume)
+{
+    P1_SCALAR_LOOP
+    while (samples--)
+        *(out++) += *(in++) * volume;
+}
+
+P1_SCALAR static void to_s16_scalar(int16_t *out, const float *in, size_t samples)
+{
+    P1_SCALAR_LOOP
+    while (samples--) {
+        float sample = *(in++);
+        if (sample > +1.0f) sample = +1.0f;
+        if (sample < -1.0f) sample = -1.0f;
+        *(out++) = (int16_t) lrintf(sample * 32767.0f);
+    }
+}
+
+static float dot_scalar(const float *a, const float *b, size_t samples)
+{
+    float sum = 0.0f;
+    while (samples--)
+        sum += *(a++) * *(b++);
+    return sum;
+}
+
+static void levels_scalar(const float *in, size_t samples, float *peak, float *sum)
+{
+    for (; samples >= 2; samples -= 2, in += 2) {
+        for (int c = 0; c < 2; c++) {
+            float v = in[c];
+            float a = fabsf(v);
+            if (a > peak[c])
+                peak[c] = a;
+            sum[c] += v * v;
+        }
+    }
+}
+
+static const audio_kernels scalar_kernels = {
+    "scalar", mix_scalar, to_s16_scalar, dot_scalar, levels_scalar
+};
+
+
+#if P1_AUDIO_X86
+
+// ----- SSE2 -----
+
+__attribute__((target("sse2")))
+static void mix_sse2(float *out, const float *in, size_t samples, float volume)
+{
+    __m128 v = _mm_set1_ps(volume);
+    for (; samples >= 8; samples -= 8, in += 8, out += 8) {
+        __m128 a = _mm_add_ps(_mm_loadu_ps(out), _mm_mul_ps(_mm_loadu_ps(in), v));
+        __m128 b = _mm_add_ps(_mm_loadu_ps(out + 4), _mm_mul_ps(_mm_loadu_ps(in + 4), v));
+        _mm_storeu_ps(out, a);
+        _mm_storeu_ps(out + 4, b);
+    }
+    mix_scalar(out, in, samples, volume);
+}
+
+// Clamping happens in float, because out of range conversions produce the
+// integer minimum, which would saturate the wrong way for large positives.
+__attribute__((target("sse2")))
+static void to_s16_sse2(int16_t *out, const float *in, size_t samples)
+{
+    __m128 scale = _mm_set1_ps(32767.0f);
+    __m128 hi = _mm_set1_ps(+1.0f);
+    __m128 lo = _mm_set1_ps(-1.0f);
+    for (; samples >= 8; samples -= 8, in += 8, out += 8) {
+        __m128 a = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(in), lo), hi);
+        __m128 b = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + 4), lo), hi);
+        __m128i ia = _mm_cvtps_epi32(_mm_mul_ps(a, scale));
+        __m128i ib = _mm_cvtps_epi32(_mm_mul_ps(b, scale));
+        _mm_storeu_si128((__m128i *) out, _mm_packs_epi32(ia, ib));
+    }
+    to_s16_scalar(out, in, samples);
+}
+
+__attribute__((target("sse2")))
+static float dot_sse2(const float *a, const float *b, size_t samples)
+{
+    __m128 sa = _mm_setzero_ps();
+    __m128 sb = _mm_setzero_ps();
+    for (; samples >= 8; samples -= 8, a += 8, b += 8) {
+        sa = _mm_add_ps(sa, _mm_mul_ps(_mm_loadu_ps(a), _mm_loadu_ps(b)));
+        sb = _mm_add_ps(sb, _mm_mul_ps(_mm_loadu_ps(a + 4), _mm_loadu_ps(b + 4)));
+    }
+    sa = _mm_add_ps(sa, sb);
+    sa = _mm_add_ps(sa, _mm_movehl_ps(sa, sa));
+    sa = _mm_add_ss(sa, _mm_shuffle_ps(sa, sa, 1));
+    return _mm_cvtss_f32(sa) + dot_scalar(a, b, samples);
+}
+
+// Lanes alternate between left and right, and are folded at the end.
+__attribute__((target("sse2")))
+static void levels_sse2(const float *in, size_t samples, float *peak, float *sum)
+{
+    __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    __m128 p = _mm_setzero_ps();
+    __m128 s = _mm_setzero_ps();
+    for (; samples >= 4; samples -= 4, in += 4) {
+        __m128 v = _mm_loadu_ps(in);
+        p = _mm_max_ps(p, _mm_and_ps(v, abs_mask));
+        s = _mm_add_ps(s, _mm_mul_ps(v, v));
+    }
+    p = _mm_max_ps(p, _mm_movehl_ps(p, p));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+
+    float pv[4], sv[4];
+    _mm_storeu_ps(pv, p);
+    _mm_storeu_ps(sv, s);
+    for (int c = 0; c < 2; c++) {
+        if (pv[c] > peak[c])
+            peak[c] = pv[c];
+        sum[c] += sv[c];
+    }
+    levels_scalar(in, samples, peak, sum);
+}
+
+static const audio_kernels sse2_kernels = {
+    "sse2", mix_sse2, to_s16_sse2, dot_sse2, levels_sse2
+};
+
+
+// ----- AVX -----
+
+__attribute__((target("avx")))
+static void mix_avx(float *out, const float *in, size_t samples, float volume)
+{
+    __m256 v = _mm256_set1_ps(volume);
+    for (; samples >= 16; samples -= 16, in += 16, out += 16) {
+        __m256 a = _mm256_add_ps(_mm256_loadu_ps(out), _mm256_mul_ps(_mm256_loadu_ps(in), v));
+        __m256 b = _mm256_add_ps(_mm256_loadu_ps(out + 8), _mm256_mul_ps(_mm256_loadu_ps(in + 8), v));
+        _mm256_storeu_ps(out, a);
+        _mm256_storeu_ps(out + 8, b);
+    }
+    mix_scalar(out, in, samples, volume);
+}
+
+// AVX has no 256-bit integer packing, so pack the halves with SSE2.
+__attribute__((target("avx")))
+static void to_s16_avx(int16_t *out, const float *in, size_t samples)
+{
+    __m256 scale = _mm256_set1_ps(32767.0f);
+    __m256 hi = _mm256_set1_ps(+1.0f);
+    __m256 lo = _mm256_set1_ps(-1.0f);
+    for (; samples >= 8; samples -= 8, in += 8, out += 8) {
+        __m256 a = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(in), lo), hi);
+        __m256i ia = _mm256_cvtps_epi32(_mm256_mul_ps(a, scale));
+        __m128i packed = _mm_packs_epi32(_mm256_castsi256_si128(ia), _mm256_extractf128_si256(ia, 1));
+        _mm_storeu_si128((__m128i *) out, packed);
+    }
+    to_s16_scalar(out, in, samples);
+}
+
+__attribute__((target("avx")))
+static float dot_avx(const float *a, const float *b, size_t samples)
+{
+    __m256 sa = _mm256_setzero_ps();
+    __m256 sb = _mm256_setzero_ps();
+    for (; samples >= 16; samples -= 16, a += 16, b += 16) {
+        sa = _mm256_add_ps(sa, _mm256_mul_ps(_mm256_loadu_ps(a), _mm256_loadu_ps(b)));
+        sb = _mm256_add_ps(sb, _mm256_mul_ps(_mm256_loadu_ps(a + 8), _mm256_loadu_ps(b + 8)));
+    }
+    sa = _mm256_add_ps(sa, sb);
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(sa), _mm256_extractf128_ps(sa, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    return _mm_cvtss_f32(s) + dot_scalar(a, b, samples);
+}
+
+__attribute__((target("avx")))
+static void levels_avx(const float *in, size_t samples, float *peak, float *sum)
+{
+    __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    __m256 p = _mm256_setzero_ps();
+    __m256 s = _mm256_setzero_ps();
+    for (; samples >= 8; samples -= 8, in += 8) {
+        __m256 v = _mm256_loadu_ps(in);
+        p = _mm256_max_ps(p, _mm256_and_ps(v, abs_mask));
+        s = _mm256_add_ps(s, _mm256_mul_ps(v, v));
+    }
+    __m128 p4 = _mm_max_ps(_mm256_castps256_ps128(p), _mm256_extractf128_ps(p, 1));
+    __m128 s4 = _mm_add_ps(_mm256_castps256_ps128(s), _mm256_extractf128_ps(s, 1));
+    p4 = _mm_max_ps(p4, _mm_movehl_ps(p4, p4));
+    s4 = _mm_add_ps(s4, _mm_movehl_ps(s4, s4));
+
+    float pv[4], sv[4];
+    _mm_storeu_ps(pv, p4);
+    _mm_storeu_ps(sv, s4);
+    for (int c = 0; c < 2; c++) {
+        if (pv[c] > peak[c])
+            peak[c] = pv[c];
+        sum[c] += sv[c];
+    }
+    levels_scalar(in, samples, peak, sum);
+}
+
+static const audio_kernels avx_kernels = {
+    "avx", mix_avx, to_s16_avx, dot_avx, levels_avx
+};
+
+#endif  // P1_AUDIO_X86
+
+
+std::vector<const audio_kernels *> supported_audio_kernels()
+{
+    std::vector<const audio_kernels *> list = { &scalar_kernels };
+#if P1_AUDIO_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+        list.push_back(&sse2_kernels);
+    if (__builtin_cpu_supports("avx"))
+        list.push_back(&avx_kernels);
+#endif
+    return list;
+}
+
+const audio_kernels &best_audio_kernels()
+{
+    static const audio_kernels *best = supported_audio_kernels().back();
+    return *best;
+}
+
+
+}  // namespace p1stream
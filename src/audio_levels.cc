@@ -0,0 +1,115 @@
+#include "p1stream_priv.h"
+
+#include <math.h>
+
+namespace p1stream {
+
+// Blocks are 100ms, momentary loudness covers 4 and short-term loudness 30.
+static const int momentary_blocks = 4;
+static const int short_term_blocks = audio_loudness::num_blocks;
+
+
+void audio_meter::add(const audio_kernels &kernels, const float *in, size_t samples)
+{
+    // Sum each call in float, which is accurate enough for a block.
+    float block_sum[2] = { 0, 0 };
+    kernels.levels(in, samples, peak, block_sum);
+    sum[0] += block_sum[0];
+    sum[1] += block_sum[1];
+    frames += samples / 2;
+}
+
+void audio_meter::reset()
+{
+    peak[0] = peak[1] = 0;
+    sum[0] = sum[1] = 0;
+    frames = 0;
+}
+
+// Filter coefficients for any sample rate, derived from the analog prototype
+// of the filters in ITU-R BS.1770.
+void audio_loudness::init(uint32_t sample_rate)
+{
+    double k, a0;
+
+    double f0 = 1681.974450955533;
+    double gain = 3.999843853973347;
+    double q = 0.7071752369554196;
+    k = tan(M_PI * f0 / sample_rate);
+    double vh = pow(10.0, gain / 20.0);
+    double vb = pow(vh, 0.4996667741545416);
+    a0 = 1.0 + k / q + k * k;
+    shelf.b0 = (vh + vb * k / q + k * k) / a0;
+    shelf.b1 = 2.0 * (k * k - vh) / a0;
+    shelf.b2 = (vh - vb * k / q + k * k) / a0;
+    shelf.a1 = 2.0 * (k * k - 1.0) / a0;
+    shelf.a2 = (1.0 - k / q + k * k) / a0;
+
+    f0 = 38.13547087602444;
+    q = 0.5003270373238773;
+    k = tan(M_PI * f0 / sample_rate);
+    a0 = 1.0 + k / q + k * k;
+    highpass.b0 = 1.0;
+    highpass.b1 = -2.0;
+    highpass.b2 = 1.0;
+    highpass.a1 = 2.0 * (k * k - 1.0) / a0;
+    highpass.a2 = (1.0 - k / q + k * k) / a0;
+
+    block_frames = sample_rate / 10;
+}
+
+static inline double run_biquad(const audio_loudness::biquad &f, double *z, double x)
+{
+    double y = f.b0 * x + z[0];
+    z[0] = f.b1 * x - f.a1 * y + z[1];
+    z[1] = f.b2 * x - f.a2 * y;
+    return y;
+}
+
+void audio_loudness::add(const float *in, size_t frames)
+{
+    for (size_t i = 0; i < frames; i++) {
+        for (int c = 0; c < 2; c++) {
+            double v = run_biquad(shelf, state[c][0], in[i * 2 + c]);
+            v = run_biquad(highpass, state[c][1], v);
+            block_sum += v * v;
+        }
+
+        if (++block_pos == block_frames) {
+            blocks[next_block] = block_sum / block_frames;
+            next_block = (next_block + 1) % num_blocks;
+            if (num_filled < num_blocks)
+                num_filled++;
+            block_pos = 0;
+            block_sum = 0;
+        }
+    }
+}
+
+double audio_loudness::momentary()
+{
+    return average(momentary_blocks);
+}
+
+double audio_loudness::short_term()
+{
+    return average(short_term_blocks);
+}
+
+// Loudness over the most recent blocks, or fewer if we don't have that many
+// yet. Silence is negative infinity.
+double audio_loudness::average(int count)
+{
+    if ((uint32_t) count > num_filled)
+        count = num_filled;
+    if (count == 0)
+        return -INFINITY;
+
+    double sum = 0;
+    for (int i = 1; i <= count; i++)
+        sum += blocks[(next_block + num_blocks - i) % num_blocks];
+    return -0.691 + 10.0 * log10(sum / count);
+}
+
+
+}  // namespace p1stream
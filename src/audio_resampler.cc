@@ -0,0 +1,173 @@
+#include "p1stream_priv.h"
+
+#include <math.h>
+#include <algorithm>
+
+namespace p1stream {
+
+static const int half_taps = audio_resampler::num_taps / 2;
+
+// Fraction of the lower Nyquist frequency passed. The rest is the transition
+// band of the filter.
+static const double filter_passband = 0.92;
+
+// Timestamps jumping by more than this restart the stream.
+static const double max_jump = 50000000;  // 50ms
+
+// How quickly the smoothed input time follows block timestamps, per block.
+static const double time_smoothing = 0.1;
+
+// Ratio correction per second of error between output and input time, and
+// its limit. Device clocks are typically off by far less than the limit. The
+// integral term takes out the remaining error for a constant drift.
+static const double drift_gain = 1.0;
+static const double drift_integral_gain = 0.1;
+static const double max_correction = 0.005;
+
+static double clamp_correction(double v)
+{
+    return std::max(-max_correction, std::min(max_correction, v));
+}
+
+
+// Build the coefficient table for a rate pair. The cutoff is at the lower of
+// the two Nyquist frequencies, and each phase is normalized to unity gain.
+static void build_filter(std::vector<float> &filter, uint32_t in_rate, uint32_t out_rate)
+{
+    const int n = audio_resampler::num_taps;
+    const int l = audio_resampler::num_phases;
+    double fc = 0.5 * std::min(1.0, (double) out_rate / in_rate) * filter_passband;
+
+    filter.resize((l + 1) * n);
+    for (int p = 0; p <= l; p++) {
+        float *row = &filter[p * n];
+        double sum = 0;
+        for (int k = 0; k < n; k++) {
+            double t = k - (half_taps - 1) - (double) p / l;
+            double x = 2 * fc * t;
+            double sinc = x == 0 ? 1 : sin(M_PI * x) / (M_PI * x);
+            double w = t / half_taps;
+            double window = 0.42 + 0.5 * cos(M_PI * w) + 0.08 * cos(2 * M_PI * w);
+            double v = 2 * fc * sinc * window;
+            row[k] = (float) v;
+            sum += v;
+        }
+        for (int k = 0; k < n; k++)
+            row[k] = (float) (row[k] / sum);
+    }
+}
+
+size_t audio_resampler::process(int64_t time, const float *a, size_t a_len, const float *b, size_t b_len,
+                                uint32_t rate, uint32_t mix_rate, const audio_kernels &kernels)
+{
+    const int n = num_taps;
+
+    // Follow the block timestamp, or restart if it's way off.
+    if (rate != in_rate || mix_rate != out_rate || history[0].empty()) {
+        restart(time, rate, mix_rate);
+    }
+    else {
+        double offset = time - input_time(history[0].size());
+        if (fabs(offset) > max_jump)
+            restart(time, rate, mix_rate);
+        else
+            base_time += offset * time_smoothing;
+    }
+
+    append(a, a_len);
+    append(b, b_len);
+
+    // Adjust the ratio, so that output time converges on input time.
+    double err = (output_time(out_count) - input_time(pos)) / 1000000000.0;
+    double duration = (double) (a_len + b_len) / 2 / in_rate;
+    drift = clamp_correction(drift + err * drift_integral_gain * duration);
+    step = (double) in_rate / out_rate * (1 + clamp_correction(drift + err * drift_gain));
+
+    size_t len = history[0].size();
+    size_t max_out = (size_t) ((len - pos) / step + 2) * 2;
+    if (out.size() < max_out)
+        out.resize(max_out);
+
+    // Filter while there are enough samples ahead of the read position.
+    size_t num_out = 0;
+    while ((size_t) pos + half_taps < len) {
+        size_t i = (size_t) pos;
+        double phase = (pos - i) * num_phases;
+        int p = (int) phase;
+        float frac = (float) (phase - p);
+        const float *h0 = &filter[p * n];
+        const float *h1 = h0 + n;
+        for (int c = 0; c < 2; c++) {
+            const float *x = &history[c][i - (half_taps - 1)];
+            float v0 = kernels.dot(x, h0, n);
+            float v1 = kernels.dot(x, h1, n);
+            out[num_out++] = v0 + (v1 - v0) * frac;
+        }
+        pos += step;
+    }
+
+    out_time = output_time(out_count);
+    out_count += num_out / 2;
+
+    // Drop input that is no longer needed as history.
+    size_t drop = (size_t) pos - (half_taps - 1);
+    if (drop > 0) {
+        for (auto &h : history)
+            h.erase(h.begin(), h.begin() + drop);
+        pos -= drop;
+        base_time += drop * 1000000000.0 / in_rate;
+    }
+
+    return num_out;
+}
+
+// Start a fresh stream, with silence as history, and the first input sample
+// at the given time.
+void audio_resampler::restart(int64_t time, uint32_t rate, uint32_t mix_rate)
+{
+    if (rate != in_rate || mix_rate != out_rate)
+        build_filter(filter, rate, mix_rate);
+
+    in_rate = rate;
+    out_rate = mix_rate;
+    step = (double) in_rate / out_rate;
+    drift = 0;
+
+    for (auto &h : history)
+        h.assign(half_taps - 1, 0.0f);
+    pos = half_taps - 1;
+
+    base_time = time - pos * 1000000000.0 / in_rate;
+    out_start_time = time;
+    out_count = 0;
+}
+
+// Deinterleave stereo input onto the history.
+void audio_resampler::append(const float *in, size_t samples)
+{
+    size_t frames = samples / 2;
+    for (int c = 0; c < 2; c++) {
+        auto &h = history[c];
+        size_t start = h.size();
+        h.resize(start + frames);
+        for (size_t i = 0; i < frames; i++)
+            h[start + i] = in[i * 2 + c];
+    }
+}
+
+// Time of a fractional position in the history.
+double audio_resampler::input_time(double at)
+{
+    return base_time + at * 1000000000.0 / in_rate;
+}
+
+// Time of an output frame. Split to avoid overflow.
+int64_t audio_resampler::output_time(uint64_t count)
+{
+    return out_start_time +
+        (int64_t) (count / out_rate) * 1000000000 +
+        (int64_t) (count % out_rate) * 1000000000 / out_rate;
+}
+
+
+}  // namespace p1stream
@@ -0,0 +1,339 @@
+// Benchmark-only additions to the native module. These are built into the
+// `bench` target only, and driven by `tools/bench.js`.
+
+#include "p1stream_priv.h"
+
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <sys/resource.h>
+
+namespace p1stream {
+
+
+// Video source that draws a cheap moving pattern from a preallocated buffer.
+class bench_video_source : public video_source {
+public:
+    bench_video_source();
+
+    lockable_mutex mutex;
+    dimensions_t dimensions;
+    uint32_t *data;
+    uint32_t frame;
+
+    // Public JavaScript methods.
+    void init(const FunctionCallbackInfo<Value>& args);
+    void destroy();
+
+    // Lockable implementation.
+    virtual lockable *lock();
+
+    // Video source implementation.
+    virtual void produce_video_frame(video_source_context &ctx);
+
+    // Module init.
+    static void init_prototype(Handle<FunctionTemplate> func);
+};
+
+// Audio source that renders a sine wave every 10ms on its own thread.
+class bench_audio_source : public audio_source {
+public:
+    bench_audio_source();
+
+    threaded_loop thread;
+    bool running;
+
+    std::list<audio_source_context *> ctxes;
+
+    // Internal.
+    void loop();
+
+    // Public JavaScript methods.
+    void init(const FunctionCallbackInfo<Value>& args);
+    void destroy();
+
+    // Lockable implementation.
+    virtual lockable *lock();
+
+    // Audio source implementation.
+    virtual void link_audio_source(audio_source_context &ctx);
+    virtual void unlink_audio_source(audio_source_context &ctx);
+
+    // Module init.
+    static void init_prototype(Handle<FunctionTemplate> func);
+};
+
+
+// ----- Bench video source -----
+
+bench_video_source::bench_video_source() :
+    data(), frame()
+{
+}
+
+void bench_video_source::init(const FunctionCallbackInfo<Value>& args)
+{
+    auto *isolate = args.GetIsolate();
+
+    if (args.Length() != 1 || !args[0]->IsObject()) {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "Expected an object")));
+        return;
+    }
+    auto params = args[0].As<Object>();
+
+    auto widthVal = params->Get(width_sym.Get(isolate));
+    auto heightVal = params->Get(height_sym.Get(isolate));
+    if (!widthVal->IsUint32() || !heightVal->IsUint32()) {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "Invalid dimensions")));
+        return;
+    }
+    dimensions.width = widthVal->Uint32Value();
+    dimensions.height = heightVal->Uint32Value();
+
+    // Parameters checked, from here on we no longer throw exceptions.
+    Wrap(args.This());
+    Ref();
+    args.GetReturnValue().Set(handle());
+
+    data = new uint32_t[dimensions.width * dimensions.height];
+}
+
+void bench_video_source::destroy()
+{
+    if (data != nullptr) {
+        delete[] data;
+        data = nullptr;
+    }
+
+    Unref();
+}
+
+lockable *bench_video_source::lock()
+{
+    return mutex.lock();
+}
+
+void bench_video_source::produce_video_frame(video_source_context &ctx)
+{
+    // Diagonal bands that move every frame, so the encoder has actual motion
+    // to deal with.
+    uint32_t *p = data;
+    for (uint32_t y = 0; y < dimensions.height; y++) {
+        uint32_t base = y + frame * 4;
+        for (uint32_t x = 0; x < dimensions.width; x++) {
+            uint32_t v = (x + base) & 0xFF;
+            *(p++) = 0xFF000000 | (v << 16) | ((255 - v) << 8) | (y & 0xFF);
+        }
+    }
+    frame++;
+
+    ctx.render_buffer(dimensions, data);
+}
+
+void bench_video_source::init_prototype(Handle<FunctionTemplate> func)
+{
+    NODE_SET_PROTOTYPE_METHOD(func, "destroy", [](const FunctionCallbackInfo<Value>& args) {
+        auto source = ObjectWrap::Unwrap<bench_video_source>(args.This());
+        source->destroy();
+    });
+}
+
+
+// ----- Bench audio source -----
+
+static const int bench_audio_rate = 44100;
+static const int bench_audio_channels = 2;
+static const int bench_audio_interval = 10000000;  // 10ms
+static const int bench_audio_samples = bench_audio_rate / 100 * bench_audio_channels;
+
+bench_audio_source::bench_audio_source() :
+    running()
+{
+}
+
+void bench_audio_source::init(const FunctionCallbackInfo<Value>& args)
+{
+    // Parameters checked, from here on we no longer throw exceptions.
+    Wrap(args.This());
+    Ref();
+    args.GetReturnValue().Set(handle());
+
+    running = true;
+    thread.init(std::bind(&bench_audio_source::loop, this));
+}
+
+void bench_audio_source::destroy()
+{
+    if (running) {
+        running = false;
+        thread.destroy();
+    }
+
+    Unref();
+}
+
+lockable *bench_audio_source::lock()
+{
+    return thread.lock();
+}
+
+void bench_audio_source::link_audio_source(audio_source_context &ctx)
+{
+    lock_handle lock(thread);
+    ctxes.push_back(&ctx);
+}
+
+void bench_audio_source::unlink_audio_source(audio_source_context &ctx)
+{
+    lock_handle lock(thread);
+    ctxes.remove(&ctx);
+}
+
+void bench_audio_source::loop()
+{
+    float buf[bench_audio_samples];
+    double phase = 0;
+    double step = 2 * M_PI * 440 / bench_audio_rate;
+
+    while (!thread.wait(bench_audio_interval) && running) {
+        int64_t time = system_time() - bench_audio_interval;
+
+        for (int i = 0; i < bench_audio_samples; i += bench_audio_channels) {
+            float v = (float) (0.25 * sin(phase));
+            for (int c = 0; c < bench_audio_channels; c++)
+                buf[i + c] = v;
+            phase += step;
+        }
+        phase = fmod(phase, 2 * M_PI);
+
+        for (auto ctx : ctxes) {
+            ((audio_source_context_full *) ctx)->render_buffer(
+                time, buf, bench_audio_samples, bench_audio_rate);
+        }
+    }
+}
+
+void bench_audio_source::init_prototype(Handle<FunctionTemplate> func)
+{
+    NODE_SET_PROTOTYPE_METHOD(func, "destroy", [](const FunctionCallbackInfo<Value>& args) {
+        auto source = ObjectWrap::Unwrap<bench_audio_source>(args.This());
+        source->destroy();
+    });
+}
+
+
+// ----- Module init -----
+
+static void bench_video_source_constructor(const FunctionCallbackInfo<Value>& args)
+{
+    auto source = new bench_video_source();
+    source->init(args);
+}
+
+static void bench_audio_source_constructor(const FunctionCallbackInfo<Value>& args)
+{
+    auto source = new bench_audio_source();
+    source->init(args);
+}
+
+// Time every supported audio kernel variant on the same input, roughly one
+// mix interval of 16 stereo sources at 48 kHz. Results are in nanoseconds
+// per sample.
+static void bench_audio_kernels(const FunctionCallbackInfo<Value>& args)
+{
+    auto *isolate = args.GetIsolate();
+    const size_t samples = 48000 * 2 * 3 / 10;
+    const int num_sources = 16;
+    const int iterations = 50;
+
+    std::vector<float> in(samples);
+    std::vector<float> mix(samples);
+    std::vector<int16_t> out(samples);
+    for (size_t i = 0; i < samples; i++)
+        in[i] = (float) sin(i * 0.01);
+
+    auto arr = Array::New(isolate);
+    uint32_t idx = 0;
+    // Keeps the compiler from discarding the conversions.
+    volatile int16_t sink = 0;
+    for (auto *kernels : supported_audio_kernels()) {
+        int64_t mix_time = 0;
+        int64_t convert_time = 0;
+        for (int i = 0; i < iterations; i++) {
+            std::fill(mix.begin(), mix.end(), 0.0f);
+
+            int64_t start = system_time();
+            for (int j = 0; j < num_sources; j++)
+                kernels->mix(mix.data(), in.data(), samples, 0.1f);
+            int64_t mid = system_time();
+            kernels->to_s16(out.data(), mix.data(), samples);
+            int64_t end = system_time();
+
+            mix_time += mid - start;
+            convert_time += end - mid;
+            sink = sink ^ out[i];
+        }
+
+        double mixed = (double) samples * num_sources * iterations;
+        double converted = (double) samples * iterations;
+        auto obj = Object::New(isolate);
+        obj->Set(String::NewFromUtf8(isolate, "name"), String::NewFromUtf8(isolate, kernels->name));
+        obj->Set(String::NewFromUtf8(isolate, "mix"), Number::New(isolate, mix_time / mixed));
+        obj->Set(String::NewFromUtf8(isolate, "convert"), Number::New(isolate, convert_time / converted));
+        arr->Set(idx++, obj);
+    }
+
+    args.GetReturnValue().Set(arr);
+}
+
+// Peak resident set size of the process in bytes.
+static void peak_rss(const FunctionCallbackInfo<Value>& args)
+{
+    auto *isolate = args.GetIsolate();
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return;
+
+#if __APPLE__
+    double bytes = usage.ru_maxrss;
+#else
+    double bytes = usage.ru_maxrss * 1024.0;
+#endif
+    args.GetReturnValue().Set(Number::New(isolate, bytes));
+}
+
+void module_bench_init(
+    Handle<Object> exports, Handle<Value> module,
+    Handle<Context> context, void* priv)
+{
+    auto *isolate = context->GetIsolate();
+    Handle<String> name;
+    Handle<FunctionTemplate> func;
+
+    name = String::NewFromUtf8(isolate, "BenchVideoSource");
+    func = FunctionTemplate::New(isolate, bench_video_source_constructor);
+    func->InstanceTemplate()->SetInternalFieldCount(1);
+    func->SetClassName(name);
+    bench_video_source::init_prototype(func);
+    exports->Set(name, func->GetFunction());
+
+    name = String::NewFromUtf8(isolate, "BenchAudioSource");
+    func = FunctionTemplate::New(isolate, bench_audio_source_constructor);
+    func->InstanceTemplate()->SetInternalFieldCount(1);
+    func->SetClassName(name);
+    bench_audio_source::init_prototype(func);
+    exports->Set(name, func->GetFunction());
+
+    name = String::NewFromUtf8(isolate, "benchAudioKernels");
+    func = FunctionTemplate::New(isolate, bench_audio_kernels);
+    exports->Set(name, func->GetFunction());
+
+    name = String::NewFromUtf8(isolate, "peakRss");
+    func = FunctionTemplate::New(isolate, peak_rss);
+    exports->Set(name, func->GetFunction());
+}
+
+
+}  // namespace p1stream
@@ -0,0 +1,635 @@
+#include "p1stream_priv.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace p1stream {
+
+// Largest frame dimension we accept.
+static const uint32_t max_dimension = 16384;
+// Marks a playback that hasn't rendered a frame yet.
+static const uint64_t no_frame = UINT64_MAX;
+
+// The audio mixer expects stereo, so mono is duplicated to both channels.
+// Samples are rendered at the file rate, and the mixer resamples.
+static const int mix_channels = 2;
+static const uint32_t min_sample_rate = 8000;
+static const uint32_t max_sample_rate = 192000;
+// How often the audio thread renders, and the most it renders at once, in
+// fractions of a second.
+static const int audio_interval = 10000000;  // 10ms
+static const int max_chunk_divisor = 10;  // 100ms
+
+static const uint16_t wav_format_pcm = 0x0001;
+static const uint16_t wav_format_float = 0x0003;
+static const uint16_t wav_format_extensible = 0xFFFE;
+
+static inline uint16_t read_u16(const uint8_t *p)
+{
+    return p[0] | p[1] << 8;
+}
+
+static inline uint32_t read_u32(const uint8_t *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static Local<Value> throw_file_error(Isolate *isolate, const char *what, const char *err)
+{
+    std::string msg(what);
+    msg += ": ";
+    msg += err;
+    return isolate->ThrowException(Exception::Error(
+        String::NewFromUtf8(isolate, msg.c_str())));
+}
+
+
+// ----- Mapped file -----
+
+const char *mapped_file::open(const std::string &path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return strerror(errno);
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        int err = errno;
+        ::close(fd);
+        return strerror(err);
+    }
+    if (st.st_size == 0) {
+        ::close(fd);
+        return "File is empty";
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    int err = errno;
+    ::close(fd);
+    if (map == MAP_FAILED)
+        return strerror(err);
+
+    // Ask for readahead now, so the first pass doesn't fault on every frame.
+    posix_madvise(map, st.st_size, POSIX_MADV_WILLNEED);
+
+    data = (const uint8_t *) map;
+    size = st.st_size;
+    return NULL;
+}
+
+void mapped_file::close()
+{
+    if (data != NULL) {
+        munmap((void *) data, size);
+        data = NULL;
+        size = 0;
+    }
+}
+
+
+// ----- File video source -----
+
+void file_video_source::init(const FunctionCallbackInfo<Value>& args)
+{
+    auto *isolate = args.GetIsolate();
+    Handle<Value> val;
+    const char *err;
+
+    if (args.Length() != 1 || !args[0]->IsObject()) {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "Expected an object")));
+        return;
+    }
+    auto params = args[0].As<Object>();
+
+    std::string path;
+    val = params->Get(path_sym.Get(isolate));
+    if (val->IsString()) {
+        String::Utf8Value v(val);
+        path = *v;
+    }
+    if (path.empty()) {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "Invalid path")));
+        return;
+    }
+
+    // Frame rate override in seconds per frame, like clocks. Required for
+    // raw files.
+    auto numVal = params->Get(numerator_sym.Get(isolate));
+    auto denVal = params->Get(denominator_sym.Get(isolate));
+    if (!numVal->IsUndefined() || !denVal->IsUndefined()) {
+        if (!numVal->IsUint32() || !denVal->IsUint32() ||
+            numVal->Uint32Value() == 0 || denVal->Uint32Value() == 0) {
+            isolate->ThrowException(Exception::TypeError(
+                String::NewFromUtf8(isolate, "Invalid fraction")));
+            return;
+        }
+    }
+
+    val = params->Get(loop_sym.Get(isolate));
+    looping = val->IsUndefined() || val->BooleanValue();
+
+    err = file.open(path);
+    if (err != NULL) {
+        throw_file_error(isolate, "Cannot open video file", err);
+        return;
+    }
+
+    y4m = file.size >= 10 && memcmp(file.data, "YUV4MPEG2 ", 10) == 0;
+    if (y4m) {
+        err = parse_y4m();
+        if (err != NULL) {
+            file.close();
+            throw_file_error(isolate, "Invalid Y4M file", err);
+            return;
+        }
+    }
+    else {
+        auto widthVal = params->Get(width_sym.Get(isolate));
+        auto heightVal = params->Get(height_sym.Get(isolate));
+        if (!widthVal->IsUint32() || !heightVal->IsUint32() ||
+            widthVal->Uint32Value() == 0 || widthVal->Uint32Value() > max_dimension ||
+            heightVal->Uint32Value() == 0 || heightVal->Uint32Value() > max_dimension) {
+            file.close();
+            isolate->ThrowException(Exception::TypeError(
+                String::NewFromUtf8(isolate, "Invalid dimensions for raw file")));
+            return;
+        }
+        dimensions.width = widthVal->Uint32Value();
+        dimensions.height = heightVal->Uint32Value();
+
+        size_t frame_size = (size_t) dimensions.width * dimensions.height * 4;
+        size_t num_frames = file.size / frame_size;
+        frame_offsets.reserve(num_frames);
+        for (size_t i = 0; i < num_frames; i++)
+            frame_offsets.push_back(i * frame_size);
+    }
+
+    if (frame_offsets.empty()) {
+        file.close();
+        isolate->ThrowException(Exception::Error(
+            String::NewFromUtf8(isolate, "Video file contains no complete frames")));
+        return;
+    }
+
+    if (numVal->IsUint32()) {
+        rate.num = numVal->Uint32Value();
+        rate.den = denVal->Uint32Value();
+    }
+    if (rate.num == 0) {
+        file.close();
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "Expected a frame rate")));
+        return;
+    }
+
+    // Parameters checked, from here on we no longer throw exceptions.
+    Wrap(args.This());
+    Ref();
+    args.GetReturnValue().Set(handle());
+}
+
+// Parse the stream header and index all frames. Frame headers may carry
+// parameters, so their length varies.
+const char *file_video_source::parse_y4m()
+{
+    const char *p = (const char *) file.data;
+    const char *end = p + file.size;
+
+    const char *eol = (const char *) memchr(p, '\n', file.size);
+    if (eol == NULL)
+        return "Unterminated header";
+
+    p += 10;
+    while (p < eol) {
+        const char *tok_end = (const char *) memchr(p, ' ', eol - p);
+        if (tok_end == NULL)
+            tok_end = eol;
+        if (tok_end == p) {
+            p++;
+            continue;
+        }
+        std::string val(p + 1, tok_end - p - 1);
+
+        switch (*p) {
+            case 'W':
+                dimensions.width = strtoul(val.c_str(), NULL, 10);
+                break;
+            case 'H':
+                dimensions.height = strtoul(val.c_str(), NULL, 10);
+                break;
+            case 'F': {
+                // Frames per second, so swapped to get seconds per frame.
+                unsigned long num = 0, den = 0;
+                if (sscanf(val.c_str(), "%lu:%lu", &num, &den) != 2 ||
+                    num == 0 || den == 0 || num > UINT32_MAX || den > UINT32_MAX)
+                    return "Invalid frame rate";
+                rate.num = den;
+                rate.den = num;
+                break;
+            }
+            case 'C':
+                if (val != "420" && val != "420jpeg" && val != "420paldv" && val != "420mpeg2")
+                    return "Only 4:2:0 with 8-bit samples is supported";
+                break;
+        }
+
+        p = tok_end + 1;
+    }
+
+    if (dimensions.width == 0 || dimensions.width > max_dimension ||
+        dimensions.height == 0 || dimensions.height > max_dimension)
+        return "Invalid dimensions";
+
+    uint32_t chroma_width = (dimensions.width + 1) / 2;
+    uint32_t chroma_height = (dimensions.height + 1) / 2;
+    strides[0] = dimensions.width;
+    strides[1] = strides[2] = chroma_width;
+    size_t frame_size = (size_t) dimensions.width * dimensions.height +
+                        (size_t) chroma_width * chroma_height * 2;
+
+    // A truncated last frame is ignored.
+    p = eol + 1;
+    while (end - p >= 5 && memcmp(p, "FRAME", 5) == 0) {
+        eol = (const char *) memchr(p, '\n', end - p);
+        if (eol == NULL || (size_t) (end - eol - 1) < frame_size)
+            break;
+
+        p = eol + 1;
+        frame_offsets.push_back(p - (const char *) file.data);
+        p += frame_size;
+    }
+
+    return NULL;
+}
+
+// Callers should remove the source from mixers first.
+void file_video_source::destroy()
+{
+    {
+        lock_handle lock(*this);
+        file.close();
+    }
+
+    Unref();
+}
+
+void file_video_source::stats(const FunctionCallbackInfo<Value>& args)
+{
+    auto *isolate = args.GetIsolate();
+    lock_handle lock(*this);
+
+    auto obj = Object::New(isolate);
+    obj->Set(String::NewFromUtf8(isolate, "frames"), Number::New(isolate, frames));
+    obj->Set(String::NewFromUtf8(isolate, "repeats"), Number::New(isolate, repeats));
+    obj->Set(String::NewFromUtf8(isolate, "skipped"), Number::New(isolate, skipped));
+    obj->Set(String::NewFromUtf8(isolate, "loops"), Number::New(isolate, loops));
+    args.GetReturnValue().Set(obj);
+}
+
+lockable *file_video_source::lock()
+{
+    return mutex.lock();
+}
+
+void file_video_source::link_video_source(video_source_context &ctx)
+{
+    lock_handle lock(*this);
+    playbacks.push_back({ &ctx, 0, no_frame });
+}
+
+void file_video_source::unlink_video_source(video_source_context &ctx)
+{
+    lock_handle lock(*this);
+    playbacks.remove_if([&](const playback &pb) {
+        return pb.ctx == &ctx;
+    });
+}
+
+void file_video_source::produce_video_frame(video_source_context &ctx)
+{
+    auto &ctx_full = (video_source_context_full &) ctx;
+    lock_handle lock(*this);
+
+    if (file.data == NULL)
+        return;
+
+    playback *pb = NULL;
+    for (auto &p : playbacks) {
+        if (p.ctx == &ctx) {
+            pb = &p;
+            break;
+        }
+    }
+    if (pb == NULL)
+        return;
+
+    if (pb->last_frame == no_frame)
+        pb->start_time = ctx_full.tick_time;
+
+    // Pick the frame nearest to the tick time. Rounding, rather than
+    // truncating, keeps a clock at the file rate on exactly one frame per
+    // tick, despite tick times being truncated to nanoseconds.
+    int64_t elapsed = ctx_full.tick_time - pb->start_time;
+    if (elapsed < 0)
+        elapsed = 0;
+    uint64_t frame_time = (uint64_t) rate.num * 1000000000;
+    uint64_t index = (uint64_t) (((unsigned __int128) elapsed * rate.den + frame_time / 2) / frame_time);
+
+    size_t num_frames = frame_offsets.size();
+    if (!looping && index >= num_frames)
+        index = num_frames - 1;
+
+    if (pb->last_frame != no_frame) {
+        if (index == pb->last_frame)
+            repeats++;
+        else if (index > pb->last_frame + 1)
+            skipped += index - pb->last_frame - 1;
+        if (index / num_frames != pb->last_frame / num_frames)
+            loops++;
+    }
+    pb->last_frame = index;
+    frames++;
+
+    const uint8_t *data = file.data + frame_offsets[index % num_frames];
+    if (y4m) {
+        const uint8_t *planes[3];
+        planes[0] = data;
+        planes[1] = planes[0] + (size_t) strides[0] * dimensions.height;
+        planes[2] = planes[1] + (size_t) strides[1] * ((dimensions.height + 1) / 2);
+        ctx_full.render_i420(dimensions, planes, strides);
+    }
+    else {
+        ctx.render_buffer(dimensions, (void *) data);
+    }
+}
+
+void file_video_source::init_prototype(Handle<FunctionTemplate> func)
+{
+    NODE_SET_PROTOTYPE_METHOD(func, "destroy", [](const FunctionCallbackInfo<Value>& args) {
+        auto source = ObjectWrap::Unwrap<file_video_source>(args.This());
+        source->destroy();
+    });
+    NODE_SET_PROTOTYPE_METHOD(func, "stats", [](const FunctionCallbackInfo<Value>& args) {
+        auto source = ObjectWrap::Unwrap<file_video_source>(args.This());
+        source->stats(args);
+    });
+}
+
+
+// ----- File audio source -----
+
+void file_audio_source::init(const FunctionCallbackInfo<Value>& args)
+{
+    auto *isolate = args.GetIsolate();
+    Handle<Value> val;
+    const char *err;
+
+    if (args.Length() != 1 || !args[0]->IsObject()) {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "Expected an object")));
+        return;
+    }
+    auto params = args[0].As<Object>();
+
+    std::string path;
+    val = params->Get(path_sym.Get(isolate));
+    if (val->IsString()) {
+        String::Utf8Value v(val);
+        path = *v;
+    }
+    if (path.empty()) {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "Invalid path")));
+        return;
+    }
+
+    val = params->Get(loop_sym.Get(isolate));
+    looping = val->IsUndefined() || val->BooleanValue();
+
+    err = file.open(path);
+    if (err != NULL) {
+        throw_file_error(isolate, "Cannot open audio file", err);
+        return;
+    }
+
+    err = parse_wav();
+    if (err != NULL) {
+        file.close();
+        throw_file_error(isolate, "Invalid WAV file", err);
+        return;
+    }
+
+    // Parameters checked, from here on we no longer throw exceptions.
+    Wrap(args.This());
+    Ref();
+    args.GetReturnValue().Set(handle());
+
+    convert_buffer = new float[sample_rate / max_chunk_divisor * mix_channels];
+
+    running = true;
+    start_time = system_time();
+    thread.init(std::bind(&file_audio_source::loop, this));
+}
+
+// Find the format and data chunks. Assumes a little-endian host, because
+// samples are used in place.
+const char *file_audio_source::parse_wav()
+{
+    const uint8_t *p = file.data;
+    const uint8_t *end = p + file.size;
+
+    if (file.size < 12 || memcmp(p, "RIFF", 4) != 0 || memcmp(p + 8, "WAVE", 4) != 0)
+        return "Not a RIFF WAVE file";
+    p += 12;
+
+    const uint8_t *fmt = NULL;
+    uint32_t fmt_size = 0;
+    size_t data_size = 0;
+    while (end - p >= 8) {
+        uint32_t size = read_u32(p + 4);
+        const uint8_t *chunk = p + 8;
+        size_t avail = end - chunk;
+
+        if (memcmp(p, "fmt ", 4) == 0) {
+            if (size < 16 || size > avail)
+                return "Invalid format chunk";
+            fmt = chunk;
+            fmt_size = size;
+        }
+        else if (memcmp(p, "data", 4) == 0) {
+            // Tolerate a data chunk that claims more than was written.
+            samples = chunk;
+            data_size = size < avail ? size : avail;
+            break;
+        }
+
+        if (size >= avail)
+            break;
+        p = chunk + size + (size & 1);
+    }
+
+    if (fmt == NULL)
+        return "Missing format chunk";
+    if (samples == NULL)
+        return "Missing data chunk";
+
+    format = read_u16(fmt);
+    num_channels = read_u16(fmt + 2);
+    sample_rate = read_u32(fmt + 4);
+    uint16_t bits = read_u16(fmt + 14);
+    if (format == wav_format_extensible && fmt_size >= 26)
+        format = read_u16(fmt + 24);
+
+    if (!(format == wav_format_pcm && (bits == 16 || bits == 24 || bits == 32)) &&
+        !(format == wav_format_float && bits == 32))
+        return "Only 16, 24 or 32-bit integer or 32-bit float samples are supported";
+    if (num_channels != 1 && num_channels != 2)
+        return "Only mono or stereo is supported";
+    if (sample_rate < min_sample_rate || sample_rate > max_sample_rate)
+        return "Sample rate must be between 8 and 192 kHz";
+
+    bytes_per_sample = bits / 8;
+    num_frames = data_size / (bytes_per_sample * num_channels);
+    if (num_frames == 0)
+        return "No samples";
+
+    return NULL;
+}
+
+void file_audio_source::destroy()
+{
+    if (running) {
+        running = false;
+        thread.destroy();
+    }
+
+    if (convert_buffer != nullptr) {
+        delete[] convert_buffer;
+        convert_buffer = nullptr;
+    }
+
+    file.close();
+
+    Unref();
+}
+
+lockable *file_audio_source::lock()
+{
+    return thread.lock();
+}
+
+void file_audio_source::link_audio_source(audio_source_context &ctx)
+{
+    lock_handle lock(thread);
+    ctxes.push_back(&ctx);
+}
+
+void file_audio_source::unlink_audio_source(audio_source_context &ctx)
+{
+    lock_handle lock(thread);
+    ctxes.remove(&ctx);
+}
+
+// Convert frames to interleaved stereo floats. The format switch is outside
+// the loops, so each loop is simple enough to be vectorized.
+void file_audio_source::convert(float *out, size_t frame, size_t count)
+{
+    size_t n = count * num_channels;
+    const uint8_t *in = samples + frame * num_channels * bytes_per_sample;
+
+    if (format == wav_format_float) {
+        memcpy(out, in, n * sizeof(float));
+    }
+    else if (bytes_per_sample == 2) {
+        for (size_t i = 0; i < n; i++, in += 2) {
+            int16_t v;
+            memcpy(&v, in, sizeof(v));
+            out[i] = v * (1.0f / 32768);
+        }
+    }
+    else if (bytes_per_sample == 3) {
+        for (size_t i = 0; i < n; i++, in += 3) {
+            int32_t v = (int32_t) (in[0] << 8 | in[1] << 16 | (uint32_t) in[2] << 24) >> 8;
+            out[i] = v * (1.0f / 8388608);
+        }
+    }
+    else {
+        for (size_t i = 0; i < n; i++, in += 4) {
+            int32_t v;
+            memcpy(&v, in, sizeof(v));
+            out[i] = v * (1.0f / 2147483648.0f);
+        }
+    }
+
+    // Expand mono in place, back to front.
+    if (num_channels == 1) {
+        for (size_t i = count; i-- > 0;)
+            out[i * 2] = out[i * 2 + 1] = out[i];
+    }
+}
+
+void file_audio_source::loop()
+{
+    size_t max_chunk_frames = sample_rate / max_chunk_divisor;
+    // If the audio thread falls further behind than a second, skip ahead
+    // instead of flooding the mixer with audio it will drop anyway.
+    uint64_t max_lag_frames = sample_rate;
+
+    while (!thread.wait(audio_interval) && running) {
+        int64_t elapsed = system_time() - start_time;
+        uint64_t due = (elapsed / 1000000000) * sample_rate +
+                       (elapsed % 1000000000) * sample_rate / 1000000000;
+
+        if (due - position > max_lag_frames)
+            position = due - max_lag_frames;
+
+        while (position < due) {
+            size_t count = due - position;
+            if (count > max_chunk_frames)
+                count = max_chunk_frames;
+
+            size_t frame;
+            if (looping) {
+                frame = position % num_frames;
+            }
+            else {
+                if (position >= num_frames)
+                    break;
+                frame = position;
+            }
+            if (count > num_frames - frame)
+                count = num_frames - frame;
+
+            convert(convert_buffer, frame, count);
+
+            int64_t time = start_time +
+                (int64_t) (position / sample_rate) * 1000000000 +
+                (int64_t) (position % sample_rate) * 1000000000 / sample_rate;
+            for (auto ctx : ctxes) {
+                ((audio_source_context_full *) ctx)->render_buffer(
+                    time, convert_buffer, count * mix_channels, sample_rate);
+            }
+
+            position += count;
+        }
+    }
+}
+
+void file_audio_source::init_prototype(Handle<FunctionTemplate> func)
+{
+    NODE_SET_PROTOTYPE_METHOD(func, "destroy", [](const FunctionCallbackInfo<Value>& args) {
+        auto source = ObjectWrap::Unwrap<file_audio_source>(args.This());
+        source->destroy();
+    });
+}
+
+
+}  // namespace p1stream
@@ -27,6 +27,7 @@ Eternal<String> x264_tuning_sym;
 Eternal<String> x264_params_sym;
 Eternal<String> x264_profile_sym;
 Eternal<String> clock_sym;
+Eternal<String> cache_dir_sym;
 Eternal<String> x1_sym;
 Eternal<String> y1_sym;
 Eternal<String> x2_sym;
@@ -35,6 +36,9 @@ Eternal<String> u1_sym;
 Eternal<String> v1_sym;
 Eternal<String> u2_sym;
 Eternal<String> v2_sym;
+Eternal<String> latency_sym;
+Eternal<String> tap_sym;
+Eternal<String> interval_sym;
 Eternal<String> buf_sym;
 Eternal<String> slice_sym;
 Eternal<String> length_sym;
@@ -49,6 +53,26 @@ Eternal<String> priority_sym;
 
 Eternal<String> numerator_sym;
 Eternal<String> denominator_sym;
+Eternal<String> limit_sym;
+Eternal<String> paused_sym;
+Eternal<String> max_pending_sym;
+Eternal<String> realtime_priority_sym;
+Eternal<String> cpu_sym;
+Eternal<String> threads_sym;
+Eternal<String> quality_sym;
+Eternal<String> path_sym;
+Eternal<String> slots_sym;
+Eternal<String> loop_sym;
+Eternal<String> entropy_sym;
+Eternal<String> frequency_sym;
+Eternal<String> sample_rate_sym;
+Eternal<String> channels_sym;
+Eternal<String> bitrate_sym;
+Eternal<String> encodings_sym;
+Eternal<String> encoding_sym;
+Eternal<String> levels_rate_sym;
+Eternal<String> codec_sym;
+Eternal<String> frame_duration_sym;
 
 Eternal<String> volume_sym;
 
@@ -65,6 +89,42 @@ static void software_clock_constructor(const FunctionCallbackInfo<Value>& args)
     clock->init(args);
 }
 
+static void offline_clock_constructor(const FunctionCallbackInfo<Value>& args)
+{
+    auto clock = new offline_clock();
+    clock->init(args);
+}
+
+static void preview_generator_constructor(const FunctionCallbackInfo<Value>& args)
+{
+    auto preview = new preview_generator();
+    preview->init(args);
+}
+
+static void file_video_source_constructor(const FunctionCallbackInfo<Value>& args)
+{
+    auto source = new file_video_source();
+    source->init(args);
+}
+
+static void file_audio_source_constructor(const FunctionCallbackInfo<Value>& args)
+{
+    auto source = new file_audio_source();
+    source->init(args);
+}
+
+static void test_pattern_source_constructor(const FunctionCallbackInfo<Value>& args)
+{
+    auto source = new test_pattern_source();
+    source->init(args);
+}
+
+static void tone_source_constructor(const FunctionCallbackInfo<Value>& args)
+{
+    auto source = new tone_source();
+    source->init(args);
+}
+
 static void audio_mixer_constructor(const FunctionCallbackInfo<Value>& args)
 {
     auto mixer = new audio_mixer_full();
@@ -107,6 +167,8 @@ static void init(Handle<Object> exports, Handle<Value> module,
     NODE_DEFINE_CONSTANT(exports, EV_VIDEO_FRAME);
     NODE_DEFINE_CONSTANT(exports, EV_AUDIO_HEADERS);
     NODE_DEFINE_CONSTANT(exports, EV_AUDIO_FRAME);
+    NODE_DEFINE_CONSTANT(exports, EV_AUDIO_LEVELS);
+    NODE_DEFINE_CONSTANT(exports, EV_PREVIEW_FRAME);
 
     // FIXME: Create our own environment, like node.
 #define SYM(handle, value) handle.Set(isolate, String::NewFromUtf8(isolate, value))
@@ -120,6 +182,7 @@ static void init(Handle<Object> exports, Handle<Value> module,
     SYM(x264_params_sym, "x264Params");
     SYM(x264_profile_sym, "x264Profile");
     SYM(clock_sym, "clock");
+    SYM(cache_dir_sym, "cacheDir");
     SYM(x1_sym, "x1");
     SYM(y1_sym, "y1");
     SYM(x2_sym, "x2");
@@ -128,6 +191,9 @@ static void init(Handle<Object> exports, Handle<Value> module,
     SYM(v1_sym, "v1");
     SYM(u2_sym, "u2");
     SYM(v2_sym, "v2");
+    SYM(latency_sym, "latency");
+    SYM(tap_sym, "tap");
+    SYM(interval_sym, "interval");
     SYM(buf_sym, "buf");
     SYM(slice_sym, "slice");
     SYM(length_sym, "length");
@@ -142,6 +208,26 @@ static void init(Handle<Object> exports, Handle<Value> module,
 
     SYM(numerator_sym, "numerator");
     SYM(denominator_sym, "denominator");
+    SYM(limit_sym, "limit");
+    SYM(paused_sym, "paused");
+    SYM(max_pending_sym, "maxPending");
+    SYM(realtime_priority_sym, "realtimePriority");
+    SYM(cpu_sym, "cpu");
+    SYM(threads_sym, "threads");
+    SYM(quality_sym, "quality");
+    SYM(path_sym, "path");
+    SYM(slots_sym, "slots");
+    SYM(loop_sym, "loop");
+    SYM(entropy_sym, "entropy");
+    SYM(frequency_sym, "frequency");
+    SYM(sample_rate_sym, "sampleRate");
+    SYM(channels_sym, "channels");
+    SYM(bitrate_sym, "bitrate");
+    SYM(encodings_sym, "encodings");
+    SYM(encoding_sym, "encoding");
+    SYM(levels_rate_sym, "levelsRate");
+    SYM(codec_sym, "codec");
+    SYM(frame_duration_sym, "frameDuration");
 
     SYM(volume_sym, "volume");
 #undef SYM
@@ -160,6 +246,20 @@ static void init(Handle<Object> exports, Handle<Value> module,
     software_clock::init_prototype(func);
     exports->Set(name, func->GetFunction());
 
+    name = String::NewFromUtf8(isolate, "OfflineClock");
+    func = FunctionTemplate::New(isolate, offline_clock_constructor);
+    func->InstanceTemplate()->SetInternalFieldCount(1);
+    func->SetClassName(name);
+    offline_clock::init_prototype(func);
+    exports->Set(name, func->GetFunction());
+
+    name = String::NewFromUtf8(isolate, "PreviewGenerator");
+    func = FunctionTemplate::New(isolate, preview_generator_constructor);
+    func->InstanceTemplate()->SetInternalFieldCount(1);
+    func->SetClassName(name);
+    preview_generator::init_prototype(func);
+    exports->Set(name, func->GetFunction());
+
     name = String::NewFromUtf8(isolate, "AudioMixer");
     func = FunctionTemplate::New(isolate, audio_mixer_constructor);
     func->InstanceTemplate()->SetInternalFieldCount(1);
@@ -167,7 +267,39 @@ static void init(Handle<Object> exports, Handle<Value> module,
     audio_mixer_full::init_prototype(func);
     exports->Set(name, func->GetFunction());
 
+    name = String::NewFromUtf8(isolate, "FileVideoSource");
+    func = FunctionTemplate::New(isolate, file_video_source_constructor);
+    func->InstanceTemplate()->SetInternalFieldCount(1);
+    func->SetClassName(name);
+    file_video_source::init_prototype(func);
+    exports->Set(name, func->GetFunction());
+
+    name = String::NewFromUtf8(isolate, "FileAudioSource");
+    func = FunctionTemplate::New(isolate, file_audio_source_constructor);
+    func->InstanceTemplate()->SetInternalFieldCount(1);
+    func->SetClassName(name);
+    file_audio_source::init_prototype(func);
+    exports->Set(name, func->GetFunction());
+
+    name = String::NewFromUtf8(isolate, "TestPatternSource");
+    func = FunctionTemplate::New(isolate, test_pattern_source_constructor);
+    func->InstanceTemplate()->SetInternalFieldCount(1);
+    func->SetClassName(name);
+    test_pattern_source::init_prototype(func);
+    exports->Set(name, func->GetFunction());
+
+    name = String::NewFromUtf8(isolate, "ToneSource");
+    func = FunctionTemplate::New(isolate, tone_source_constructor);
+    func->InstanceTemplate()->SetInternalFieldCount(1);
+    func->SetClassName(name);
+    tone_source::init_prototype(func);
+    exports->Set(name, func->GetFunction());
+
     module_platform_init(exports, module, context, priv);
+
+#if P1STREAM_BENCH
+    module_bench_init(exports, module, context, priv);
+#endif
 }
 
 
@@ -0,0 +1,204 @@
+#include "p1stream_priv.h"
+
+namespace p1stream {
+
+// Default number of undelivered frames per mixer before we stop ticking.
+static const int default_max_pending = 8;
+
+// How long to sleep while idle or waiting on mixers.
+static const int64_t idle_interval = 1000000;  // 1ms
+
+
+void offline_clock::init(const FunctionCallbackInfo<Value>& args)
+{
+    auto *isolate = args.GetIsolate();
+
+    if (args.Length() != 1 || !args[0]->IsObject()) {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "Expected an object")));
+        return;
+    }
+    auto params = args[0].As<Object>();
+
+    auto numVal = params->Get(numerator_sym.Get(isolate));
+    auto denVal = params->Get(denominator_sym.Get(isolate));
+    if (!numVal->IsUint32()) {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "Invalid numerator")));
+        return;
+    }
+    if (!denVal->IsUint32()) {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "Invalid denominator")));
+        return;
+    }
+
+    rate.num = numVal->Uint32Value();
+    rate.den = denVal->Uint32Value();
+    if (rate.num == 0 || rate.den == 0) {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "Invalid fraction")));
+        return;
+    }
+
+    auto val = params->Get(limit_sym.Get(isolate));
+    if (val->IsUndefined()) {
+        limit = 0;
+    }
+    else if (val->IsUint32()) {
+        limit = val->Uint32Value();
+    }
+    else {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "Invalid limit")));
+        return;
+    }
+
+    val = params->Get(max_pending_sym.Get(isolate));
+    if (val->IsUndefined()) {
+        max_pending = default_max_pending;
+    }
+    else if (val->IsUint32() && val->Uint32Value() != 0) {
+        max_pending = val->Uint32Value();
+    }
+    else {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "Invalid maxPending")));
+        return;
+    }
+
+    paused = params->Get(paused_sym.Get(isolate))->BooleanValue();
+
+    int num_threads = tick_dispatcher::threads_param(isolate, params);
+    if (num_threads == 0)
+        return;
+
+    // Parameters checked, from here on we no longer throw exceptions.
+    Wrap(args.This());
+    Ref();
+    args.GetReturnValue().Set(handle());
+
+    dispatcher.init(num_threads);
+
+    running = true;
+    thread.init(std::bind(&offline_clock::loop, this));
+}
+
+void offline_clock::destroy()
+{
+    if (running) {
+        running = false;
+        thread.destroy();
+        dispatcher.destroy();
+    }
+
+    Unref();
+}
+
+void offline_clock::resume()
+{
+    lock_handle lock(thread);
+    paused = false;
+}
+
+void offline_clock::stats(const FunctionCallbackInfo<Value>& args)
+{
+    auto *isolate = args.GetIsolate();
+    lock_handle lock(thread);
+
+    int64_t elapsed = 0;
+    if (end_time)
+        elapsed = end_time - start_time;
+    else if (start_time)
+        elapsed = system_time() - start_time;
+
+    auto obj = Object::New(isolate);
+    obj->Set(String::NewFromUtf8(isolate, "ticks"), Number::New(isolate, ticks));
+    obj->Set(String::NewFromUtf8(isolate, "stalls"), Number::New(isolate, stalls));
+    obj->Set(String::NewFromUtf8(isolate, "elapsed"), Number::New(isolate, elapsed));
+    obj->Set(String::NewFromUtf8(isolate, "done"), Boolean::New(isolate, end_time != 0));
+    obj->Set(String::NewFromUtf8(isolate, "dispatch"), dispatcher.stats_to_js(isolate));
+    args.GetReturnValue().Set(obj);
+}
+
+lockable *offline_clock::lock()
+{
+    return thread.lock();
+}
+
+void offline_clock::link_video_clock(video_clock_context &ctx)
+{
+    ctxes.push_back(&ctx);
+    dispatcher.link(ctx);
+}
+
+void offline_clock::unlink_video_clock(video_clock_context &ctx)
+{
+    ctxes.remove(&ctx);
+    dispatcher.unlink(ctx);
+}
+
+fraction_t offline_clock::video_ticks_per_second(video_clock_context &ctx)
+{
+    return rate;
+}
+
+// Whether any of the linked mixers has too many frames in flight.
+bool offline_clock::backlogged()
+{
+    for (auto ctx : ctxes) {
+        auto *mixer = (video_mixer_base *) ctx->mixer();
+        if (mixer->frames_pending >= max_pending)
+            return true;
+    }
+    return false;
+}
+
+void offline_clock::loop()
+{
+    while (running) {
+        bool idle = paused || ctxes.empty() || (limit && ticks == limit);
+        if (idle || backlogged()) {
+            if (!idle)
+                stalls++;
+            if (thread.wait(idle_interval))
+                break;
+            continue;
+        }
+
+        // Timestamps start at the wall time of the first tick, so that output
+        // looks like that of a regular clock.
+        if (start_time == 0)
+            start_time = system_time();
+
+        frame_time_t time = start_time + tick_offset(ticks + 1, rate);
+        dispatcher.dispatch(time);
+        dispatcher.wait_idle();
+
+        if (++ticks == limit)
+            end_time = system_time();
+
+        // Briefly release the lock, so mixers can link and unlink.
+        thread.unlock();
+        thread.lock();
+    }
+}
+
+void offline_clock::init_prototype(Handle<FunctionTemplate> func)
+{
+    NODE_SET_PROTOTYPE_METHOD(func, "destroy", [](const FunctionCallbackInfo<Value>& args) {
+        auto clock = ObjectWrap::Unwrap<offline_clock>(args.This());
+        clock->destroy();
+    });
+    NODE_SET_PROTOTYPE_METHOD(func, "resume", [](const FunctionCallbackInfo<Value>& args) {
+        auto clock = ObjectWrap::Unwrap<offline_clock>(args.This());
+        clock->resume();
+    });
+    NODE_SET_PROTOTYPE_METHOD(func, "stats", [](const FunctionCallbackInfo<Value>& args) {
+        auto clock = ObjectWrap::Unwrap<offline_clock>(args.This());
+        clock->stats(args);
+    });
+}
+
+
+}  // namespace p1stream
@@ -3,8 +3,12 @@
 
 #include "p1stream.h"
 
+#include <string>
 #include <vector>
 #include <list>
+#include <deque>
+#include <atomic>
+#include <memory>
 
 extern "C" {
 
@@ -15,6 +19,8 @@ extern "C" {
 
 #include <x264.h>
 
+#include <opus/opus.h>
+
 #if __APPLE__
 #   include <OpenCL/opencl.h>
 #else
@@ -39,6 +45,7 @@ extern Eternal<String> x264_tuning_sym;
 extern Eternal<String> x264_params_sym;
 extern Eternal<String> x264_profile_sym;
 extern Eternal<String> clock_sym;
+extern Eternal<String> cache_dir_sym;
 extern Eternal<String> x1_sym;
 extern Eternal<String> y1_sym;
 extern Eternal<String> x2_sym;
@@ -47,6 +54,9 @@ extern Eternal<String> u1_sym;
 extern Eternal<String> v1_sym;
 extern Eternal<String> u2_sym;
 extern Eternal<String> v2_sym;
+extern Eternal<String> latency_sym;
+extern Eternal<String> tap_sym;
+extern Eternal<String> interval_sym;
 extern Eternal<String> buf_sym;
 extern Eternal<String> slice_sym;
 extern Eternal<String> length_sym;
@@ -61,6 +71,26 @@ extern Eternal<String> priority_sym;
 
 extern Eternal<String> numerator_sym;
 extern Eternal<String> denominator_sym;
+extern Eternal<String> limit_sym;
+extern Eternal<String> paused_sym;
+extern Eternal<String> max_pending_sym;
+extern Eternal<String> realtime_priority_sym;
+extern Eternal<String> cpu_sym;
+extern Eternal<String> threads_sym;
+extern Eternal<String> quality_sym;
+extern Eternal<String> path_sym;
+extern Eternal<String> slots_sym;
+extern Eternal<String> loop_sym;
+extern Eternal<String> entropy_sym;
+extern Eternal<String> frequency_sym;
+extern Eternal<String> sample_rate_sym;
+extern Eternal<String> channels_sym;
+extern Eternal<String> bitrate_sym;
+extern Eternal<String> encodings_sym;
+extern Eternal<String> encoding_sym;
+extern Eternal<String> levels_rate_sym;
+extern Eternal<String> codec_sym;
+extern Eternal<String> frame_duration_sym;
 
 extern Eternal<String> volume_sym;
 
@@ -68,36 +98,256 @@ extern Eternal<String> volume_sym;
 #define EV_VIDEO_FRAME   'vfrm'
 #define EV_AUDIO_HEADERS 'ahdr'
 #define EV_AUDIO_FRAME   'afrm'
+#define EV_AUDIO_LEVELS  'alvl'
+#define EV_PREVIEW_FRAME 'pjpg'
 
 void module_platform_init(
     Handle<Object> exports, Handle<Value> module,
     Handle<Context> context, void* priv);
 
+#if P1STREAM_BENCH
+void module_bench_init(
+    Handle<Object> exports, Handle<Value> module,
+    Handle<Context> context, void* priv);
+#endif
+
+
+// ----- Utility types -----
+
+// Histogram of durations in nanoseconds, used for statistics. Buckets are
+// logarithmic, with four linear steps per power of two, so memory use is fixed
+// and percentiles are accurate to within roughly 12%. Callers are responsible
+// for locking.
+class latency_histogram {
+public:
+    latency_histogram();
+
+    static const int num_buckets = 160;
+
+    uint64_t count;
+    int64_t sum;
+    int64_t min;
+    int64_t max;
+    uint64_t buckets[num_buckets];
+
+    void reset();
+    void record(int64_t value);
+    int64_t percentile(double p) const;
+
+    // Build a plain JavaScript object with a summary.
+    Local<Object> to_js(Isolate *isolate) const;
+    // Build an array of [value, count] pairs for all non-empty buckets.
+    Local<Array> buckets_to_js(Isolate *isolate) const;
+};
+
+// On-disk cache of compiled program binaries. Entries are keyed by a string
+// that should describe the device, driver and source. The full key is stored
+// and verified on load, so any mismatch is simply a miss. An empty directory
+// disables the cache.
+class program_cache {
+public:
+    std::string dir;
+
+    bool load(const std::string &key, std::vector<char> &data);
+    void store(const std::string &key, const void *data, size_t size);
+
+    // Short hash for use in keys, and to name files.
+    static std::string hash(const std::string &str);
+
+    // Internal.
+    std::string path_for(const std::string &key);
+};
 
 
 // ----- Video types ----
 
+class video_mixer_base;
 class video_clock_context_full;
 class video_source_context_full;
 class video_hook_context_full;
 
-// Lockable is a proxy for the video clock.
+// Frames pushed by a source from its own thread, with capture timestamps.
+// The mixer's upload thread copies them into textures, and every tick renders
+// the frame nearest to the tick time. Shared between the source context, the
+// upload thread and ticks.
+class video_upload_queue {
+public:
+    video_upload_queue();
+
+    static const int num_staging = 4;
+    static const int num_slots = 4;
+
+    struct staged_frame {
+        frame_time_t time;
+        dimensions_t dimensions;
+        std::vector<char> data;
+    };
+
+    enum slot_state {
+        slot_free,
+        slot_uploading,
+        slot_ready,
+        slot_current
+    };
+
+    struct slot {
+        slot_state state;
+        GLuint texture;
+        dimensions_t dimensions;
+        frame_time_t time;
+        GLsync fence;
+    };
+
+    // Set on the first push, after which ticks no longer call the source.
+    std::atomic<bool> active;
+    // Set when the source is unlinked, after which the upload thread cleans up.
+    std::atomic<bool> closed;
+
+    // Frames waiting for upload. This is a lock-free ring with the source as
+    // the single producer, and the upload thread as the single consumer.
+    staged_frame staging[num_staging];
+    std::atomic<uint32_t> staging_head;
+    std::atomic<uint32_t> staging_tail;
+
+    // Uploaded frames, protected by the mutex. The mutex is never held
+    // during an upload or draw. Texture names are only changed by the upload
+    // thread.
+    lockable_mutex mutex;
+    slot slots[num_slots];
+
+    // Ticks select the frame nearest to the tick time minus this offset.
+    int64_t latency;
+
+    // Statistics. Pushed and overflows are counted by the source, the rest
+    // are protected by the mutex. Drops are frames that were never rendered,
+    // repeats are ticks that rendered the same frame again.
+    std::atomic<uint64_t> pushed;
+    std::atomic<uint64_t> overflows;
+    uint64_t uploaded;
+    uint64_t dropped;
+    uint64_t repeats;
+
+    Local<Object> stats_to_js(Isolate *isolate);
+};
+
+// Converted I420 frame, shared read-only between the mixer and taps. The
+// mixer reuses a frame once nothing else references it.
+class video_frame {
+public:
+    video_frame();
+
+    frame_time_t time;
+    dimensions_t dimensions;
+    uint8_t *planes[3];
+    int strides[3];
+    std::vector<uint8_t> data;
+
+    // Cleared with release ordering when the last reference is dropped, and
+    // checked with acquire ordering before reuse, so all reads of a tap
+    // happen before the mixer writes to the frame again.
+    std::atomic<bool> in_use;
+};
+
+class video_tap_context;
+
+// Taps receive every Nth converted frame, without another GPU readback. They
+// are called on a thread of their own, and a slow tap only misses frames.
+// Lockable implementations need not lock anything; the mixer doesn't use it.
+class video_tap : public ObjectWrap, public lockable {
+public:
+    virtual void link_video_tap(video_tap_context &ctx);
+    virtual void unlink_video_tap(video_tap_context &ctx);
+    virtual void video_tap_frame(video_tap_context &ctx, std::shared_ptr<const video_frame> frame) = 0;
+};
+
+// Link between a mixer and a tap, with the thread that calls the tap. Only
+// the most recent undelivered frame is kept.
+class video_tap_context {
+public:
+    video_tap_context(video_mixer_base *mixer, video_tap *tap, uint32_t interval);
+
+    video_mixer_base *mixer;
+    video_tap *tap;
+    uint32_t interval;
+    uint64_t counter;
+
+    lockable_mutex mutex;
+    uv_cond_t cond;
+    uv_thread_t thread;
+    bool running;
+    std::shared_ptr<const video_frame> pending;
+
+    // Statistics, protected by the mutex.
+    uint64_t delivered;
+    uint64_t dropped;
+
+    void start();
+    void stop();
+    // Hand a frame to the tap thread, replacing any undelivered frame.
+    void offer(std::shared_ptr<const video_frame> frame);
+
+    // Internal.
+    static void thread_cb(void *arg);
+    void loop();
+};
+
+// Upload thread of a mixer, with its own GL context in the mixer's share
+// group. Services all upload queues of the mixer. The thread and context are
+// only created once a source pushes its first frame.
+class video_uploader {
+public:
+    video_uploader();
+
+    video_mixer_base *mixer;
+
+    lockable_mutex mutex;
+    uv_cond_t cond;
+    uv_thread_t thread;
+    bool started;
+    bool stopped;
+    bool running;
+    bool pending;
+
+    std::vector<std::shared_ptr<video_upload_queue>> queues;
+
+    void init(video_mixer_base *mixer);
+    void destroy();
+
+    // Create a queue for a new source context.
+    std::shared_ptr<video_upload_queue> create_queue();
+    // Wake the thread, because a queue has work. Starts the thread if a queue
+    // is active, otherwise only forgets closed queues.
+    void signal();
+
+    // Internal.
+    static void thread_cb(void *arg);
+    void loop();
+    bool upload(video_upload_queue &queue);
+    void cleanup(video_upload_queue &queue);
+};
+
+// Ticks arrive on a clock worker thread, and hold the mixer lock throughout.
+// The GL context is released after each tick, because the next tick may run
+// on a different thread.
 class video_mixer_base : public video_mixer {
 public:
     video_mixer_base();
 
     Isolate *isolate;
     event_buffer buffer;
+    lockable_mutex mutex;
     bool running;
 
     video_clock_context_full *clock_ctx;
     std::vector<video_source_context_full> source_ctxes;
     std::vector<video_hook_context_full> hook_ctxes;
+    std::vector<std::unique_ptr<video_tap_context>> tap_ctxes;
 
     // Objects set up by platform_init. The GL and CL contexts must be in the
-    // same share group. The CL context is cleaned up by common code and
-    // doesn't need handling in platform_destroy. After platform_init, the GL
-    // context should be active and the output texture bound.
+    // same share group. The CL context may be shared with other mixers.
+    // Common code releases one reference to it, so platform_destroy doesn't
+    // need to. After platform_init, the GL context should be active and the
+    // output texture bound.
     cl_context cl;
     // Additional fields defined in the public header:
     // GLuint texture_;
@@ -109,27 +359,67 @@ public:
     dimensions_t out_dimensions;
     x264_picture_t out_pic;
 
+    // Frames for taps. While taps are linked, conversion writes to one of
+    // these instead of the buffer of out_pic, so the result can be shared.
+    std::vector<std::shared_ptr<video_frame>> frame_pool;
+
     // OpenGL objects.
     GLuint fbo;
     GLuint vao;
     GLuint vbo;
     GLuint program;
     GLuint tex_u;
+    GLuint tex_u_u;
+    GLuint tex_v_u;
+    GLuint planar_u;
+
+    // Binaries of the above GL program and the CL program below.
+    program_cache cache;
 
     // OpenCL objects.
     size_t yuv_work_size[2];
     cl_command_queue clq;
     cl_mem tex_mem;
     cl_mem out_mem;
+    cl_program yuv_program;  // Shared with other mixers, see video.cc.
     cl_kernel yuv_kernel;
 
+    // Asynchronous source uploads.
+    video_uploader uploader;
+
     // Video encoding.
     x264_param_t enc_params;
     x264_t *enc;
 
+    // Number of frame events not yet delivered to JavaScript. Clocks that
+    // run faster than realtime use this for backpressure.
+    std::atomic<int> frames_pending;
+
+    // Ticks that arrived while the previous one was still running, and ticks
+    // that were skipped entirely because of that. Updated by the clock.
+    std::atomic<uint64_t> late_ticks;
+    std::atomic<uint64_t> dropped_ticks;
+
+    // Startup timing. The encoder is opened during init, and the latency of
+    // the first frame is measured from the start of init.
+    int64_t init_time;
+    int64_t encoder_open_time;
+    int64_t first_frame_latency;
+
+    // Statistics, protected by the lock.
+    uint64_t ticks;
+    uint64_t frames_out;
+    uint64_t bytes_out;
+    latency_histogram render_latency;
+    latency_histogram convert_latency;
+    latency_histogram encode_latency;
+    latency_histogram tick_latency;
+
     // Internal.
     void clear_sources();
     void clear_hooks();
+    void clear_taps();
+    std::shared_ptr<video_frame> acquire_frame();
     void tick(frame_time_t time);
     GLuint build_shader(GLuint type, const char *source);
     bool build_program();
@@ -142,6 +432,11 @@ public:
     virtual bool platform_init(Handle<Object> params) = 0;
     virtual void platform_destroy() = 0;
     virtual bool activate_gl() = 0;
+    virtual void deactivate_gl() = 0;
+    // Create a context in the share group for the upload thread, and make it
+    // current. These are called on the upload thread, with the lock held.
+    virtual bool upload_gl_init() = 0;
+    virtual void upload_gl_destroy() = 0;
 
     // Public JavaScript methods.
     void init(const FunctionCallbackInfo<Value>& args);
@@ -149,6 +444,8 @@ public:
 
     void set_sources(const FunctionCallbackInfo<Value>& args);
     void set_hooks(const FunctionCallbackInfo<Value>& args);
+    void set_taps(const FunctionCallbackInfo<Value>& args);
+    void stats(const FunctionCallbackInfo<Value>& args);
 
     // Module init.
     static void init_prototype(Handle<FunctionTemplate> func);
@@ -170,6 +467,31 @@ public:
     // Top left and bottom right coordinates of the image area to grab, used to
     // achieve clipping. These are in the range [0, 1].
     GLfloat u1, v1, u2, v2;
+
+    // Offset subtracted from tick times when selecting pushed frames.
+    int64_t latency;
+
+    // Time of the tick being rendered. Sources that play at their own rate
+    // use this instead of the wall clock, so they follow offline clocks too.
+    frame_time_t tick_time;
+
+    std::shared_ptr<video_upload_queue> upload;
+
+    // Chroma textures for render_i420, created on first use. Luma uses the
+    // regular texture.
+    GLuint plane_textures[2];
+
+    // Queue a frame captured at the given time for asynchronous upload. This
+    // copies the data, and may be called from any one thread at a time. Once
+    // a source has pushed a frame, ticks render uploaded frames instead of
+    // calling the source. Frames are dropped if the queue is full.
+    void push_buffer(frame_time_t time, dimensions_t dimensions, const void *data);
+    // Render the uploaded frame nearest to the tick time, if any.
+    void render_uploaded(frame_time_t time);
+    // Render an I420 image, converting it while drawing. Planes are uploaded
+    // straight from the given memory, and strides are in bytes. Chroma planes
+    // are half the dimensions, rounded up.
+    void render_i420(dimensions_t dimensions, const uint8_t *const planes[3], const uint32_t strides[3]);
 };
 
 class video_hook_context_full : public video_hook_context {
@@ -178,6 +500,124 @@ public:
 };
 
 
+// ----- Tick dispatch -----
+
+// Runs ticks for the mixers linked to a clock on a pool of worker threads.
+// Different mixers tick in parallel, but a single mixer only ever runs one
+// tick at a time. When a tick arrives for a mixer that is still busy, it is
+// counted as late, and replaces any tick still waiting for that mixer.
+//
+// Clocks call link, unlink and dispatch with their own lock held. Unlink waits
+// for a running tick of the mixer to finish.
+class tick_dispatcher {
+public:
+    tick_dispatcher();
+
+    struct entry {
+        video_clock_context *ctx;
+        bool busy;
+        bool pending;
+        frame_time_t pending_time;
+    };
+
+    // A dispatched tick, tracked until all mixers have finished it.
+    struct tick_record {
+        frame_time_t time;
+        int64_t start;
+        int remaining;
+    };
+
+    lockable_mutex mutex;
+    uv_cond_t work_cond;
+    uv_cond_t done_cond;
+    std::vector<uv_thread_t> threads;
+    bool running;
+
+    std::list<entry> entries;
+    std::deque<entry *> queue;
+    std::deque<tick_record> records;
+
+    // Statistics, protected by the mutex.
+    uint64_t ticks;
+    uint64_t late;
+    uint64_t dropped;
+    latency_histogram completion;
+
+    void init(int num_threads);
+    void destroy();
+
+    void link(video_clock_context &ctx);
+    void unlink(video_clock_context &ctx);
+    void dispatch(frame_time_t time);
+    // Wait until all dispatched ticks have finished.
+    void wait_idle();
+
+    Local<Object> stats_to_js(Isolate *isolate);
+
+    // Parse the optional `threads` parameter of clocks. Returns 0 and throws
+    // if the value is invalid.
+    static int threads_param(Isolate *isolate, Handle<Object> params);
+
+    // Internal.
+    static void worker_cb(void *arg);
+    void worker();
+    void complete_tick(frame_time_t time);
+    std::list<entry>::iterator find(video_clock_context &ctx);
+};
+
+
+// ----- Preview generator -----
+
+// Tap that produces small JPEG stills for the web interface. Frames are
+// downscaled by halving until they fit the configured dimensions, then
+// encoded on the tap thread. The mixer is asked for frames at roughly the
+// configured rate, by setting the tap interval on link.
+class preview_generator : public video_tap {
+public:
+    preview_generator();
+
+    Isolate *isolate;
+    event_buffer buffer;
+    lockable_mutex mutex;
+
+    dimensions_t max_dimensions;
+    fraction_t rate;
+    int quality;
+
+    // Scratch state of the encoder, protected by the work mutex. This is
+    // separate from the main mutex, so event delivery doesn't wait on
+    // encoding. Buffers only grow.
+    lockable_mutex work_mutex;
+    std::vector<uint8_t> scale_buffers[2];
+    unsigned char *jpeg_buf;
+    unsigned long jpeg_capacity;
+
+    // Statistics, protected by the lock.
+    uint64_t frames;
+    uint64_t bytes;
+    uint64_t errors;
+    latency_histogram encode_latency;
+
+    // Internal.
+    bool encode(const video_frame &frame);
+
+    // Public JavaScript methods.
+    void init(const FunctionCallbackInfo<Value>& args);
+    void destroy();
+    void stats(const FunctionCallbackInfo<Value>& args);
+
+    // Lockable implementation.
+    virtual lockable *lock() final;
+
+    // Video tap implementation.
+    virtual void link_video_tap(video_tap_context &ctx) final;
+    virtual void video_tap_frame(video_tap_context &ctx, std::shared_ptr<const video_frame> frame) final;
+
+    // Module init.
+    static void init_prototype(Handle<FunctionTemplate> func);
+};
+
+
 // ----- Software video clock -----
 
 class software_clock : public video_clock {
@@ -189,14 +629,65 @@ public:
     threaded_loop thread;
     bool running;
 
+    tick_dispatcher dispatcher;
+
+    // Internal.
+    void loop();
+
+    // Public JavaScript methods.
+    void init(const FunctionCallbackInfo<Value>& args);
+    void destroy();
+    void stats(const FunctionCallbackInfo<Value>& args);
+
+    // Lockable implementation.
+    virtual lockable *lock() final;
+
+    // Video clock implementation.
+    virtual void link_video_clock(video_clock_context &ctx) final;
+    virtual void unlink_video_clock(video_clock_context &ctx) final;
+    virtual fraction_t video_ticks_per_second(video_clock_context &ctx) final;
+
+    // Module init.
+    static void init_prototype(Handle<FunctionTemplate> func);
+};
+
+
+// ----- Offline video clock -----
+
+// Clock that ticks back-to-back instead of following wall time. Timestamps are
+// synthetic and evenly spaced at the configured rate. Ticking pauses while no
+// mixers are linked, and while any mixer has too many undelivered frames.
+// Linked mixers tick in parallel, and all finish a tick before the next.
+class offline_clock : public video_clock {
+public:
+    offline_clock();
+
+    fraction_t rate;
+    uint32_t limit;
+    int max_pending;
+
+    threaded_loop thread;
+    bool running;
+    bool paused;
+
     std::list<video_clock_context *> ctxes;
+    tick_dispatcher dispatcher;
+
+    // Statistics, protected by the lock.
+    uint32_t ticks;
+    uint64_t stalls;
+    int64_t start_time;
+    int64_t end_time;
 
     // Internal.
     void loop();
+    bool backlogged();
 
     // Public JavaScript methods.
     void init(const FunctionCallbackInfo<Value>& args);
     void destroy();
+    void resume();
+    void stats(const FunctionCallbackInfo<Value>& args);
 
     // Lockable implementation.
     virtual lockable *lock() final;
@@ -214,6 +705,250 @@ public:
 // ----- Audio types -----
 
 class audio_source_context_full;
+struct audio_kernels;
+
+// Converts a stream of interleaved stereo samples to the mixer sample rate,
+// using a windowed sinc polyphase filter. Phase is kept across calls, so
+// blocks may be of any size. The input timestamps are followed to correct
+// for slight drift between the device clock and system time, by nudging the
+// ratio. A large jump in timestamps restarts the stream.
+class audio_resampler {
+public:
+    static const int num_taps = 32;
+    static const int num_phases = 256;
+
+    audio_resampler();
+
+    uint32_t in_rate;
+    uint32_t out_rate;
+
+    // Coefficients, one row of taps for each phase, plus a final row so
+    // neighbouring phases can be interpolated.
+    std::vector<float> filter;
+
+    // Deinterleaved input, starting with history for the filter. The read
+    // position is fractional, relative to the start of the history.
+    std::vector<float> history[2];
+    double pos;
+    double step;
+    // Accumulated ratio correction.
+    double drift;
+
+    // Time of the first history sample, which is smoothed towards block
+    // timestamps, and the time of the first output sample.
+    double base_time;
+    int64_t out_start_time;
+    uint64_t out_count;
+
+    // Output of the last call, interleaved stereo.
+    std::vector<float> out;
+    int64_t out_time;
+
+    // Resample a block, which may be given in two parts. Returns the number
+    // of output samples, which start at `out_time`.
+    size_t process(int64_t time, const float *a, size_t a_len, const float *b, size_t b_len,
+                   uint32_t rate, uint32_t mix_rate, const audio_kernels &kernels);
+
+    // Internal.
+    void restart(int64_t time, uint32_t rate, uint32_t mix_rate);
+    void append(const float *in, size_t samples);
+    double input_time(double at);
+    int64_t output_time(uint64_t count);
+};
+
+// Peak and sum of squares of interleaved stereo, collected over a metering
+// period.
+class audio_meter {
+public:
+    audio_meter();
+
+    float peak[2];
+    double sum[2];
+    uint64_t frames;
+
+    void add(const audio_kernels &kernels, const float *in, size_t samples);
+    void reset();
+};
+
+// EBU R128 loudness of interleaved stereo. Samples are K-weighted, and mean
+// squares collected in 100ms blocks, from which the momentary (400ms) and
+// short-term (3s) loudness follow, in LUFS.
+class audio_loudness {
+public:
+    static const int num_blocks = 30;
+
+    struct biquad {
+        double b0, b1, b2, a1, a2;
+    };
+
+    audio_loudness();
+
+    // The shelving stage and the high-pass stage of the K filter. State is
+    // per channel and stage, in transposed direct form II.
+    biquad shelf;
+    biquad highpass;
+    double state[2][2][2];
+
+    uint32_t block_frames;
+    uint32_t block_pos;
+    double block_sum;
+
+    // Ring of completed blocks, with the most recent before the next index.
+    double blocks[num_blocks];
+    uint32_t next_block;
+    uint32_t num_filled;
+
+    void init(uint32_t sample_rate);
+    void add(const float *in, size_t frames);
+    double momentary();
+    double short_term();
+
+    // Internal.
+    double average(int count);
+};
+
+// Single-producer, single-consumer ring of timestamped sample blocks, written
+// by a source and drained by the mixer thread. Writing is wait-free, so
+// sources on realtime threads never wait for the mixer. Blocks that don't fit
+// are dropped and counted as overruns.
+class audio_input_ring {
+public:
+    static const uint32_t num_blocks = 256;
+    static const uint32_t num_samples = 1 << 17;  // About 1.5s, power of two
+
+    struct block {
+        int64_t time;
+        uint32_t pos;
+        uint32_t samples;
+        uint32_t rate;
+    };
+
+    audio_input_ring();
+
+    block blocks[num_blocks];
+    std::vector<float> data;
+
+    // Free-running block counters.
+    std::atomic<uint32_t> head;
+    std::atomic<uint32_t> tail;
+
+    // Free-running sample position, only used by the producer.
+    uint32_t write_pos;
+    // Whether the consumer has seen any blocks yet, and the time up to which
+    // it has mixed samples.
+    bool started;
+    int64_t end_time;
+
+    // Statistics. Overruns are counted by the producer, the rest by the
+    // consumer under the mixer lock. Underruns are mixer intervals in which
+    // a source that delivered before had nothing.
+    std::atomic<uint64_t> overruns;
+    uint64_t blocks_read;
+    uint64_t samples_read;
+    uint64_t underruns;
+
+    // Resampler state and levels, only used by the consumer. These live with
+    // the ring, so they survive the source list changing, as long as the
+    // source stays in it. Restarting the resampler would click.
+    audio_resampler resampler;
+    audio_meter meter;
+
+    bool write(int64_t time, const float *in, size_t samples, uint32_t rate);
+};
+
+class audio_mixer_full;
+
+enum audio_codec_t {
+    AUDIO_CODEC_AAC,
+    AUDIO_CODEC_OPUS
+};
+
+// Configuration of one encoding of the mix. The frame duration is in
+// milliseconds, and only applies to Opus.
+struct audio_encoding_params {
+    audio_codec_t codec;
+    uint32_t num_channels;
+    uint32_t bit_rate;
+    uint32_t frame_duration;
+};
+
+// Encoder on its own thread, so a slow encode never holds the mixer lock.
+// The mixer pushes whole frames of PCM to a bounded queue, and frames that
+// don't fit are dropped. The thread takes the mixer lock only to emit events.
+//
+// Queued frames are AAC sized. Opus frames are shorter, so samples for Opus
+// are collected into frames of its own size first.
+class audio_encoder {
+public:
+    static const int frame_size = 1024;
+    static const int max_channels = 2;
+    static const uint32_t queue_size = 32;  // About 0.75s at 44.1 kHz
+    static const int out_bytes = 4000;  // Enough for either codec
+
+    struct queued_frame {
+        int64_t pts;
+        int16_t samples[frame_size * max_channels];
+    };
+
+    audio_encoder();
+
+    audio_mixer_full *mixer;
+    uint32_t id;
+    audio_codec_t codec;
+    uint32_t sample_rate;
+    uint32_t num_channels;
+
+    // AAC encoder.
+    HANDLE_AACENCODER enc;
+
+    // Opus encoder, and the partial frame being collected for it.
+    OpusEncoder *opus;
+    uint32_t opus_frame_size;
+    std::vector<int16_t> opus_pcm;
+    uint32_t opus_pcm_frames;
+    int64_t opus_pcm_pts;
+
+    lockable_mutex mutex;
+    uv_cond_t cond;
+    uv_thread_t thread;
+    bool running;
+
+    // Queue of frames, protected by the mutex. The counters are free-running.
+    // The frame at the tail is owned by the thread while it is encoding.
+    std::vector<queued_frame> queue;
+    uint32_t head;
+    uint32_t tail;
+    // Scratch space for downmixing, used by the mixer thread.
+    float downmix[frame_size];
+
+    // Statistics, protected by the mutex.
+    uint64_t frames;
+    uint64_t dropped;
+    uint32_t max_depth;
+    latency_histogram encode_latency;
+
+    // Open the encoder and start the thread. Errors are emitted to the mixer
+    // event buffer. Called with configuration checked.
+    bool init(audio_mixer_full *mixer, uint32_t id, uint32_t sample_rate,
+              const audio_encoding_params &params);
+    void destroy();
+
+    // Queue a frame of interleaved stereo float samples. Called from the
+    // mixer thread, with the mixer lock held.
+    void push(int64_t pts, const float *in);
+
+    Local<Object> stats_to_js(Isolate *isolate);
+
+    // Internal.
+    bool init_aac(uint32_t bit_rate);
+    bool init_opus(uint32_t bit_rate, uint32_t frame_duration);
+    void emit_headers(const uint8_t *data, size_t size, uint32_t bit_rate);
+    static void thread_cb(void *arg);
+    void loop();
+    void encode_aac(queued_frame &frame);
+    void encode_opus(queued_frame &frame);
+    void emit_frame(int64_t pts, const uint8_t *data, size_t size);
+};
 
 class audio_mixer_full : public audio_mixer {
 public:
@@ -222,24 +957,69 @@ public:
     Isolate *isolate;
     event_buffer buffer;
 
-    std::vector<audio_source_context_full> source_ctxes;
+    // Sources keep pointers to their contexts, and contexts live as long as
+    // the source is in the list, so their rings keep unmixed blocks.
+    std::vector<std::unique_ptr<audio_source_context_full>> source_ctxes;
 
     Persistent<Function> on_event;
 
-    // Mix buffer.
+    // Mixing is always stereo at the output sample rate. Encodings may
+    // downmix to mono.
+    uint32_t sample_rate;
+
+    // Timing. Frames are encoded once every source delivered them, or once
+    // they are older than the latency. The thread runs at least every
+    // interval, and sooner when sources wake it.
+    int64_t mix_interval;
+    int64_t mix_latency;
+
+    // Mix ring, indexed by absolute sample position modulo its size. The
+    // read position is the oldest sample not yet encoded. Its time is derived
+    // from the start time, so no rounding error accumulates.
     float *mix_buffer;
+    size_t mix_samples;
+    size_t mix_mask;
+    size_t mix_latency_samples;
+    int64_t mix_start_time;
+    uint64_t mix_pos;
     int64_t mix_time;
+    const audio_kernels *kernels;
 
-    // Encoder.
-    HANDLE_AACENCODER enc;
+    std::vector<std::unique_ptr<audio_encoder>> encoders;
 
     // Mix thread.
     threaded_loop thread;
     bool running;
 
+    // Wake-up by sources. The thread sleeps on the wake condition with the
+    // main lock released. Sources signal it once they've written past the
+    // wake time, which is the end of the next frame to encode.
+    lockable_mutex wake_mutex;
+    uv_cond_t wake_cond;
+    bool wake_pending;
+    std::atomic<int64_t> wake_time;
+
+    // Level metering, enabled by a non-zero rate. Levels are emitted every
+    // period of mixed frames, which is rounded up to whole encoder frames.
+    uint32_t levels_rate;
+    uint64_t levels_frames;
+    audio_meter master_meter;
+    audio_loudness loudness;
+
+    // Statistics. Latency is the time from the end of a frame to encoding.
+    latency_histogram latency;
+
     // Internal.
     void clear_sources();
     void loop();
+    bool sleep(int64_t timeout);
+    void wake();
+    int64_t drain_inputs();
+    void emit_levels();
+    void mix_input(int64_t time, const float *a, size_t a_len, const float *b, size_t b_len, float volume);
+    void mix_into(size_t offset, const float *in, size_t samples, float volume);
+    void clear_mix(uint64_t pos, size_t samples);
+    int64_t position_time(uint64_t pos);
     size_t time_to_samples(int64_t time);
     int64_t samples_to_time(size_t samples);
 
@@ -251,6 +1031,7 @@ public:
     void destroy();
 
     void set_sources(const FunctionCallbackInfo<Value>& args);
+    void stats(const FunctionCallbackInfo<Value>& args);
 
     // Module init.
     static void init_prototype(Handle<FunctionTemplate> func);
@@ -262,18 +1043,287 @@ public:
 
     // Volume in range [0, 1].
     float volume;
+
+    // Render samples at any sample rate, which the mixer resamples from.
+    using audio_source_context::render_buffer;
+    void render_buffer(int64_t time, float *in, size_t samples, uint32_t rate);
+
+    std::shared_ptr<audio_input_ring> ring;
+};
+
+
+// ----- Audio kernels -----
+
+// Inner loops of the audio mixer. There are variants for several instruction
+// sets, and the best one the CPU supports is selected on first use. Sample
+// counts are of individual samples, not frames, and buffers need not be
+// aligned.
+struct audio_kernels {
+    const char *name;
+    // Multiply samples by volume and add them to the output.
+    void (*mix)(float *out, const float *in, size_t samples, float volume);
+    // Convert samples to 16-bit, rounding and saturating outside [-1, +1].
+    void (*to_s16)(int16_t *out, const float *in, size_t samples);
+    // Sum of products, for filters.
+    float (*dot)(const float *a, const float *b, size_t samples);
+    // Raise the per-channel peak, and add squares to the per-channel sum,
+    // of interleaved stereo.
+    void (*levels)(const float *in, size_t samples, float *peak, float *sum);
+};
+
+const audio_kernels &best_audio_kernels();
+// All variants the CPU supports, from the scalar fallback to the best.
+std::vector<const audio_kernels *> supported_audio_kernels();
+
+
+// ----- File sources -----
+
+// Read-only mapping of a whole file. Used by the file sources below, so
+// playback only touches the page cache and never allocates.
+class mapped_file {
+public:
+    mapped_file();
+    ~mapped_file();
+
+    const uint8_t *data;
+    size_t size;
+
+    // Map the file, returning an error message on failure.
+    const char *open(const std::string &path);
+    void close();
+};
+
+// Video source that plays a Y4M file, or a file of raw BGRA frames, following
+// the tick times of the mixer. Frames are rendered straight from the mapping.
+// Each linked mixer starts playback at its first tick. The frame rate comes
+// from the Y4M header, unless overridden.
+class file_video_source : public video_source {
+public:
+    file_video_source();
+
+    lockable_mutex mutex;
+
+    mapped_file file;
+    bool y4m;
+    bool looping;
+    dimensions_t dimensions;
+    fraction_t rate;  // Seconds per frame.
+    uint32_t strides[3];
+    std::vector<size_t> frame_offsets;
+
+    // Playback position per linked mixer, protected by the lock.
+    struct playback {
+        video_source_context *ctx;
+        frame_time_t start_time;
+        uint64_t last_frame;
+    };
+    std::list<playback> playbacks;
+
+    // Statistics, protected by the lock.
+    uint64_t frames;
+    uint64_t repeats;
+    uint64_t skipped;
+    uint64_t loops;
+
+    // Internal.
+    const char *parse_y4m();
+
+    // Public JavaScript methods.
+    void init(const FunctionCallbackInfo<Value>& args);
+    void destroy();
+    void stats(const FunctionCallbackInfo<Value>& args);
+
+    // Lockable implementation.
+    virtual lockable *lock() final;
+
+    // Video source implementation.
+    virtual void link_video_source(video_source_context &ctx) final;
+    virtual void unlink_video_source(video_source_context &ctx) final;
+    virtual void produce_video_frame(video_source_context &ctx) final;
+
+    // Module init.
+    static void init_prototype(Handle<FunctionTemplate> func);
+};
+
+// Audio source that streams a WAV file in realtime. A thread wakes at a fixed
+// interval, converts the samples that became due into a preallocated buffer,
+// and renders them with timestamps derived from the start time.
+class file_audio_source : public audio_source {
+public:
+    file_audio_source();
+
+    mapped_file file;
+    bool looping;
+    const uint8_t *samples;
+    size_t num_frames;
+    uint16_t format;
+    uint16_t num_channels;
+    uint16_t bytes_per_sample;
+    uint32_t sample_rate;
+    float *convert_buffer;
+
+    threaded_loop thread;
+    bool running;
+    int64_t start_time;
+    uint64_t position;
+
+    std::list<audio_source_context *> ctxes;
+
+    // Internal.
+    const char *parse_wav();
+    void convert(float *out, size_t frame, size_t count);
+    void loop();
+
+    // Public JavaScript methods.
+    void init(const FunctionCallbackInfo<Value>& args);
+    void destroy();
+
+    // Lockable implementation.
+    virtual lockable *lock() final;
+
+    // Audio source implementation.
+    virtual void link_audio_source(audio_source_context &ctx) final;
+    virtual void unlink_audio_source(audio_source_context &ctx) final;
+
+    // Module init.
+    static void init_prototype(Handle<FunctionTemplate> func);
+};
+
+
+// ----- Test pattern sources -----
+
+// Video source that draws a generated pattern, with a frame counter and the
+// tick time burned in. Static patterns are drawn once, so those frames only
+// redraw the counter. Mixers sharing a clock share frames.
+class test_pattern_source : public video_source {
+public:
+    enum pattern_t {
+        pattern_bars,
+        pattern_zone_plate,
+        pattern_gradient,
+        pattern_noise
+    };
+
+    test_pattern_source();
+
+    lockable_mutex mutex;
+
+    pattern_t pattern;
+    dimensions_t dimensions;
+    std::vector<uint32_t> data;
+
+    // Pattern state. The gradient copies rows out of a periodic template, the
+    // zone plate looks up a cosine table, and noise is a xorshift generator
+    // masked to the configured number of bits per channel.
+    std::vector<uint32_t> table;
+    uint32_t noise_mask;
+    uint32_t noise_base;
+    uint32_t noise_state[4];
+
+    // Protected by the lock.
+    frame_time_t last_time;
+    uint64_t frame;
+
+    // Internal.
+    void draw_bars();
+    void draw_zone_plate();
+    void draw_gradient();
+    void draw_noise();
+    void draw_counter(frame_time_t time);
+
+    // Public JavaScript methods.
+    void init(const FunctionCallbackInfo<Value>& args);
+    void destroy();
+
+    // Lockable implementation.
+    virtual lockable *lock() final;
+
+    // Video source implementation.
+    virtual void produce_video_frame(video_source_context &ctx) final;
+
+    // Module init.
+    static void init_prototype(Handle<FunctionTemplate> func);
+};
+
+// Audio source that generates a sine, a logarithmic sweep, or pink noise, in
+// realtime on its own thread.
+class tone_source : public audio_source {
+public:
+    enum waveform_t {
+        waveform_sine,
+        waveform_sweep,
+        waveform_pink
+    };
+
+    tone_source();
+
+    waveform_t waveform;
+    double frequency;
+    float *out_buffer;
+
+    threaded_loop thread;
+    bool running;
+    int64_t start_time;
+    uint64_t position;
+
+    // Generator state.
+    double phase;
+    uint32_t noise_state;
+    float pink[7];
+
+    std::list<audio_source_context *> ctxes;
+
+    // Internal.
+    void generate(float *out, size_t count);
+    void loop();
+
+    // Public JavaScript methods.
+    void init(const FunctionCallbackInfo<Value>& args);
+    void destroy();
+
+    // Lockable implementation.
+    virtual lockable *lock() final;
+
+    // Audio source implementation.
+    virtual void link_audio_source(audio_source_context &ctx) final;
+    virtual void unlink_audio_source(audio_source_context &ctx) final;
+
+    // Module init.
+    static void init_prototype(Handle<FunctionTemplate> func);
 };
 
 
 // ----- Inline implementations -----
 
+inline latency_histogram::latency_histogram()
+{
+    reset();
+}
+
+inline video_frame::video_frame() :
+    time(), dimensions(), planes(), strides(), in_use(false)
+{
+}
+
+inline video_upload_queue::video_upload_queue() :
+    active(false), closed(false), staging_head(0), staging_tail(0), slots(), latency(),
+    pushed(0), overflows(0), uploaded(), dropped(), repeats()
+{
+}
+
+inline video_uploader::video_uploader() :
+    mixer(), started(), stopped(), running(), pending()
+{
+}
+
 inline video_clock_context_full::video_clock_context_full(video_mixer *mixer, video_clock *clock)
 {
     mixer_ = mixer;
     clock_ = clock;
 }
 
-inline video_source_context_full::video_source_context_full(video_mixer *mixer, video_source *source)
+inline video_source_context_full::video_source_context_full(video_mixer *mixer, video_source *source) :
+    latency(), tick_time(), plane_textures()
 {
     mixer_ = mixer;
     source_ = source;
@@ -285,12 +1335,98 @@ inline video_hook_context_full::video_hook_context_full(video_mixer *mixer, vide
     hook_ = hook;
 }
 
+inline video_tap_context::video_tap_context(video_mixer_base *mixer_, video_tap *tap_, uint32_t interval_) :
+    mixer(mixer_), tap(tap_), interval(interval_), counter(), running(), delivered(), dropped()
+{
+}
+
+inline tick_dispatcher::tick_dispatcher() :
+    running(), ticks(), late(), dropped()
+{
+}
+
 inline software_clock::software_clock() :
     running()
 {
 }
 
-inline audio_source_context_full::audio_source_context_full(audio_mixer *mixer, audio_source *source)
+inline offline_clock::offline_clock() :
+    running(), paused(), ticks(), stalls(), start_time(), end_time()
+{
+}
+
+// Offset in nanoseconds of the given tick number, where the rate is expressed
+// in seconds per tick. Exact, so no rounding error accumulates over time.
+inline int64_t tick_offset(uint64_t tick, fraction_t rate)
+{
+    uint64_t q = tick / rate.den;
+    uint64_t r = tick % rate.den;
+    return q * rate.num * 1000000000 + r * rate.num * 1000000000 / rate.den;
+}
+
+inline mapped_file::mapped_file() :
+    data(), size()
+{
+}
+
+inline mapped_file::~mapped_file()
+{
+    close();
+}
+
+inline file_video_source::file_video_source() :
+    y4m(), looping(), dimensions(), rate(), strides(), frames(), repeats(), skipped(), loops()
+{
+}
+
+inline file_audio_source::file_audio_source() :
+    looping(), samples(), num_frames(), format(), num_channels(), bytes_per_sample(),
+    sample_rate(), convert_buffer(), running(), start_time(), position()
+{
+}
+
+inline test_pattern_source::test_pattern_source() :
+    pattern(), dimensions(), noise_mask(), noise_base(), noise_state(), last_time(), frame()
+{
+}
+
+inline tone_source::tone_source() :
+    waveform(), frequency(), out_buffer(), running(), start_time(), position(),
+    phase(), noise_state(), pink()
+{
+}
+
+inline audio_encoder::audio_encoder() :
+    mixer(), id(), codec(), sample_rate(), num_channels(), enc(),
+    opus(), opus_frame_size(), opus_pcm_frames(), opus_pcm_pts(),
+    running(), head(), tail(), downmix(), frames(), dropped(), max_depth()
+{
+}
+
+inline audio_meter::audio_meter() :
+    peak(), sum(), frames()
+{
+}
+
+inline audio_loudness::audio_loudness() :
+    shelf(), highpass(), state(), block_frames(), block_pos(), block_sum(),
+    blocks(), next_block(), num_filled()
+{
+}
+
+inline audio_resampler::audio_resampler() :
+    in_rate(), out_rate(), pos(), step(), drift(), base_time(), out_start_time(), out_count(), out_time()
+{
+}
+
+inline audio_input_ring::audio_input_ring() :
+    blocks(), data(num_samples), head(0), tail(0), write_pos(), started(), end_time(),
+    overruns(0), blocks_read(), samples_read(), underruns()
+{
+}
+
+inline audio_source_context_full::audio_source_context_full(audio_mixer *mixer, audio_source *source) :
+    volume(), ring(std::make_shared<audio_input_ring>())
 {
     mixer_ = mixer;
     source_ = source;
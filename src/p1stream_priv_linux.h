@@ -10,23 +10,282 @@
 namespace p1stream {
 
 
+// Process-wide EGL display and OpenCL context, shared by all mixers. The root
+// GL context is never made current; mixers create their own contexts in its
+// share group, so textures can be handed to the shared CL context. Access is
+// through acquire and release, which maintain a reference count.
+class egl_device {
+public:
+    egl_device();
+
+    EGLDisplay display;
+    EGLConfig config;
+    EGLContext root_context;
+    cl_context cl;
+    int refcount;
+
+    // Returns the shared device, creating it if necessary. Errors are logged
+    // to the buffer, and result in a null return value.
+    static egl_device *acquire(event_buffer &buffer);
+    void release();
+
+    // Internal.
+    bool init(event_buffer &buffer);
+    void destroy();
+};
+
 class video_mixer_linux : public video_mixer_base {
 public:
     video_mixer_linux();
 
-    EGLDisplay egl_display;
+    egl_device *device;
     EGLContext egl_context;
+    EGLContext upload_context;
 
     virtual bool platform_init(Handle<Object> params) final;
     virtual void platform_destroy() final;
     virtual bool activate_gl() final;
+    virtual void deactivate_gl() final;
+    virtual bool upload_gl_init() final;
+    virtual void upload_gl_destroy() final;
+};
+
+
+// ----- High-precision video clock -----
+
+// Clock driven by a timerfd armed with absolute CLOCK_MONOTONIC deadlines.
+// Every tick time is calculated exactly from the rational rate, so there is no
+// drift. Optionally runs with realtime priority and pinned to a CPU.
+class precise_clock : public video_clock {
+public:
+    precise_clock();
+
+    fraction_t rate;
+    int rt_priority;
+    int cpu;
+
+    threaded_loop thread;
+    bool running;
+    int timer_fd;
+    int stop_fd;
+
+    tick_dispatcher dispatcher;
+
+    // Statistics, protected by the lock.
+    uint64_t ticks;
+    uint64_t missed;
+    latency_histogram jitter;
+
+    // Internal.
+    void loop();
+    void setup_thread();
+
+    // Public JavaScript methods.
+    void init(const FunctionCallbackInfo<Value>& args);
+    void destroy();
+    void stats(const FunctionCallbackInfo<Value>& args);
+
+    // Lockable implementation.
+    virtual lockable *lock() final;
+
+    // Video clock implementation.
+    virtual void link_video_clock(video_clock_context &ctx) final;
+    virtual void unlink_video_clock(video_clock_context &ctx) final;
+    virtual fraction_t video_ticks_per_second(video_clock_context &ctx) final;
+
+    // Module init.
+    static void init_prototype(Handle<FunctionTemplate> func);
+};
+
+
+// ----- Shared-memory frame rings -----
+
+// Layout of a memfd shared with other processes. The header is followed by
+// num_slots slots at slot_size strides, each starting with a slot header. All
+// offsets are in bytes, and all structures are 64 bytes.
+//
+// A writer fills the slot after the latest one. The slot seq is odd while it
+// is being written, and even once it is complete. The writer then increments
+// the header seq, and wakes futex waiters on it. Readers take slot
+// (seq - 1) % num_slots, use the data in place, and afterwards check that the
+// slot seq is still the even value they started with. Otherwise the writer
+// lapped them, and they should skip the frame. Writers never wait on readers.
+//
+// Times are CLOCK_MONOTONIC in nanoseconds, like system_time().
+#define SHM_RING_MAGIC   0x52533150  // 'P1SR' in memory
+#define SHM_RING_VERSION 1
+
+enum shm_ring_format {
+    shm_format_i420 = 1,
+    shm_format_bgra = 2
+};
+
+struct shm_ring_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_slots;
+    uint32_t slot_size;
+    std::atomic<uint32_t> seq;
+    uint32_t reserved[11];
+};
+
+struct shm_ring_slot {
+    std::atomic<uint32_t> seq;
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+    int64_t time;
+    // Plane offsets from the start of the slot, and strides. BGRA frames use
+    // only the first plane.
+    uint32_t offsets[3];
+    uint32_t strides[3];
+    uint32_t reserved[4];
+};
+
+static_assert(sizeof(shm_ring_header) == 64, "shm_ring_header must be 64 bytes");
+static_assert(sizeof(shm_ring_slot) == 64, "shm_ring_slot must be 64 bytes");
+
+// Message sent along with the memfd to clients of an export socket.
+struct shm_ring_hello {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t size;
+};
+
+// Tap that publishes converted frames to a shared-memory ring, and hands the
+// memfd to anyone connecting to a UNIX socket. The ring is created on the
+// first link, sized for the mixer output. Frames are copied on the tap
+// thread, so the mixer is never held up.
+class shm_exporter : public video_tap {
+public:
+    shm_exporter();
+
+    Isolate *isolate;
+    event_buffer buffer;
+    lockable_mutex mutex;
+
+    std::string path;
+    uint32_t num_slots;
+
+    int listen_fd;
+    int stop_fd;
+    uv_thread_t thread;
+    bool running;
+
+    // The ring, set up on first link, protected by the lock. Writes to it
+    // are serialized by the write mutex.
+    int mem_fd;
+    size_t map_size;
+    shm_ring_header *header;
+    dimensions_t dimensions;
+    lockable_mutex write_mutex;
+
+    // Statistics, protected by the lock.
+    uint64_t published;
+    uint64_t skipped;
+    uint64_t clients;
+
+    // Internal.
+    bool create_ring(dimensions_t dimensions);
+    void destroy_ring();
+    void publish(const video_frame &frame);
+    static void thread_cb(void *arg);
+    void loop();
+    void send_fd(int client_fd);
+
+    // Public JavaScript methods.
+    void init(const FunctionCallbackInfo<Value>& args);
+    void destroy();
+    void stats(const FunctionCallbackInfo<Value>& args);
+
+    // Lockable implementation.
+    virtual lockable *lock() final;
+
+    // Video tap implementation.
+    virtual void link_video_tap(video_tap_context &ctx) final;
+    virtual void video_tap_frame(video_tap_context &ctx, std::shared_ptr<const video_frame> frame) final;
+
+    // Module init.
+    static void init_prototype(Handle<FunctionTemplate> func);
+};
+
+// Video source that reads frames from a shared-memory ring written by another
+// process. The memfd is obtained by connecting to a UNIX socket, using the
+// same handshake as shm_exporter. A background thread connects, and
+// reconnects when the producer goes quiet. Every tick renders the newest
+// complete frame, straight from the mapping.
+class shm_source : public video_source {
+public:
+    shm_source();
+
+    Isolate *isolate;
+    event_buffer buffer;
+    lockable_mutex mutex;
+
+    std::string path;
+
+    int stop_fd;
+    uv_thread_t thread;
+    bool running;
+
+    // The attached ring, protected by the lock. The layout is copied from the
+    // header when attaching, because the producer could change it later.
+    size_t map_size;
+    const shm_ring_header *header;
+    uint32_t num_slots;
+    uint32_t slot_size;
+    uint32_t last_seq;
+    int64_t last_seq_time;
+    uint32_t rendered_seq;
+
+    // Statistics, protected by the lock. Skipped frames were published, but
+    // replaced before any tick saw them. Lag is from the frame timestamp to
+    // the time it is rendered.
+    uint64_t attaches;
+    uint64_t frames;
+    uint64_t repeats;
+    uint64_t skipped;
+    uint64_t torn;
+    uint64_t invalid;
+    latency_histogram lag;
+
+    // Internal.
+    static void thread_cb(void *arg);
+    void loop();
+    bool connect_ring();
+    void detach();
+    const shm_ring_slot *slot_for(uint32_t seq);
+
+    // Public JavaScript methods.
+    void init(const FunctionCallbackInfo<Value>& args);
+    void destroy();
+    void stats(const FunctionCallbackInfo<Value>& args);
+
+    // Lockable implementation.
+    virtual lockable *lock() final;
+
+    // Video source implementation.
+    virtual void produce_video_frame(video_source_context &ctx) final;
+
+    // Module init.
+    static void init_prototype(Handle<FunctionTemplate> func);
 };
 
 
 // ----- Inline implementations -----
 
+inline egl_device::egl_device() :
+    display(EGL_NO_DISPLAY), config(), root_context(EGL_NO_CONTEXT), cl(), refcount()
+{
+}
+
 inline video_mixer_linux::video_mixer_linux() :
-    egl_display(), egl_context()
+    device(), egl_context(EGL_NO_CONTEXT), upload_context(EGL_NO_CONTEXT)
+{
+}
+
+inline precise_clock::precise_clock() :
+    rt_priority(), cpu(-1), running(), timer_fd(-1), stop_fd(-1), ticks(), missed()
 {
 }
 
@@ -10,15 +10,21 @@ class video_mixer_mac : public video_mixer_base {
 public:
     video_mixer_mac();
 
+    CGLContextObj upload_context;
+
     virtual bool platform_init(Handle<Object> params) final;
     virtual void platform_destroy() final;
     virtual bool activate_gl() final;
+    virtual void deactivate_gl() final;
+    virtual bool upload_gl_init() final;
+    virtual void upload_gl_destroy() final;
 };
 
 
 // ----- Inline implementations -----
 
-inline video_mixer_mac::video_mixer_mac()
+inline video_mixer_mac::video_mixer_mac() :
+    upload_context()
 {
     cgl_context_ = NULL;
     surface_ = NULL;
@@ -0,0 +1,254 @@
+#include "p1stream_priv_linux.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+namespace p1stream {
+
+
+void precise_clock::init(const FunctionCallbackInfo<Value>& args)
+{
+    auto *isolate = args.GetIsolate();
+
+    if (args.Length() != 1 || !args[0]->IsObject()) {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "Expected an object")));
+        return;
+    }
+    auto params = args[0].As<Object>();
+
+    auto numVal = params->Get(numerator_sym.Get(isolate));
+    auto denVal = params->Get(denominator_sym.Get(isolate));
+    if (!numVal->IsUint32()) {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "Invalid numerator")));
+        return;
+    }
+    if (!denVal->IsUint32()) {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "Invalid denominator")));
+        return;
+    }
+
+    rate.num = numVal->Uint32Value();
+    rate.den = denVal->Uint32Value();
+    if (rate.num == 0 || rate.den == 0) {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "Invalid fraction")));
+        return;
+    }
+
+    auto val = params->Get(realtime_priority_sym.Get(isolate));
+    if (!val->IsUndefined()) {
+        int min = sched_get_priority_min(SCHED_FIFO);
+        int max = sched_get_priority_max(SCHED_FIFO);
+        if (!val->IsInt32() || val->Int32Value() < min || val->Int32Value() > max) {
+            isolate->ThrowException(Exception::TypeError(
+                String::NewFromUtf8(isolate, "Invalid realtimePriority")));
+            return;
+        }
+        rt_priority = val->Int32Value();
+    }
+
+    val = params->Get(cpu_sym.Get(isolate));
+    if (!val->IsUndefined()) {
+        if (!val->IsUint32() || val->Uint32Value() >= CPU_SETSIZE) {
+            isolate->ThrowException(Exception::TypeError(
+                String::NewFromUtf8(isolate, "Invalid cpu")));
+            return;
+        }
+        cpu = val->Uint32Value();
+    }
+
+    int num_threads = tick_dispatcher::threads_param(isolate, params);
+    if (num_threads == 0)
+        return;
+
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (timer_fd == -1) {
+        isolate->ThrowException(Exception::Error(
+            String::NewFromUtf8(isolate, "timerfd_create failed")));
+        return;
+    }
+
+    stop_fd = eventfd(0, EFD_CLOEXEC);
+    if (stop_fd == -1) {
+        close(timer_fd);
+        timer_fd = -1;
+        isolate->ThrowException(Exception::Error(
+            String::NewFromUtf8(isolate, "eventfd failed")));
+        return;
+    }
+
+    // Parameters checked, from here on we no longer throw exceptions.
+    Wrap(args.This());
+    Ref();
+    args.GetReturnValue().Set(handle());
+
+    dispatcher.init(num_threads);
+
+    running = true;
+    thread.init(std::bind(&precise_clock::loop, this));
+}
+
+void precise_clock::destroy()
+{
+    if (running) {
+        running = false;
+
+        uint64_t one = 1;
+        if (write(stop_fd, &one, sizeof(one)) != sizeof(one))
+            fprintf(stderr, "eventfd write error %d\n", errno);
+
+        thread.destroy();
+        dispatcher.destroy();
+    }
+
+    if (timer_fd != -1) {
+        close(timer_fd);
+        timer_fd = -1;
+    }
+
+    if (stop_fd != -1) {
+        close(stop_fd);
+        stop_fd = -1;
+    }
+
+    Unref();
+}
+
+void precise_clock::stats(const FunctionCallbackInfo<Value>& args)
+{
+    auto *isolate = args.GetIsolate();
+    lock_handle lock(thread);
+
+    auto obj = Object::New(isolate);
+    obj->Set(String::NewFromUtf8(isolate, "ticks"), Number::New(isolate, ticks));
+    obj->Set(String::NewFromUtf8(isolate, "missed"), Number::New(isolate, missed));
+    obj->Set(String::NewFromUtf8(isolate, "jitter"), jitter.to_js(isolate));
+    obj->Set(String::NewFromUtf8(isolate, "jitterBuckets"), jitter.buckets_to_js(isolate));
+    obj->Set(String::NewFromUtf8(isolate, "dispatch"), dispatcher.stats_to_js(isolate));
+    args.GetReturnValue().Set(obj);
+}
+
+lockable *precise_clock::lock()
+{
+    return thread.lock();
+}
+
+void precise_clock::link_video_clock(video_clock_context &ctx)
+{
+    dispatcher.link(ctx);
+}
+
+void precise_clock::unlink_video_clock(video_clock_context &ctx)
+{
+    dispatcher.unlink(ctx);
+}
+
+fraction_t precise_clock::video_ticks_per_second(video_clock_context &ctx)
+{
+    return rate;
+}
+
+// Apply scheduling parameters to the clock thread. Failure here is not fatal,
+// because realtime priority usually requires extra privileges.
+void precise_clock::setup_thread()
+{
+    int ret;
+
+    if (rt_priority != 0) {
+        struct sched_param param;
+        param.sched_priority = rt_priority;
+        ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (ret != 0)
+            fprintf(stderr, "pthread_setschedparam error %d\n", ret);
+    }
+
+    if (cpu != -1) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (ret != 0)
+            fprintf(stderr, "pthread_setaffinity_np error %d\n", ret);
+    }
+}
+
+void precise_clock::loop()
+{
+    setup_thread();
+
+    int64_t start_time = system_time();
+    uint64_t tick = 1;
+    int64_t time_next = start_time + tick_offset(tick, rate);
+
+    while (running) {
+        struct itimerspec spec = {};
+        spec.it_value.tv_sec = time_next / 1000000000;
+        spec.it_value.tv_nsec = time_next % 1000000000;
+        if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, NULL) != 0) {
+            fprintf(stderr, "timerfd_settime error %d\n", errno);
+            break;
+        }
+
+        // Wait for the timer or a stop request, without holding the lock.
+        struct pollfd fds[2];
+        fds[0].fd = timer_fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = stop_fd;
+        fds[1].events = POLLIN;
+
+        thread.unlock();
+        int ret = poll(fds, 2, -1);
+        int poll_errno = errno;
+        thread.lock();
+
+        if (!running || (ret > 0 && fds[1].revents))
+            break;
+        if (ret < 0) {
+            if (poll_errno == EINTR)
+                continue;
+            fprintf(stderr, "poll error %d\n", poll_errno);
+            break;
+        }
+
+        uint64_t expirations;
+        if (read(timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+            continue;
+
+        jitter.record(system_time() - time_next);
+        ticks++;
+
+        dispatcher.dispatch(time_next);
+
+        // If we woke up later than an interval, skip the ticks we're already
+        // late for, rather than bursting to catch up.
+        int64_t time_now = system_time();
+        time_next = start_time + tick_offset(++tick, rate);
+        while (time_next <= time_now) {
+            time_next = start_time + tick_offset(++tick, rate);
+            missed++;
+        }
+    }
+}
+
+void precise_clock::init_prototype(Handle<FunctionTemplate> func)
+{
+    NODE_SET_PROTOTYPE_METHOD(func, "destroy", [](const FunctionCallbackInfo<Value>& args) {
+        auto clock = ObjectWrap::Unwrap<precise_clock>(args.This());
+        clock->destroy();
+    });
+    NODE_SET_PROTOTYPE_METHOD(func, "stats", [](const FunctionCallbackInfo<Value>& args) {
+        auto clock = ObjectWrap::Unwrap<precise_clock>(args.This());
+        clock->stats(args);
+    });
+}
+
+
+}  // namespace p1stream
@@ -0,0 +1,423 @@
+#include "p1stream_priv.h"
+
+#include <algorithm>
+#include <setjmp.h>
+
+#if __SSE2__
+#   include <emmintrin.h>
+#endif
+
+extern "C" {
+#include <jpeglib.h>
+}
+
+namespace p1stream {
+
+static Local<Value> preview_events_transform(Isolate *isolate, event &ev, buffer_slicer &slicer);
+
+// Smallest dimensions we'll downscale to.
+static const uint32_t min_dimension = 16;
+
+// Event data of an encoded still.
+struct preview_frame_data {
+    frame_time_t time;
+    dimensions_t dimensions;
+    size_t size;
+    char data[0];
+};
+
+// A single image plane. Strides are padded for the JPEG encoder, see below.
+struct preview_plane {
+    uint8_t *data;
+    int stride;
+    uint32_t width;
+    uint32_t height;
+};
+
+// libjpeg error handler that returns control to us, instead of exiting.
+struct preview_jpeg_error {
+    jpeg_error_mgr mgr;
+    jmp_buf jmp;
+    char message[JMSG_LENGTH_MAX];
+};
+
+
+static void jpeg_error_exit(j_common_ptr cinfo)
+{
+    auto *err = (preview_jpeg_error *) cinfo->err;
+    (*cinfo->err->format_message)(cinfo, err->message);
+    longjmp(err->jmp, 1);
+}
+
+static uint32_t align_to(uint32_t value, uint32_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+// Halve a plane in both directions with a 2x2 box filter. Odd source
+// dimensions round up, repeating the last row or column.
+static void halve_plane(const uint8_t *src, int src_stride, uint32_t src_width, uint32_t src_height,
+                        preview_plane &dst)
+{
+    for (uint32_t y = 0; y < dst.height; y++) {
+        const uint8_t *r0 = src + 2 * y * src_stride;
+        const uint8_t *r1 = 2 * y + 1 < src_height ? r0 + src_stride : r0;
+        uint8_t *out = dst.data + y * dst.stride;
+        uint32_t x = 0;
+
+#if __SSE2__
+        // Average rows first, then separate even and odd columns in 16-bit
+        // lanes, and average those. This rounds up twice, which is fine for
+        // a preview.
+        const __m128i mask = _mm_set1_epi16(0x00FF);
+        for (; x + 16 <= src_width / 2; x += 16) {
+            __m128i a0 = _mm_loadu_si128((const __m128i *) (r0 + 2 * x));
+            __m128i a1 = _mm_loadu_si128((const __m128i *) (r0 + 2 * x + 16));
+            __m128i b0 = _mm_loadu_si128((const __m128i *) (r1 + 2 * x));
+            __m128i b1 = _mm_loadu_si128((const __m128i *) (r1 + 2 * x + 16));
+            __m128i v0 = _mm_avg_epu8(a0, b0);
+            __m128i v1 = _mm_avg_epu8(a1, b1);
+            __m128i h0 = _mm_avg_epu16(_mm_and_si128(v0, mask), _mm_srli_epi16(v0, 8));
+            __m128i h1 = _mm_avg_epu16(_mm_and_si128(v1, mask), _mm_srli_epi16(v1, 8));
+            _mm_storeu_si128((__m128i *) (out + x), _mm_packus_epi16(h0, h1));
+        }
+#endif
+
+        for (; x < dst.width; x++) {
+            uint32_t x1 = std::min(2 * x + 1, src_width - 1);
+            out[x] = (r0[2 * x] + r0[x1] + r1[2 * x] + r1[x1] + 2) >> 2;
+        }
+    }
+}
+
+static void copy_plane(const uint8_t *src, int src_stride, preview_plane &dst)
+{
+    for (uint32_t y = 0; y < dst.height; y++)
+        memcpy(dst.data + y * dst.stride, src + y * src_stride, dst.width);
+}
+
+// The encoder reads whole 8x8 blocks, so repeat the last column into the
+// padding. Rows are repeated by pointing at the last row instead.
+static void pad_plane(preview_plane &plane)
+{
+    for (uint32_t y = 0; y < plane.height; y++) {
+        uint8_t *row = plane.data + y * plane.stride;
+        memset(row + plane.width, row[plane.width - 1], plane.stride - plane.width);
+    }
+}
+
+// Lay out I420 planes of the given dimensions in a buffer. Chroma of odd
+// dimensions rounds up, as the JPEG encoder expects.
+static void layout_planes(std::vector<uint8_t> &buf, uint32_t width, uint32_t height, preview_plane *planes)
+{
+    uint32_t c_width = (width + 1) / 2;
+    uint32_t c_height = (height + 1) / 2;
+    int y_stride = align_to(width, 16);
+    int c_stride = align_to(c_width, 8);
+    buf.resize(y_stride * height + 2 * c_stride * c_height);
+
+    planes[0] = { buf.data(), y_stride, width, height };
+    planes[1] = { planes[0].data + y_stride * height, c_stride, c_width, c_height };
+    planes[2] = { planes[1].data + c_stride * c_height, c_stride, c_width, c_height };
+}
+
+// Encode padded I420 planes as a JPEG, using raw data input, so there is no
+// color conversion or further resampling.
+static bool compress_i420(preview_jpeg_error &err, preview_plane *planes, int quality,
+                          unsigned char **out, unsigned long *out_size)
+{
+    jpeg_compress_struct cinfo;
+    cinfo.err = jpeg_std_error(&err.mgr);
+    err.mgr.error_exit = jpeg_error_exit;
+    if (setjmp(err.jmp)) {
+        jpeg_destroy_compress(&cinfo);
+        return false;
+    }
+
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, out, out_size);
+
+    cinfo.image_width = planes[0].width;
+    cinfo.image_height = planes[0].height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_YCbCr;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, quality, TRUE);
+    cinfo.raw_data_in = TRUE;
+    cinfo.dct_method = JDCT_IFAST;
+    cinfo.comp_info[0].h_samp_factor = 2;
+    cinfo.comp_info[0].v_samp_factor = 2;
+    cinfo.comp_info[1].h_samp_factor = 1;
+    cinfo.comp_info[1].v_samp_factor = 1;
+    cinfo.comp_info[2].h_samp_factor = 1;
+    cinfo.comp_info[2].v_samp_factor = 1;
+
+    jpeg_start_compress(&cinfo, TRUE);
+
+    JSAMPROW y_rows[16], u_rows[8], v_rows[8];
+    JSAMPARRAY rows[3] = { y_rows, u_rows, v_rows };
+    uint32_t height = planes[0].height;
+    for (uint32_t row = 0; row < height; row += 16) {
+        for (uint32_t i = 0; i < 16; i++) {
+            uint32_t y = std::min(row + i, height - 1);
+            y_rows[i] = planes[0].data + y * planes[0].stride;
+        }
+        for (uint32_t i = 0; i < 8; i++) {
+            uint32_t y = std::min(row / 2 + i, planes[1].height - 1);
+            u_rows[i] = planes[1].data + y * planes[1].stride;
+            v_rows[i] = planes[2].data + y * planes[2].stride;
+        }
+        jpeg_write_raw_data(&cinfo, rows, 16);
+    }
+
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    return true;
+}
+
+
+preview_generator::preview_generator() :
+    buffer(this, preview_events_transform, 1048576),  // 1 MiB event buffer
+    max_dimensions(), rate(), quality(), jpeg_buf(), jpeg_capacity(),
+    frames(), bytes(), errors()
+{
+}
+
+void preview_generator::init(const FunctionCallbackInfo<Value>& args)
+{
+    Handle<Value> val;
+
+    isolate = args.GetIsolate();
+
+    if (args.Length() != 1 || !args[0]->IsObject()) {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "Expected an object")));
+        return;
+    }
+    auto params = args[0].As<Object>();
+
+    val = params->Get(width_sym.Get(isolate));
+    if (!val->IsUint32() || val->Uint32Value() < min_dimension) {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "Invalid width")));
+        return;
+    }
+    max_dimensions.width = val->Uint32Value();
+
+    val = params->Get(height_sym.Get(isolate));
+    if (!val->IsUint32() || val->Uint32Value() < min_dimension) {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "Invalid height")));
+        return;
+    }
+    max_dimensions.height = val->Uint32Value();
+
+    // Seconds per preview frame, like clocks. Defaults to 2 per second.
+    rate.num = 1;
+    rate.den = 2;
+    auto num_val = params->Get(numerator_sym.Get(isolate));
+    auto den_val = params->Get(denominator_sym.Get(isolate));
+    if (!num_val->IsUndefined() || !den_val->IsUndefined()) {
+        if (!num_val->IsUint32() || !den_val->IsUint32() ||
+            num_val->Uint32Value() == 0 || den_val->Uint32Value() == 0) {
+            isolate->ThrowException(Exception::TypeError(
+                String::NewFromUtf8(isolate, "Invalid fraction")));
+            return;
+        }
+        rate.num = num_val->Uint32Value();
+        rate.den = den_val->Uint32Value();
+    }
+
+    quality = 75;
+    val = params->Get(quality_sym.Get(isolate));
+    if (!val->IsUndefined()) {
+        if (!val->IsUint32() || val->Uint32Value() == 0 || val->Uint32Value() > 100) {
+            isolate->ThrowException(Exception::TypeError(
+                String::NewFromUtf8(isolate, "Invalid quality")));
+            return;
+        }
+        quality = val->Uint32Value();
+    }
+
+    val = params->Get(on_event_sym.Get(isolate));
+    if (!val->IsFunction()) {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "Expected an onEvent function")));
+        return;
+    }
+
+    // Parameters checked, from here on we no longer throw exceptions.
+    Wrap(args.This());
+    Ref();
+    args.GetReturnValue().Set(handle(isolate));
+
+    buffer.set_callback(isolate->GetCurrentContext(), val.As<Function>());
+}
+
+// Callers should remove the generator from mixers first.
+void preview_generator::destroy()
+{
+    {
+        lock_handle lock(work_mutex);
+        free(jpeg_buf);
+        jpeg_buf = NULL;
+        jpeg_capacity = 0;
+    }
+
+    Unref();
+}
+
+lockable *preview_generator::lock()
+{
+    return mutex.lock();
+}
+
+// Pick the interval that gets closest to our rate at the mixer frame rate.
+void preview_generator::link_video_tap(video_tap_context &ctx)
+{
+    auto &params = ctx.mixer->enc_params;
+    uint64_t num = (uint64_t) params.i_fps_num * rate.num;
+    uint64_t den = (uint64_t) params.i_fps_den * rate.den;
+    uint64_t interval = den ? (num + den / 2) / den : 1;
+    ctx.interval = interval < 1 ? 1 : (uint32_t) interval;
+}
+
+void preview_generator::video_tap_frame(video_tap_context &ctx, std::shared_ptr<const video_frame> frame)
+{
+    lock_handle lock(work_mutex);
+    encode(*frame);
+}
+
+bool preview_generator::encode(const video_frame &frame)
+{
+    int64_t start = system_time();
+
+    // Halve until we fit, never going below the minimum. Luma can only be
+    // halved while even, but chroma rounds up, so odd chroma is fine.
+    uint32_t width = frame.dimensions.width & ~1;
+    uint32_t height = frame.dimensions.height & ~1;
+    int steps = 0;
+    while ((width > max_dimensions.width || height > max_dimensions.height) &&
+           width % 2 == 0 && height % 2 == 0 &&
+           width / 2 >= min_dimension && height / 2 >= min_dimension) {
+        width /= 2;
+        height /= 2;
+        steps++;
+    }
+
+    const uint8_t *src[3] = { frame.planes[0], frame.planes[1], frame.planes[2] };
+    int src_strides[3] = { frame.strides[0], frame.strides[1], frame.strides[2] };
+    uint32_t step_width = frame.dimensions.width & ~1;
+    uint32_t step_height = frame.dimensions.height & ~1;
+    uint32_t src_widths[3] = { step_width, step_width / 2, step_width / 2 };
+    uint32_t src_heights[3] = { step_height, step_height / 2, step_height / 2 };
+    preview_plane planes[3];
+
+    if (steps == 0) {
+        layout_planes(scale_buffers[0], width, height, planes);
+        for (int i = 0; i < 3; i++)
+            copy_plane(src[i], src_strides[i], planes[i]);
+    }
+
+    // Intermediate steps alternate between the two scratch buffers.
+    for (int step = 0; step < steps; step++) {
+        step_width /= 2;
+        step_height /= 2;
+        layout_planes(scale_buffers[step % 2], step_width, step_height, planes);
+        for (int i = 0; i < 3; i++) {
+            halve_plane(src[i], src_strides[i], src_widths[i], src_heights[i], planes[i]);
+            src[i] = planes[i].data;
+            src_strides[i] = planes[i].stride;
+            src_widths[i] = planes[i].width;
+            src_heights[i] = planes[i].height;
+        }
+    }
+
+    for (int i = 0; i < 3; i++)
+        pad_plane(planes[i]);
+
+    // Start with a buffer large enough for any sensible quality, so libjpeg
+    // rarely has to grow it. If it does, it allocates a new one we now own.
+    unsigned long min_capacity = planes[0].stride * height;
+    if (jpeg_capacity < min_capacity) {
+        free(jpeg_buf);
+        jpeg_buf = (unsigned char *) malloc(min_capacity);
+        jpeg_capacity = jpeg_buf ? min_capacity : 0;
+    }
+
+    unsigned char *out = jpeg_buf;
+    unsigned long out_size = jpeg_capacity;
+    preview_jpeg_error err;
+    bool ok = compress_i420(err, planes, quality, &out, &out_size);
+    if (ok && out != jpeg_buf) {
+        free(jpeg_buf);
+        jpeg_buf = out;
+        jpeg_capacity = out_size;
+    }
+
+    lock_handle lock(*this);
+
+    if (!ok) {
+        errors++;
+        buffer.emitf(EV_LOG_ERROR, "JPEG encoding error: %s", err.message);
+        return false;
+    }
+
+    encode_latency.record(system_time() - start);
+
+    auto *ev = buffer.emit(EV_PREVIEW_FRAME, sizeof(preview_frame_data) + out_size);
+    if (ev == NULL)
+        return false;
+
+    auto &data = *(preview_frame_data *) ev->data;
+    data.time = frame.time;
+    data.dimensions.width = width;
+    data.dimensions.height = height;
+    data.size = out_size;
+    memcpy(data.data, out, out_size);
+
+    frames++;
+    bytes += out_size;
+    return true;
+}
+
+void preview_generator::stats(const FunctionCallbackInfo<Value>& args)
+{
+    lock_handle lock(*this);
+
+    auto obj = Object::New(isolate);
+    obj->Set(String::NewFromUtf8(isolate, "frames"), Number::New(isolate, frames));
+    obj->Set(String::NewFromUtf8(isolate, "bytes"), Number::New(isolate, bytes));
+    obj->Set(String::NewFromUtf8(isolate, "errors"), Number::New(isolate, errors));
+    obj->Set(String::NewFromUtf8(isolate, "encode"), encode_latency.to_js(isolate));
+    args.GetReturnValue().Set(obj);
+}
+
+static Local<Value> preview_events_transform(Isolate *isolate, event &ev, buffer_slicer &slicer)
+{
+    if (ev.id != EV_PREVIEW_FRAME)
+        return Undefined(isolate);
+
+    auto &data = *(preview_frame_data *) ev.data;
+    auto obj = Object::New(isolate);
+    obj->Set(pts_sym.Get(isolate), Number::New(isolate, data.time));
+    obj->Set(width_sym.Get(isolate), Integer::NewFromUnsigned(isolate, data.dimensions.width));
+    obj->Set(height_sym.Get(isolate), Integer::NewFromUnsigned(isolate, data.dimensions.height));
+    obj->Set(buf_sym.Get(isolate), slicer.slice(data.data, data.size));
+    return obj;
+}
+
+void preview_generator::init_prototype(Handle<FunctionTemplate> func)
+{
+    NODE_SET_PROTOTYPE_METHOD(func, "destroy", [](const FunctionCallbackInfo<Value>& args) {
+        auto preview = ObjectWrap::Unwrap<preview_generator>(args.This());
+        preview->destroy();
+    });
+    NODE_SET_PROTOTYPE_METHOD(func, "stats", [](const FunctionCallbackInfo<Value>& args) {
+        auto preview = ObjectWrap::Unwrap<preview_generator>(args.This());
+        preview->stats(args);
+    });
+}
+
+
+}  // namespace p1stream
@@ -0,0 +1,107 @@
+#include "p1stream_priv.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace p1stream {
+
+// Identifies cache files, and is bumped when the layout changes.
+static const uint32_t cache_magic = 'P1C1';
+
+
+// 64-bit FNV-1a, as a hex string.
+std::string program_cache::hash(const std::string &str)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : str) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", (unsigned long long) hash);
+    return hex;
+}
+
+std::string program_cache::path_for(const std::string &key)
+{
+    return dir + "/" + hash(key) + ".bin";
+}
+
+// Files start with the magic, the key length and the full key, so that hash
+// collisions and stale entries read as a miss.
+bool program_cache::load(const std::string &key, std::vector<char> &data)
+{
+    if (dir.empty())
+        return false;
+
+    int fd = open(path_for(key).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return false;
+
+    bool ok;
+    struct stat st;
+    uint32_t header[2];
+    size_t size = 0;
+
+    ok = (fstat(fd, &st) == 0);
+    if (ok) {
+        size = st.st_size;
+        ok = (size > sizeof(header) + key.size());
+    }
+
+    if (ok) {
+        data.resize(size);
+        ok = (read(fd, data.data(), size) == (ssize_t) size);
+    }
+
+    close(fd);
+
+    if (ok) {
+        memcpy(header, data.data(), sizeof(header));
+        ok = (header[0] == cache_magic && header[1] == key.size() &&
+              memcmp(data.data() + sizeof(header), key.data(), key.size()) == 0);
+    }
+
+    if (ok)
+        data.erase(data.begin(), data.begin() + sizeof(header) + key.size());
+    else
+        data.clear();
+
+    return ok;
+}
+
+// Writes go to a temporary file that is renamed into place, so concurrent
+// processes never see a partial entry. Failure is silently ignored.
+void program_cache::store(const std::string &key, const void *data, size_t size)
+{
+    if (dir.empty())
+        return;
+
+    mkdir(dir.c_str(), 0755);
+
+    std::string path = path_for(key);
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%d.tmp", (int) getpid());
+    std::string tmp_path = path + suffix;
+
+    int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1)
+        return;
+
+    uint32_t header[2] = { cache_magic, (uint32_t) key.size() };
+    bool ok = (
+        write(fd, header, sizeof(header)) == sizeof(header) &&
+        write(fd, key.data(), key.size()) == (ssize_t) key.size() &&
+        write(fd, data, size) == (ssize_t) size
+    );
+    ok = (close(fd) == 0) && ok;
+
+    if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0)
+        unlink(tmp_path.c_str());
+}
+
+
+}  // namespace p1stream
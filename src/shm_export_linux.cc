@@ -0,0 +1,419 @@
+#include "p1stream_priv_linux.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <linux/memfd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+
+namespace p1stream {
+
+static Local<Value> shm_export_events_transform(Isolate *isolate, event &ev, buffer_slicer &slicer);
+
+// Default number of slots in the ring.
+static const uint32_t default_num_slots = 4;
+
+
+static size_t align_64(size_t value)
+{
+    return (value + 63) & ~(size_t) 63;
+}
+
+shm_exporter::shm_exporter() :
+    buffer(this, shm_export_events_transform, 65536),  // 64 KiB event buffer
+    num_slots(), listen_fd(-1), stop_fd(-1), running(),
+    mem_fd(-1), map_size(), header(), dimensions(),
+    published(), skipped(), clients()
+{
+}
+
+void shm_exporter::init(const FunctionCallbackInfo<Value>& args)
+{
+    Handle<Value> val;
+
+    isolate = args.GetIsolate();
+
+    if (args.Length() != 1 || !args[0]->IsObject()) {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "Expected an object")));
+        return;
+    }
+    auto params = args[0].As<Object>();
+
+    struct sockaddr_un addr = {};
+    val = params->Get(path_sym.Get(isolate));
+    if (val->IsString()) {
+        String::Utf8Value v(val);
+        path = *v;
+    }
+    if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "Invalid path")));
+        return;
+    }
+
+    num_slots = default_num_slots;
+    val = params->Get(slots_sym.Get(isolate));
+    if (!val->IsUndefined()) {
+        if (!val->IsUint32() || val->Uint32Value() < 2 || val->Uint32Value() > 64) {
+            isolate->ThrowException(Exception::TypeError(
+                String::NewFromUtf8(isolate, "Invalid slots")));
+            return;
+        }
+        num_slots = val->Uint32Value();
+    }
+
+    val = params->Get(on_event_sym.Get(isolate));
+    if (!val->IsFunction()) {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "Expected an onEvent function")));
+        return;
+    }
+
+    // Replace a stale socket from an earlier run, but nothing else.
+    struct stat st;
+    if (lstat(path.c_str(), &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            isolate->ThrowException(Exception::Error(
+                String::NewFromUtf8(isolate, "Path exists and is not a socket")));
+            return;
+        }
+        unlink(path.c_str());
+    }
+
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.c_str(), path.size());
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd == -1) {
+        isolate->ThrowException(Exception::Error(
+            String::NewFromUtf8(isolate, "socket failed")));
+        return;
+    }
+
+    if (bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+        listen(listen_fd, 8) != 0) {
+        close(listen_fd);
+        listen_fd = -1;
+        isolate->ThrowException(Exception::Error(
+            String::NewFromUtf8(isolate, "Could not listen on path")));
+        return;
+    }
+
+    stop_fd = eventfd(0, EFD_CLOEXEC);
+    if (stop_fd == -1) {
+        close(listen_fd);
+        listen_fd = -1;
+        unlink(path.c_str());
+        isolate->ThrowException(Exception::Error(
+            String::NewFromUtf8(isolate, "eventfd failed")));
+        return;
+    }
+
+    // Parameters checked, from here on we no longer throw exceptions.
+    Wrap(args.This());
+    Ref();
+    args.GetReturnValue().Set(handle(isolate));
+
+    buffer.set_callback(isolate->GetCurrentContext(), val.As<Function>());
+
+    running = true;
+    uv_thread_create(&thread, thread_cb, this);
+}
+
+// Callers should remove the exporter from mixers first.
+void shm_exporter::destroy()
+{
+    if (running) {
+        running = false;
+
+        uint64_t one = 1;
+        if (write(stop_fd, &one, sizeof(one)) != sizeof(one))
+            fprintf(stderr, "eventfd write error %d\n", errno);
+
+        uv_thread_join(&thread);
+    }
+
+    if (listen_fd != -1) {
+        close(listen_fd);
+        listen_fd = -1;
+        unlink(path.c_str());
+    }
+
+    if (stop_fd != -1) {
+        close(stop_fd);
+        stop_fd = -1;
+    }
+
+    {
+        lock_handle write_lock(write_mutex);
+        lock_handle lock(*this);
+        destroy_ring();
+    }
+
+    buffer.flush();
+
+    Unref();
+}
+
+void shm_exporter::stats(const FunctionCallbackInfo<Value>& args)
+{
+    lock_handle lock(*this);
+
+    auto obj = Object::New(isolate);
+    obj->Set(String::NewFromUtf8(isolate, "published"), Number::New(isolate, published));
+    obj->Set(String::NewFromUtf8(isolate, "skipped"), Number::New(isolate, skipped));
+    obj->Set(String::NewFromUtf8(isolate, "clients"), Number::New(isolate, clients));
+    args.GetReturnValue().Set(obj);
+}
+
+lockable *shm_exporter::lock()
+{
+    return mutex.lock();
+}
+
+// Caller should hold the lock.
+bool shm_exporter::create_ring(dimensions_t dimensions_)
+{
+    bool ok;
+    dimensions = dimensions_;
+
+    size_t frame_size = dimensions.width * dimensions.height * 3 / 2;
+    size_t slot_size = align_64(sizeof(shm_ring_slot) + frame_size);
+    map_size = sizeof(shm_ring_header) + num_slots * slot_size;
+
+    mem_fd = syscall(SYS_memfd_create, "p1stream-export", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (!(ok = (mem_fd != -1)))
+        buffer.emitf(EV_LOG_ERROR, "memfd_create error %d", errno);
+
+    if (ok) {
+        ok = (ftruncate(mem_fd, map_size) == 0);
+        if (!ok)
+            buffer.emitf(EV_LOG_ERROR, "ftruncate error %d", errno);
+    }
+
+    // Consumers can trust the size once it is sealed.
+    if (ok) {
+        ok = (fcntl(mem_fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) == 0);
+        if (!ok)
+            buffer.emitf(EV_LOG_ERROR, "fcntl F_ADD_SEALS error %d", errno);
+    }
+
+    if (ok) {
+        void *map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, mem_fd, 0);
+        if (!(ok = (map != MAP_FAILED)))
+            buffer.emitf(EV_LOG_ERROR, "mmap error %d", errno);
+        else
+            header = (shm_ring_header *) map;
+    }
+
+    if (ok) {
+        // The memfd starts out zeroed, so only the header needs filling.
+        header->magic = SHM_RING_MAGIC;
+        header->version = SHM_RING_VERSION;
+        header->num_slots = num_slots;
+        header->slot_size = slot_size;
+        header->seq.store(0, std::memory_order_release);
+    }
+    else {
+        destroy_ring();
+    }
+
+    return ok;
+}
+
+// Caller should hold the lock and the write mutex.
+void shm_exporter::destroy_ring()
+{
+    if (header != NULL) {
+        munmap(header, map_size);
+        header = NULL;
+    }
+
+    if (mem_fd != -1) {
+        close(mem_fd);
+        mem_fd = -1;
+    }
+
+    map_size = 0;
+    dimensions = dimensions_t();
+}
+
+void shm_exporter::link_video_tap(video_tap_context &ctx)
+{
+    lock_handle lock(*this);
+
+    auto dims = ctx.mixer->out_dimensions;
+    if (header == NULL) {
+        create_ring(dims);
+    }
+    else if (dims.width != dimensions.width || dims.height != dimensions.height) {
+        buffer.emitf(EV_LOG_WARN, "Export ring is %ux%u, frames of %ux%u will be skipped",
+            dimensions.width, dimensions.height, dims.width, dims.height);
+    }
+}
+
+void shm_exporter::video_tap_frame(video_tap_context &ctx, std::shared_ptr<const video_frame> frame)
+{
+    lock_handle write_lock(write_mutex);
+    publish(*frame);
+}
+
+// Caller should hold the write mutex.
+void shm_exporter::publish(const video_frame &frame)
+{
+    shm_ring_header *hdr;
+    {
+        lock_handle lock(*this);
+        hdr = header;
+        if (hdr == NULL || frame.dimensions.width != dimensions.width ||
+            frame.dimensions.height != dimensions.height) {
+            skipped++;
+            return;
+        }
+    }
+
+    uint32_t width = frame.dimensions.width;
+    uint32_t height = frame.dimensions.height;
+
+    uint32_t seq = hdr->seq.load(std::memory_order_relaxed);
+    auto *slot = (shm_ring_slot *) ((char *) hdr + sizeof(shm_ring_header) +
+        (size_t) (seq % num_slots) * hdr->slot_size);
+
+    // Mark the slot as being written, before touching anything else.
+    uint32_t slot_seq = slot->seq.load(std::memory_order_relaxed);
+    slot->seq.store(slot_seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot->format = shm_format_i420;
+    slot->width = width;
+    slot->height = height;
+    slot->time = frame.time;
+
+    uint32_t offset = sizeof(shm_ring_slot);
+    for (int i = 0; i < 3; i++) {
+        uint32_t plane_width = i == 0 ? width : width / 2;
+        uint32_t plane_height = i == 0 ? height : height / 2;
+        uint8_t *dst = (uint8_t *) slot + offset;
+
+        slot->offsets[i] = offset;
+        slot->strides[i] = plane_width;
+
+        if (frame.strides[i] == (int) plane_width) {
+            memcpy(dst, frame.planes[i], plane_width * plane_height);
+        }
+        else {
+            for (uint32_t y = 0; y < plane_height; y++)
+                memcpy(dst + y * plane_width, frame.planes[i] + y * frame.strides[i], plane_width);
+        }
+
+        offset += plane_width * plane_height;
+    }
+
+    slot->seq.store(slot_seq + 2, std::memory_order_release);
+    hdr->seq.store(seq + 1, std::memory_order_release);
+
+    // Waiters are in other processes, so this is not a private futex.
+    syscall(SYS_futex, (uint32_t *) &hdr->seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+
+    lock_handle lock(*this);
+    published++;
+}
+
+void shm_exporter::thread_cb(void *arg)
+{
+    ((shm_exporter *) arg)->loop();
+}
+
+// Accept connections, and hand each the memfd. Connections are closed right
+// after, clients only need the descriptor.
+void shm_exporter::loop()
+{
+    while (true) {
+        struct pollfd fds[2];
+        fds[0].fd = listen_fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = stop_fd;
+        fds[1].events = POLLIN;
+
+        int ret = poll(fds, 2, -1);
+        if (ret > 0 && fds[1].revents)
+            break;
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "poll error %d\n", errno);
+            break;
+        }
+
+        int client_fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (client_fd == -1)
+            continue;
+
+        send_fd(client_fd);
+        close(client_fd);
+    }
+}
+
+void shm_exporter::send_fd(int client_fd)
+{
+    lock_handle lock(*this);
+
+    // Not linked yet, so nothing to hand out.
+    if (mem_fd == -1)
+        return;
+
+    shm_ring_hello hello;
+    hello.magic = SHM_RING_MAGIC;
+    hello.version = SHM_RING_VERSION;
+    hello.size = map_size;
+
+    struct iovec iov;
+    iov.iov_base = &hello;
+    iov.iov_len = sizeof(hello);
+
+    char control[CMSG_SPACE(sizeof(int))] = {};
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &mem_fd, sizeof(int));
+
+    // Never wait on a client.
+    if (sendmsg(client_fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL) == (ssize_t) sizeof(hello))
+        clients++;
+}
+
+static Local<Value> shm_export_events_transform(Isolate *isolate, event &ev, buffer_slicer &slicer)
+{
+    return Undefined(isolate);
+}
+
+void shm_exporter::init_prototype(Handle<FunctionTemplate> func)
+{
+    NODE_SET_PROTOTYPE_METHOD(func, "destroy", [](const FunctionCallbackInfo<Value>& args) {
+        auto exporter = ObjectWrap::Unwrap<shm_exporter>(args.This());
+        exporter->destroy();
+    });
+    NODE_SET_PROTOTYPE_METHOD(func, "stats", [](const FunctionCallbackInfo<Value>& args) {
+        auto exporter = ObjectWrap::Unwrap<shm_exporter>(args.This());
+        exporter->stats(args);
+    });
+}
+
+
+}  // namespace p1stream
@@ -0,0 +1,422 @@
+#include "p1stream_priv_linux.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+namespace p1stream {
+
+static Local<Value> shm_source_events_transform(Isolate *isolate, event &ev, buffer_slicer &slicer);
+
+// How often the connection thread checks on the ring.
+static const int check_interval_ms = 1000;
+// Reconnect if the producer hasn't published for this long, in case it
+// restarted with a new ring.
+static const int64_t stale_interval = 3000000000;  // 3s
+// Largest frame dimension we accept from a producer.
+static const uint32_t max_dimension = 16384;
+
+
+shm_source::shm_source() :
+    buffer(this, shm_source_events_transform, 65536),  // 64 KiB event buffer
+    stop_fd(-1), running(),
+    map_size(), header(), num_slots(), slot_size(), last_seq(), last_seq_time(), rendered_seq(),
+    attaches(), frames(), repeats(), skipped(), torn(), invalid()
+{
+}
+
+void shm_source::init(const FunctionCallbackInfo<Value>& args)
+{
+    Handle<Value> val;
+
+    isolate = args.GetIsolate();
+
+    if (args.Length() != 1 || !args[0]->IsObject()) {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "Expected an object")));
+        return;
+    }
+    auto params = args[0].As<Object>();
+
+    struct sockaddr_un addr;
+    val = params->Get(path_sym.Get(isolate));
+    if (val->IsString()) {
+        String::Utf8Value v(val);
+        path = *v;
+    }
+    if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "Invalid path")));
+        return;
+    }
+
+    val = params->Get(on_event_sym.Get(isolate));
+    if (!val->IsFunction()) {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "Expected an onEvent function")));
+        return;
+    }
+
+    stop_fd = eventfd(0, EFD_CLOEXEC);
+    if (stop_fd == -1) {
+        isolate->ThrowException(Exception::Error(
+            String::NewFromUtf8(isolate, "eventfd failed")));
+        return;
+    }
+
+    // Parameters checked, from here on we no longer throw exceptions.
+    Wrap(args.This());
+    Ref();
+    args.GetReturnValue().Set(handle(isolate));
+
+    buffer.set_callback(isolate->GetCurrentContext(), val.As<Function>());
+
+    running = true;
+    uv_thread_create(&thread, thread_cb, this);
+}
+
+// Callers should remove the source from mixers first.
+void shm_source::destroy()
+{
+    if (running) {
+        running = false;
+
+        uint64_t one = 1;
+        if (write(stop_fd, &one, sizeof(one)) != sizeof(one))
+            fprintf(stderr, "eventfd write error %d\n", errno);
+
+        uv_thread_join(&thread);
+    }
+
+    if (stop_fd != -1) {
+        close(stop_fd);
+        stop_fd = -1;
+    }
+
+    {
+        lock_handle lock(*this);
+        detach();
+    }
+
+    buffer.flush();
+
+    Unref();
+}
+
+void shm_source::stats(const FunctionCallbackInfo<Value>& args)
+{
+    lock_handle lock(*this);
+
+    auto obj = Object::New(isolate);
+    obj->Set(String::NewFromUtf8(isolate, "attached"), header != NULL ? True(isolate) : False(isolate));
+    obj->Set(String::NewFromUtf8(isolate, "attaches"), Number::New(isolate, attaches));
+    obj->Set(String::NewFromUtf8(isolate, "frames"), Number::New(isolate, frames));
+    obj->Set(String::NewFromUtf8(isolate, "repeats"), Number::New(isolate, repeats));
+    obj->Set(String::NewFromUtf8(isolate, "skipped"), Number::New(isolate, skipped));
+    obj->Set(String::NewFromUtf8(isolate, "torn"), Number::New(isolate, torn));
+    obj->Set(String::NewFromUtf8(isolate, "invalid"), Number::New(isolate, invalid));
+    obj->Set(String::NewFromUtf8(isolate, "lag"), lag.to_js(isolate));
+    args.GetReturnValue().Set(obj);
+}
+
+lockable *shm_source::lock()
+{
+    return mutex.lock();
+}
+
+void shm_source::thread_cb(void *arg)
+{
+    ((shm_source *) arg)->loop();
+}
+
+void shm_source::loop()
+{
+    while (true) {
+        bool want_connect;
+        {
+            lock_handle lock(*this);
+            if (header == NULL) {
+                want_connect = true;
+            }
+            else {
+                int64_t now = system_time();
+                uint32_t seq = header->seq.load(std::memory_order_relaxed);
+                if (seq != last_seq) {
+                    last_seq = seq;
+                    last_seq_time = now;
+                }
+                want_connect = (now - last_seq_time > stale_interval);
+            }
+        }
+
+        if (want_connect)
+            connect_ring();
+
+        struct pollfd fds[1];
+        fds[0].fd = stop_fd;
+        fds[0].events = POLLIN;
+
+        int ret = poll(fds, 1, check_interval_ms);
+        if (ret > 0)
+            break;
+        if (ret < 0 && errno != EINTR) {
+            fprintf(stderr, "poll error %d\n", errno);
+            break;
+        }
+    }
+}
+
+// Connect to the producer, and attach to the ring it hands us. Failure to
+// connect is silent, because the producer may simply not be running yet.
+bool shm_source::connect_ring()
+{
+    bool ok;
+    int sock_fd;
+    int mem_fd = -1;
+    shm_ring_hello hello;
+    struct stat st;
+    void *map = MAP_FAILED;
+
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.c_str(), path.size());
+
+    sock_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    ok = (sock_fd != -1);
+
+    if (ok) {
+        struct timeval timeout = { 1, 0 };
+        setsockopt(sock_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        ok = (connect(sock_fd, (struct sockaddr *) &addr, sizeof(addr)) == 0);
+    }
+
+    if (ok) {
+        struct iovec iov;
+        iov.iov_base = &hello;
+        iov.iov_len = sizeof(hello);
+
+        char control[CMSG_SPACE(sizeof(int))] = {};
+        struct msghdr msg = {};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        ssize_t ret = recvmsg(sock_fd, &msg, MSG_CMSG_CLOEXEC);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+            memcpy(&mem_fd, CMSG_DATA(cmsg), sizeof(int));
+
+        // A producer without a ring yet just closes the connection.
+        ok = (ret == (ssize_t) sizeof(hello) && mem_fd != -1 &&
+              hello.magic == SHM_RING_MAGIC && hello.version == SHM_RING_VERSION);
+        if (!ok && ret > 0) {
+            lock_handle lock(*this);
+            buffer.emitf(EV_LOG_ERROR, "Invalid handshake from %s", path.c_str());
+        }
+    }
+
+    // The ring is mapped for as long as we're connected, so a producer must
+    // not be able to shrink it from under us. Reads past the end fault.
+    if (ok) {
+        int seals = fcntl(mem_fd, F_GET_SEALS);
+        ok = (seals != -1 && (seals & F_SEAL_SHRINK) != 0);
+        if (!ok) {
+            lock_handle lock(*this);
+            buffer.emitf(EV_LOG_ERROR, "Ring from %s is not sealed against shrinking", path.c_str());
+        }
+    }
+
+    if (ok) {
+        ok = (fstat(mem_fd, &st) == 0 && hello.size >= sizeof(shm_ring_header) &&
+              (uint64_t) st.st_size >= hello.size);
+        if (!ok) {
+            lock_handle lock(*this);
+            buffer.emitf(EV_LOG_ERROR, "Invalid ring size from %s", path.c_str());
+        }
+    }
+
+    if (ok) {
+        map = mmap(NULL, hello.size, PROT_READ, MAP_SHARED, mem_fd, 0);
+        if (!(ok = (map != MAP_FAILED))) {
+            lock_handle lock(*this);
+            buffer.emitf(EV_LOG_ERROR, "mmap error %d", errno);
+        }
+    }
+
+    // Copy the layout, and check it fits.
+    uint32_t new_num_slots = 0;
+    uint32_t new_slot_size = 0;
+    if (ok) {
+        auto *hdr = (const shm_ring_header *) map;
+        new_num_slots = hdr->num_slots;
+        new_slot_size = hdr->slot_size;
+        ok = (hdr->magic == SHM_RING_MAGIC && hdr->version == SHM_RING_VERSION &&
+              new_num_slots != 0 && new_slot_size >= sizeof(shm_ring_slot) &&
+              sizeof(shm_ring_header) + (uint64_t) new_num_slots * new_slot_size <= hello.size);
+        if (!ok) {
+            lock_handle lock(*this);
+            buffer.emitf(EV_LOG_ERROR, "Invalid ring layout from %s", path.c_str());
+        }
+    }
+
+    if (mem_fd != -1)
+        close(mem_fd);
+    if (sock_fd != -1)
+        close(sock_fd);
+
+    if (!ok) {
+        if (map != MAP_FAILED)
+            munmap(map, hello.size);
+        return false;
+    }
+
+    lock_handle lock(*this);
+    detach();
+    header = (const shm_ring_header *) map;
+    map_size = hello.size;
+    num_slots = new_num_slots;
+    slot_size = new_slot_size;
+    last_seq = header->seq.load(std::memory_order_relaxed);
+    last_seq_time = system_time();
+    rendered_seq = 0;
+    attaches++;
+    return true;
+}
+
+// Caller should hold the lock.
+void shm_source::detach()
+{
+    if (header != NULL) {
+        munmap((void *) header, map_size);
+        header = NULL;
+    }
+    map_size = 0;
+}
+
+// Caller should hold the lock.
+const shm_ring_slot *shm_source::slot_for(uint32_t seq)
+{
+    return (const shm_ring_slot *) ((const char *) header + sizeof(shm_ring_header) +
+        (size_t) ((seq - 1) % num_slots) * slot_size);
+}
+
+// Check that a plane lies within the slot.
+static bool plane_fits(uint32_t slot_size, uint32_t offset, uint32_t stride,
+                       uint32_t row_size, uint32_t rows)
+{
+    return stride >= row_size && offset >= sizeof(shm_ring_slot) &&
+        offset + (uint64_t) stride * (rows - 1) + row_size <= slot_size;
+}
+
+void shm_source::produce_video_frame(video_source_context &ctx)
+{
+    auto &full = *((video_source_context_full *) &ctx);
+    lock_handle lock(*this);
+
+    if (header == NULL)
+        return;
+
+    uint32_t seq = header->seq.load(std::memory_order_acquire);
+
+    // Take the newest frame, or an older one if the producer is somehow
+    // still writing it. The oldest slot is the next one to be written.
+    uint32_t tries = num_slots > 1 ? num_slots - 1 : 1;
+    for (uint32_t i = 0; i < tries && seq - i != 0; i++) {
+        const shm_ring_slot *slot = slot_for(seq - i);
+        uint32_t slot_seq = slot->seq.load(std::memory_order_acquire);
+        if (slot_seq & 1)
+            continue;
+
+        // Take a copy of the metadata, then validate and use only that.
+        uint32_t format = slot->format;
+        dimensions_t dimensions = { slot->width, slot->height };
+        frame_time_t time = slot->time;
+        uint32_t offsets[3], strides[3];
+        memcpy(offsets, slot->offsets, sizeof(offsets));
+        memcpy(strides, slot->strides, sizeof(strides));
+
+        bool valid = (dimensions.width != 0 && dimensions.width <= max_dimension &&
+                      dimensions.height != 0 && dimensions.height <= max_dimension);
+        if (valid && format == shm_format_bgra) {
+            valid = (strides[0] % 4 == 0 &&
+                     plane_fits(slot_size, offsets[0], strides[0], dimensions.width * 4, dimensions.height));
+        }
+        else if (valid && format == shm_format_i420) {
+            valid = (dimensions.width % 2 == 0 && dimensions.height % 2 == 0 &&
+                     plane_fits(slot_size, offsets[0], strides[0], dimensions.width, dimensions.height) &&
+                     plane_fits(slot_size, offsets[1], strides[1], dimensions.width / 2, dimensions.height / 2) &&
+                     plane_fits(slot_size, offsets[2], strides[2], dimensions.width / 2, dimensions.height / 2));
+        }
+        else {
+            valid = false;
+        }
+
+        if (!valid) {
+            invalid++;
+            return;
+        }
+
+        // Upload straight from the mapping. GL has its own copy once the
+        // call returns.
+        auto *base = (const uint8_t *) slot;
+        if (format == shm_format_bgra) {
+            bool packed = (strides[0] == dimensions.width * 4);
+            if (!packed)
+                glPixelStorei(GL_UNPACK_ROW_LENGTH, strides[0] / 4);
+            ctx.render_buffer(dimensions, (void *) (base + offsets[0]));
+            if (!packed)
+                glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        }
+        else {
+            const uint8_t *planes[3] = { base + offsets[0], base + offsets[1], base + offsets[2] };
+            full.render_i420(dimensions, planes, strides);
+        }
+
+        // If the producer lapped us during the upload, this frame may be
+        // mixed with a newer one. That takes a full trip around the ring, so
+        // we only count it.
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot->seq.load(std::memory_order_relaxed) != slot_seq)
+            torn++;
+
+        uint32_t frame_seq = seq - i;
+        if (frame_seq == rendered_seq) {
+            repeats++;
+        }
+        else {
+            if (rendered_seq != 0 && frame_seq - rendered_seq > 1)
+                skipped += frame_seq - rendered_seq - 1;
+            rendered_seq = frame_seq;
+            frames++;
+        }
+        lag.record(system_time() - time);
+        return;
+    }
+}
+
+static Local<Value> shm_source_events_transform(Isolate *isolate, event &ev, buffer_slicer &slicer)
+{
+    return Undefined(isolate);
+}
+
+void shm_source::init_prototype(Handle<FunctionTemplate> func)
+{
+    NODE_SET_PROTOTYPE_METHOD(func, "destroy", [](const FunctionCallbackInfo<Value>& args) {
+        auto source = ObjectWrap::Unwrap<shm_source>(args.This());
+        source->destroy();
+    });
+    NODE_SET_PROTOTYPE_METHOD(func, "stats", [](const FunctionCallbackInfo<Value>& args) {
+        auto source = ObjectWrap::Unwrap<shm_source>(args.This());
+        source->stats(args);
+    });
+}
+
+
+}  // namespace p1stream
@@ -35,11 +35,17 @@ void software_clock::init(const FunctionCallbackInfo<Value>& args)
         return;
     }
 
+    int num_threads = tick_dispatcher::threads_param(isolate, params);
+    if (num_threads == 0)
+        return;
+
     // Parameters checked, from here on we no longer throw exceptions.
     Wrap(args.This());
     Ref();
     args.GetReturnValue().Set(handle());
 
+    dispatcher.init(num_threads);
+
     running = true;
     thread.init(std::bind(&software_clock::loop, this));
 }
@@ -49,11 +55,18 @@ void software_clock::destroy()
     if (running) {
         running = false;
         thread.destroy();
+        dispatcher.destroy();
     }
 
     Unref();
 }
 
+void software_clock::stats(const FunctionCallbackInfo<Value>& args)
+{
+    auto *isolate = args.GetIsolate();
+    args.GetReturnValue().Set(dispatcher.stats_to_js(isolate));
+}
+
 lockable *software_clock::lock()
 {
     return thread.lock();
@@ -61,12 +74,12 @@ lockable *software_clock::lock()
 
 void software_clock::link_video_clock(video_clock_context &ctx)
 {
-    ctxes.push_back(&ctx);
+    dispatcher.link(ctx);
 }
 
 void software_clock::unlink_video_clock(video_clock_context &ctx)
 {
-    ctxes.remove(&ctx);
+    dispatcher.unlink(ctx);
 }
 
 fraction_t software_clock::video_ticks_per_second(video_clock_context &ctx)
@@ -81,8 +94,7 @@ void software_clock::loop()
     int64_t time_next = time_now + interval;
 
     while (!thread.wait(time_next - time_now) && running) {
-        for (auto ctx : ctxes)
-            ctx->tick(time_next);
+        dispatcher.dispatch(time_next);
 
         time_now = system_time();
         while (time_next < time_now)
@@ -96,6 +108,10 @@ void software_clock::init_prototype(Handle<FunctionTemplate> func)
         auto clock = ObjectWrap::Unwrap<software_clock>(args.This());
         clock->destroy();
     });
+    NODE_SET_PROTOTYPE_METHOD(func, "stats", [](const FunctionCallbackInfo<Value>& args) {
+        auto clock = ObjectWrap::Unwrap<software_clock>(args.This());
+        clock->stats(args);
+    });
 }
 
 
@@ -0,0 +1,578 @@
+#include "p1stream_priv.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#if __SSE2__
+#   include <emmintrin.h>
+#endif
+
+namespace p1stream {
+
+// Largest frame dimension we accept.
+static const uint32_t max_dimension = 16384;
+
+// Size of the zone plate cosine table. Must be a power of two.
+static const uint32_t zone_table_size = 1024;
+
+// Font for the burned-in counter. Glyphs are 3x5 pixels, one octal digit per
+// row, top row first.
+static const char glyph_chars[] = "0123456789:.";
+static const uint16_t glyphs[] = {
+    075557, 026227, 071747, 071717, 055711,
+    074717, 074757, 071111, 075757, 075717,
+    002020, 000002
+};
+
+// Tones are generated in stereo at a fixed rate, which the mixer resamples
+// from if it runs at another rate.
+static const int tone_rate = 44100;
+static const int mix_channels = 2;
+// How often the audio thread renders, and the most it renders at once.
+static const int audio_interval = 10000000;  // 10ms
+static const size_t max_chunk_frames = tone_rate / 10;  // 100ms
+// If the audio thread falls further behind than this, skip ahead.
+static const uint64_t max_lag_frames = tone_rate;  // 1s
+
+// Tone level, about -12 dBFS.
+static const float tone_amplitude = 0.25f;
+// The sweep goes from 20 Hz to 20 kHz in 10 seconds, then repeats.
+static const double sweep_start = 20;
+static const double sweep_end = 20000;
+static const uint64_t sweep_frames = tone_rate * 10;
+
+
+static void fill_pixels(uint32_t *p, size_t n, uint32_t v)
+{
+#if __SSE2__
+    __m128i vv = _mm_set1_epi32(v);
+    for (; n >= 4; n -= 4, p += 4)
+        _mm_storeu_si128((__m128i *) p, vv);
+#endif
+    while (n--)
+        *(p++) = v;
+}
+
+// Fill a row with segments, whose widths are given in 84ths of the row. 84 is
+// divisible by 7, 12 and 28, which the bars layout needs.
+static void fill_segments(uint32_t *row, uint32_t width, const uint32_t *colors, const uint8_t *widths, size_t n)
+{
+    uint32_t pos = 0;
+    uint32_t x = 0;
+    for (size_t i = 0; i < n; i++) {
+        pos += widths[i];
+        uint32_t end = (uint64_t) width * pos / 84;
+        fill_pixels(row + x, end - x, colors[i]);
+        x = end;
+    }
+}
+
+
+// ----- Test pattern video source -----
+
+void test_pattern_source::init(const FunctionCallbackInfo<Value>& args)
+{
+    auto *isolate = args.GetIsolate();
+    Handle<Value> val;
+
+    if (args.Length() != 1 || !args[0]->IsObject()) {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "Expected an object")));
+        return;
+    }
+    auto params = args[0].As<Object>();
+
+    auto widthVal = params->Get(width_sym.Get(isolate));
+    auto heightVal = params->Get(height_sym.Get(isolate));
+    if (!widthVal->IsUint32() || !heightVal->IsUint32() ||
+        widthVal->Uint32Value() == 0 || widthVal->Uint32Value() > max_dimension ||
+        heightVal->Uint32Value() == 0 || heightVal->Uint32Value() > max_dimension) {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "Invalid dimensions")));
+        return;
+    }
+    dimensions.width = widthVal->Uint32Value();
+    dimensions.height = heightVal->Uint32Value();
+
+    pattern = pattern_bars;
+    val = params->Get(type_sym.Get(isolate));
+    if (!val->IsUndefined()) {
+        String::Utf8Value v(val);
+        if (strcmp(*v, "bars") == 0) {
+            pattern = pattern_bars;
+        }
+        else if (strcmp(*v, "zoneplate") == 0) {
+            pattern = pattern_zone_plate;
+        }
+        else if (strcmp(*v, "gradient") == 0) {
+            pattern = pattern_gradient;
+        }
+        else if (strcmp(*v, "noise") == 0) {
+            pattern = pattern_noise;
+        }
+        else {
+            isolate->ThrowException(Exception::TypeError(
+                String::NewFromUtf8(isolate, "Invalid pattern type")));
+            return;
+        }
+    }
+
+    // Entropy is the fraction of random bits per channel, for noise.
+    double entropy = 1;
+    val = params->Get(entropy_sym.Get(isolate));
+    if (!val->IsUndefined()) {
+        entropy = val->NumberValue();
+        if (!(entropy >= 0 && entropy <= 1)) {
+            isolate->ThrowException(Exception::TypeError(
+                String::NewFromUtf8(isolate, "Invalid entropy")));
+            return;
+        }
+    }
+
+    // Parameters checked, from here on we no longer throw exceptions.
+    Wrap(args.This());
+    Ref();
+    args.GetReturnValue().Set(handle());
+
+    data.resize((size_t) dimensions.width * dimensions.height);
+
+    switch (pattern) {
+        case pattern_bars:
+            draw_bars();
+            break;
+
+        case pattern_zone_plate:
+            table.resize(zone_table_size);
+            for (uint32_t i = 0; i < zone_table_size; i++) {
+                uint32_t v = (uint32_t) lround(127.5 + 127.5 * cos(2 * M_PI * i / zone_table_size));
+                table[i] = 0xFF000000 | v << 16 | v << 8 | v;
+            }
+            break;
+
+        case pattern_gradient:
+            // Periodic in 256 pixels, with room to start a row anywhere in
+            // the first period.
+            table.resize(dimensions.width + 256);
+            for (uint32_t i = 0; i < table.size(); i++) {
+                uint32_t v = i & 0xFF;
+                uint32_t b = v < 128 ? v * 2 : 511 - v * 2;
+                table[i] = 0xFF000000 | v << 16 | (255 - v) << 8 | b;
+            }
+            break;
+
+        case pattern_noise: {
+            // Random bits go in the top of each channel. The bit below them
+            // is set, to center the value in its quantization step.
+            uint32_t bits = (uint32_t) lround(entropy * 8);
+            uint32_t mask = (0xFF << (8 - bits)) & 0xFF;
+            uint32_t base = bits < 8 ? 0x80 >> bits : 0;
+            noise_mask = mask * 0x010101;
+            noise_base = base * 0x010101 | 0xFF000000;
+
+            // Fixed seeds, so runs are reproducible.
+            noise_state[0] = 0x9E3779B9;
+            noise_state[1] = 0x7F4A7C15;
+            noise_state[2] = 0x6A09E667;
+            noise_state[3] = 0xBB67AE85;
+            break;
+        }
+    }
+}
+
+void test_pattern_source::destroy()
+{
+    {
+        lock_handle lock(*this);
+        std::vector<uint32_t>().swap(data);
+        std::vector<uint32_t>().swap(table);
+    }
+
+    Unref();
+}
+
+lockable *test_pattern_source::lock()
+{
+    return mutex.lock();
+}
+
+// SMPTE color bars at 75%. These are static, so only drawn once.
+void test_pattern_source::draw_bars()
+{
+    static const uint32_t top_colors[] = {
+        0xFFBFBFBF, 0xFFBFBF00, 0xFF00BFBF, 0xFF00BF00,
+        0xFFBF00BF, 0xFFBF0000, 0xFF0000BF
+    };
+    static const uint8_t top_widths[] = { 12, 12, 12, 12, 12, 12, 12 };
+    static const uint32_t mid_colors[] = {
+        0xFF0000BF, 0xFF000000, 0xFFBF00BF, 0xFF000000,
+        0xFF00BFBF, 0xFF000000, 0xFFBFBFBF
+    };
+    static const uint32_t bottom_colors[] = {
+        0xFF00214C, 0xFFFFFFFF, 0xFF32006A, 0xFF000000,
+        0xFF000000, 0xFF000000, 0xFF0A0A0A, 0xFF000000
+    };
+    static const uint8_t bottom_widths[] = { 15, 15, 15, 15, 4, 4, 4, 12 };
+
+    uint32_t width = dimensions.width;
+    uint32_t height = dimensions.height;
+    uint32_t mid_start = height * 2 / 3;
+    uint32_t bottom_start = height * 3 / 4;
+
+    for (uint32_t y = 0; y < height; y++) {
+        uint32_t *row = data.data() + (size_t) y * width;
+        if (y == 0)
+            fill_segments(row, width, top_colors, top_widths, 7);
+        else if (y == mid_start)
+            fill_segments(row, width, mid_colors, top_widths, 7);
+        else if (y == bottom_start)
+            fill_segments(row, width, bottom_colors, bottom_widths, 8);
+        else
+            memcpy(row, row - width, width * sizeof(uint32_t));
+    }
+}
+
+// Circular zone plate whose rings move outward. Radius squared is updated
+// incrementally, so the inner loop is two additions and a table lookup.
+void test_pattern_source::draw_zone_plate()
+{
+    uint32_t width = dimensions.width;
+    uint32_t height = dimensions.height;
+    int32_t cx = width / 2;
+    int32_t cy = height / 2;
+
+    // Scaled so the frequency reaches Nyquist at the edge of the larger
+    // dimension.
+    uint32_t size = width > height ? width : height;
+    uint64_t k = ((uint64_t) zone_table_size << 15) / size;
+    uint32_t phase = (uint32_t) (frame * 8);
+    const uint32_t *lut = table.data();
+
+    uint32_t *p = data.data();
+    for (uint32_t y = 0; y < height; y++) {
+        int64_t dy = (int64_t) y - cy;
+        int64_t dx = -cx;
+        uint64_t r2 = dx * dx + dy * dy;
+        for (uint32_t x = 0; x < width; x++) {
+            *(p++) = lut[((r2 * k >> 16) + phase) & (zone_table_size - 1)];
+            r2 += 2 * dx + 1;
+            dx++;
+        }
+    }
+}
+
+// Diagonal color bands moving sideways. Every row is a copy out of the
+// periodic template.
+void test_pattern_source::draw_gradient()
+{
+    uint32_t width = dimensions.width;
+    uint32_t shift = (uint32_t) (frame * 4);
+
+    uint32_t *p = data.data();
+    for (uint32_t y = 0; y < dimensions.height; y++, p += width)
+        memcpy(p, table.data() + ((y + shift) & 0xFF), width * sizeof(uint32_t));
+}
+
+// Xorshift noise, generating four pixels per step.
+void test_pattern_source::draw_noise()
+{
+    uint32_t *p = data.data();
+    size_t n = data.size();
+
+#if __SSE2__
+    __m128i s = _mm_loadu_si128((__m128i *) noise_state);
+    __m128i mask = _mm_set1_epi32(noise_mask);
+    __m128i base = _mm_set1_epi32(noise_base);
+    for (; n >= 4; n -= 4, p += 4) {
+        s = _mm_xor_si128(s, _mm_slli_epi32(s, 13));
+        s = _mm_xor_si128(s, _mm_srli_epi32(s, 17));
+        s = _mm_xor_si128(s, _mm_slli_epi32(s, 5));
+        _mm_storeu_si128((__m128i *) p, _mm_or_si128(_mm_and_si128(s, mask), base));
+    }
+    _mm_storeu_si128((__m128i *) noise_state, s);
+#endif
+
+    for (size_t i = 0; n--; i = (i + 1) & 3) {
+        uint32_t s = noise_state[i];
+        s ^= s << 13;
+        s ^= s >> 17;
+        s ^= s << 5;
+        noise_state[i] = s;
+        *(p++) = (s & noise_mask) | noise_base;
+    }
+}
+
+// Burn the frame counter and tick time into the top left corner. The time is
+// shown as time of day of the monotonic clock, to compare against logs.
+void test_pattern_source::draw_counter(frame_time_t time)
+{
+    char text[32];
+    uint64_t ms = time / 1000000;
+    int len = snprintf(text, sizeof(text), "%08llu %02u:%02u:%02u.%03u",
+                       (unsigned long long) frame,
+                       (unsigned) (ms / 3600000 % 24), (unsigned) (ms / 60000 % 60),
+                       (unsigned) (ms / 1000 % 60), (unsigned) (ms % 1000));
+    if (len <= 0 || len >= (int) sizeof(text))
+        return;
+
+    // Each glyph cell is 4x6 units, and the box has a unit of padding.
+    uint32_t width = dimensions.width;
+    uint32_t unit = dimensions.height / 180;
+    if (unit == 0)
+        unit = 1;
+    uint32_t x0 = unit * 2;
+    uint32_t y0 = unit * 2;
+    uint32_t box_width = unit * (len * 4 + 1);
+    uint32_t box_height = unit * 7;
+    if (x0 + box_width > width || y0 + box_height > dimensions.height)
+        return;
+
+    uint32_t *origin = data.data() + (size_t) y0 * width + x0;
+    for (uint32_t y = 0; y < box_height; y++)
+        fill_pixels(origin + (size_t) y * width, box_width, 0xFF000000);
+
+    for (int i = 0; i < len; i++) {
+        const char *c = strchr(glyph_chars, text[i]);
+        if (text[i] == ' ' || c == NULL)
+            continue;
+        uint16_t glyph = glyphs[c - glyph_chars];
+
+        uint32_t *cell = origin + (size_t) unit * width + unit * (i * 4 + 1);
+        for (uint32_t gy = 0; gy < 5; gy++) {
+            uint32_t bits = (glyph >> (3 * (4 - gy))) & 7;
+            for (uint32_t gx = 0; gx < 3; gx++) {
+                if (!(bits & (4 >> gx)))
+                    continue;
+                uint32_t *block = cell + (size_t) gy * unit * width + gx * unit;
+                for (uint32_t y = 0; y < unit; y++)
+                    fill_pixels(block + (size_t) y * width, unit, 0xFFFFFFFF);
+            }
+        }
+    }
+}
+
+void test_pattern_source::produce_video_frame(video_source_context &ctx)
+{
+    auto &ctx_full = (video_source_context_full &) ctx;
+    lock_handle lock(*this);
+
+    if (data.empty())
+        return;
+
+    // Only draw once per tick, in case several mixers share the clock.
+    frame_time_t time = ctx_full.tick_time;
+    if (frame == 0 || time != last_time) {
+        switch (pattern) {
+            case pattern_bars:
+                break;
+            case pattern_zone_plate:
+                draw_zone_plate();
+                break;
+            case pattern_gradient:
+                draw_gradient();
+                break;
+            case pattern_noise:
+                draw_noise();
+                break;
+        }
+        draw_counter(time);
+
+        last_time = time;
+        frame++;
+    }
+
+    ctx.render_buffer(dimensions, data.data());
+}
+
+void test_pattern_source::init_prototype(Handle<FunctionTemplate> func)
+{
+    NODE_SET_PROTOTYPE_METHOD(func, "destroy", [](const FunctionCallbackInfo<Value>& args) {
+        auto source = ObjectWrap::Unwrap<test_pattern_source>(args.This());
+        source->destroy();
+    });
+}
+
+
+// ----- Tone audio source -----
+
+void tone_source::init(const FunctionCallbackInfo<Value>& args)
+{
+    auto *isolate = args.GetIsolate();
+    Handle<Value> val;
+
+    if (args.Length() != 1 || !args[0]->IsObject()) {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "Expected an object")));
+        return;
+    }
+    auto params = args[0].As<Object>();
+
+    waveform = waveform_sine;
+    val = params->Get(type_sym.Get(isolate));
+    if (!val->IsUndefined()) {
+        String::Utf8Value v(val);
+        if (strcmp(*v, "sine") == 0) {
+            waveform = waveform_sine;
+        }
+        else if (strcmp(*v, "sweep") == 0) {
+            waveform = waveform_sweep;
+        }
+        else if (strcmp(*v, "pink") == 0) {
+            waveform = waveform_pink;
+        }
+        else {
+            isolate->ThrowException(Exception::TypeError(
+                String::NewFromUtf8(isolate, "Invalid waveform type")));
+            return;
+        }
+    }
+
+    frequency = 1000;
+    val = params->Get(frequency_sym.Get(isolate));
+    if (!val->IsUndefined()) {
+        frequency = val->NumberValue();
+        if (!(frequency > 0 && frequency < tone_rate / 2)) {
+            isolate->ThrowException(Exception::TypeError(
+                String::NewFromUtf8(isolate, "Invalid frequency")));
+            return;
+        }
+    }
+
+    // Parameters checked, from here on we no longer throw exceptions.
+    Wrap(args.This());
+    Ref();
+    args.GetReturnValue().Set(handle());
+
+    out_buffer = new float[max_chunk_frames * mix_channels];
+    noise_state = 0x9E3779B9;
+
+    running = true;
+    start_time = system_time();
+    thread.init(std::bind(&tone_source::loop, this));
+}
+
+void tone_source::destroy()
+{
+    if (running) {
+        running = false;
+        thread.destroy();
+    }
+
+    if (out_buffer != nullptr) {
+        delete[] out_buffer;
+        out_buffer = nullptr;
+    }
+
+    Unref();
+}
+
+lockable *tone_source::lock()
+{
+    return thread.lock();
+}
+
+void tone_source::link_audio_source(audio_source_context &ctx)
+{
+    lock_handle lock(thread);
+    ctxes.push_back(&ctx);
+}
+
+void tone_source::unlink_audio_source(audio_source_context &ctx)
+{
+    lock_handle lock(thread);
+    ctxes.remove(&ctx);
+}
+
+// Generate interleaved stereo samples, with both channels the same.
+void tone_source::generate(float *out, size_t count)
+{
+    switch (waveform) {
+        case waveform_sine: {
+            double step = 2 * M_PI * frequency / tone_rate;
+            for (size_t i = 0; i < count; i++) {
+                out[i * 2] = out[i * 2 + 1] = tone_amplitude * (float) sin(phase);
+                phase += step;
+            }
+            break;
+        }
+
+        case waveform_sweep: {
+            double log_ratio = log(sweep_end / sweep_start);
+            for (size_t i = 0; i < count; i++) {
+                double t = (double) ((position + i) % sweep_frames) / sweep_frames;
+                double f = sweep_start * exp(t * log_ratio);
+                out[i * 2] = out[i * 2 + 1] = tone_amplitude * (float) sin(phase);
+                phase += 2 * M_PI * f / tone_rate;
+            }
+            break;
+        }
+
+        case waveform_pink: {
+            // Paul Kellet's refined filter, applied to xorshift white noise.
+            float *b = pink;
+            for (size_t i = 0; i < count; i++) {
+                uint32_t s = noise_state;
+                s ^= s << 13;
+                s ^= s >> 17;
+                s ^= s << 5;
+                noise_state = s;
+                float white = (int32_t) s * (1.0f / 2147483648.0f);
+
+                b[0] = 0.99886f * b[0] + white * 0.0555179f;
+                b[1] = 0.99332f * b[1] + white * 0.0750759f;
+                b[2] = 0.96900f * b[2] + white * 0.1538520f;
+                b[3] = 0.86650f * b[3] + white * 0.3104856f;
+                b[4] = 0.55000f * b[4] + white * 0.5329522f;
+                b[5] = -0.7616f * b[5] - white * 0.0168980f;
+                float v = b[0] + b[1] + b[2] + b[3] + b[4] + b[5] + b[6] + white * 0.5362f;
+                b[6] = white * 0.115926f;
+
+                out[i * 2] = out[i * 2 + 1] = tone_amplitude * 0.11f * v;
+            }
+            break;
+        }
+    }
+
+    phase = fmod(phase, 2 * M_PI);
+}
+
+void tone_source::loop()
+{
+    while (!thread.wait(audio_interval) && running) {
+        int64_t elapsed = system_time() - start_time;
+        uint64_t due = (elapsed / 1000000000) * tone_rate +
+                       (elapsed % 1000000000) * tone_rate / 1000000000;
+
+        if (due - position > max_lag_frames)
+            position = due - max_lag_frames;
+
+        while (position < due) {
+            size_t count = due - position;
+            if (count > max_chunk_frames)
+                count = max_chunk_frames;
+
+            generate(out_buffer, count);
+
+            int64_t time = start_time +
+                (int64_t) (position / tone_rate) * 1000000000 +
+                (int64_t) (position % tone_rate) * 1000000000 / tone_rate;
+            for (auto ctx : ctxes) {
+                ((audio_source_context_full *) ctx)->render_buffer(
+                    time, out_buffer, count * mix_channels, tone_rate);
+            }
+
+            position += count;
+        }
+    }
+}
+
+void tone_source::init_prototype(Handle<FunctionTemplate> func)
+{
+    NODE_SET_PROTOTYPE_METHOD(func, "destroy", [](const FunctionCallbackInfo<Value>& args) {
+        auto source = ObjectWrap::Unwrap<tone_source>(args.This());
+        source->destroy();
+    });
+}
+
+
+}  // namespace p1stream
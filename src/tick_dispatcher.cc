@@ -0,0 +1,218 @@
+#include "p1stream_priv.h"
+
+#include <thread>
+
+namespace p1stream {
+
+// Upper bound on the default number of worker threads.
+static const int max_default_threads = 4;
+
+
+void tick_dispatcher::init(int num_threads)
+{
+    running = true;
+    uv_cond_init(&work_cond);
+    uv_cond_init(&done_cond);
+
+    threads.resize(num_threads);
+    for (auto &thread : threads)
+        uv_thread_create(&thread, worker_cb, this);
+}
+
+void tick_dispatcher::destroy()
+{
+    if (!running)
+        return;
+
+    {
+        lock_handle lock(mutex);
+        running = false;
+        uv_cond_broadcast(&work_cond);
+    }
+
+    for (auto &thread : threads)
+        uv_thread_join(&thread);
+    threads.clear();
+
+    uv_cond_destroy(&work_cond);
+    uv_cond_destroy(&done_cond);
+}
+
+std::list<tick_dispatcher::entry>::iterator tick_dispatcher::find(video_clock_context &ctx)
+{
+    auto it = entries.begin();
+    while (it != entries.end() && it->ctx != &ctx)
+        it++;
+    return it;
+}
+
+void tick_dispatcher::link(video_clock_context &ctx)
+{
+    lock_handle lock(mutex);
+
+    entry e;
+    e.ctx = &ctx;
+    e.busy = false;
+    e.pending = false;
+    e.pending_time = 0;
+    entries.push_back(e);
+}
+
+void tick_dispatcher::unlink(video_clock_context &ctx)
+{
+    lock_handle lock(mutex);
+
+    auto it = find(ctx);
+    if (it == entries.end())
+        return;
+
+    auto &e = *it;
+    if (e.pending) {
+        for (auto qit = queue.begin(); qit != queue.end(); qit++) {
+            if (*qit == &e) {
+                queue.erase(qit);
+                break;
+            }
+        }
+        e.pending = false;
+        complete_tick(e.pending_time);
+    }
+
+    // The caller holds the clock lock, so no new ticks can arrive meanwhile.
+    while (e.busy)
+        uv_cond_wait(&done_cond, &mutex.mutex);
+
+    entries.erase(it);
+}
+
+void tick_dispatcher::dispatch(frame_time_t time)
+{
+    lock_handle lock(mutex);
+
+    if (entries.empty())
+        return;
+
+    tick_record record;
+    record.time = time;
+    record.start = system_time();
+    record.remaining = (int) entries.size();
+    records.push_back(record);
+    ticks++;
+
+    for (auto &e : entries) {
+        if (e.busy || e.pending) {
+            late++;
+            ((video_mixer_base *) e.ctx->mixer())->late_ticks++;
+        }
+
+        if (e.pending) {
+            // Still waiting on the previous tick, which we now skip.
+            dropped++;
+            ((video_mixer_base *) e.ctx->mixer())->dropped_ticks++;
+            complete_tick(e.pending_time);
+            e.pending_time = time;
+            continue;
+        }
+
+        e.pending = true;
+        e.pending_time = time;
+        if (!e.busy) {
+            queue.push_back(&e);
+            uv_cond_signal(&work_cond);
+        }
+    }
+}
+
+void tick_dispatcher::wait_idle()
+{
+    lock_handle lock(mutex);
+    while (!records.empty())
+        uv_cond_wait(&done_cond, &mutex.mutex);
+}
+
+// Account for one mixer being done with a tick, either because it ran, or
+// because it was skipped.
+void tick_dispatcher::complete_tick(frame_time_t time)
+{
+    for (auto &record : records) {
+        if (record.time == time) {
+            if (--record.remaining == 0)
+                completion.record(system_time() - record.start);
+            break;
+        }
+    }
+
+    while (!records.empty() && records.front().remaining == 0)
+        records.pop_front();
+}
+
+void tick_dispatcher::worker_cb(void *arg)
+{
+    ((tick_dispatcher *) arg)->worker();
+}
+
+void tick_dispatcher::worker()
+{
+    lock_handle lock(mutex);
+
+    while (true) {
+        while (running && queue.empty())
+            uv_cond_wait(&work_cond, &mutex.mutex);
+        if (!running)
+            break;
+
+        auto &e = *queue.front();
+        queue.pop_front();
+
+        frame_time_t time = e.pending_time;
+        e.pending = false;
+        e.busy = true;
+
+        mutex.unlock();
+        e.ctx->tick(time);
+        mutex.lock();
+
+        e.busy = false;
+        complete_tick(time);
+
+        // Another tick arrived while this one was running.
+        if (e.pending)
+            queue.push_back(&e);
+
+        uv_cond_broadcast(&done_cond);
+    }
+}
+
+Local<Object> tick_dispatcher::stats_to_js(Isolate *isolate)
+{
+    lock_handle lock(mutex);
+
+    auto obj = Object::New(isolate);
+    obj->Set(String::NewFromUtf8(isolate, "threads"), Number::New(isolate, threads.size()));
+    obj->Set(String::NewFromUtf8(isolate, "ticks"), Number::New(isolate, ticks));
+    obj->Set(String::NewFromUtf8(isolate, "late"), Number::New(isolate, late));
+    obj->Set(String::NewFromUtf8(isolate, "dropped"), Number::New(isolate, dropped));
+    obj->Set(String::NewFromUtf8(isolate, "completion"), completion.to_js(isolate));
+    return obj;
+}
+
+int tick_dispatcher::threads_param(Isolate *isolate, Handle<Object> params)
+{
+    auto val = params->Get(threads_sym.Get(isolate));
+    if (val->IsUndefined()) {
+        int num = (int) std::thread::hardware_concurrency();
+        if (num > max_default_threads)
+            num = max_default_threads;
+        return num < 1 ? 1 : num;
+    }
+
+    if (!val->IsUint32() || val->Uint32Value() == 0 || val->Uint32Value() > 64) {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "Invalid threads")));
+        return 0;
+    }
+    return val->Uint32Value();
+}
+
+
+}  // namespace p1stream
@@ -1,6 +1,8 @@
 #include "p1stream_priv.h"
 #include "node_buffer.h"
 
+#include <string.h>
+
 namespace p1stream {
 
 
@@ -152,5 +154,99 @@ void event_buffer::flush()
     }
 }
 
+void latency_histogram::reset()
+{
+    count = 0;
+    sum = 0;
+    min = INT64_MAX;
+    max = 0;
+    memset(buckets, 0, sizeof(buckets));
+}
+
+// Bucket 0-3 hold exact values, after that every power of two is split into
+// four linear steps.
+static int latency_bucket(int64_t value)
+{
+    if (value < 4)
+        return value < 0 ? 0 : (int) value;
+
+    int msb = 63 - __builtin_clzll((uint64_t) value);
+    int sub = (int) (value >> (msb - 2)) & 3;
+    int idx = (msb - 1) * 4 + sub;
+    return idx < latency_histogram::num_buckets ? idx : latency_histogram::num_buckets - 1;
+}
+
+static int64_t latency_bucket_mid(int idx)
+{
+    if (idx < 4)
+        return idx;
+
+    int msb = idx / 4 + 1;
+    int64_t step = (int64_t) 1 << (msb - 2);
+    return (4 + idx % 4) * step + step / 2;
+}
+
+void latency_histogram::record(int64_t value)
+{
+    count++;
+    sum += value;
+    if (value < min) min = value;
+    if (value > max) max = value;
+    buckets[latency_bucket(value)]++;
+}
+
+int64_t latency_histogram::percentile(double p) const
+{
+    if (count == 0)
+        return 0;
+
+    uint64_t target = (uint64_t) (p * count);
+    if (target >= count)
+        target = count - 1;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < num_buckets; i++) {
+        seen += buckets[i];
+        if (seen > target) {
+            int64_t value = latency_bucket_mid(i);
+            if (value < min) value = min;
+            if (value > max) value = max;
+            return value;
+        }
+    }
+    return max;
+}
+
+Local<Object> latency_histogram::to_js(Isolate *isolate) const
+{
+    auto obj = Object::New(isolate);
+#define SET(key, value) obj->Set(String::NewFromUtf8(isolate, key), Number::New(isolate, value))
+    SET("count", count);
+    SET("min", count ? min : 0);
+    SET("max", max);
+    SET("mean", count ? (double) sum / count : 0);
+    SET("p50", percentile(0.50));
+    SET("p90", percentile(0.90));
+    SET("p99", percentile(0.99));
+#undef SET
+    return obj;
+}
+
+Local<Array> latency_histogram::buckets_to_js(Isolate *isolate) const
+{
+    auto arr = Array::New(isolate);
+    uint32_t len = 0;
+    for (int i = 0; i < num_buckets; i++) {
+        if (buckets[i] == 0)
+            continue;
+
+        auto pair = Array::New(isolate, 2);
+        pair->Set(0, Number::New(isolate, latency_bucket_mid(i)));
+        pair->Set(1, Number::New(isolate, buckets[i]));
+        arr->Set(len++, pair);
+    }
+    return arr;
+}
+
 
 } // namespace p1stream
@@ -3,6 +3,24 @@
 namespace p1stream {
 
 
+static void precise_clock_constructor(const FunctionCallbackInfo<Value>& args)
+{
+    auto clock = new precise_clock();
+    clock->init(args);
+}
+
+static void shm_exporter_constructor(const FunctionCallbackInfo<Value>& args)
+{
+    auto exporter = new shm_exporter();
+    exporter->init(args);
+}
+
+static void shm_source_constructor(const FunctionCallbackInfo<Value>& args)
+{
+    auto source = new shm_source();
+    source->init(args);
+}
+
 int64_t system_time()
 {
     struct timespec t;
@@ -13,8 +31,33 @@ int64_t system_time()
 
 void module_platform_init(
     Handle<Object> exports, Handle<Value> module,
-    Handle<Context> context, void* priv);
+    Handle<Context> context, void* priv)
 {
+    auto *isolate = context->GetIsolate();
+
+    Handle<String> name;
+    Handle<FunctionTemplate> func;
+
+    name = String::NewFromUtf8(isolate, "PreciseClock");
+    func = FunctionTemplate::New(isolate, precise_clock_constructor);
+    func->InstanceTemplate()->SetInternalFieldCount(1);
+    func->SetClassName(name);
+    precise_clock::init_prototype(func);
+    exports->Set(name, func->GetFunction());
+
+    name = String::NewFromUtf8(isolate, "ShmExporter");
+    func = FunctionTemplate::New(isolate, shm_exporter_constructor);
+    func->InstanceTemplate()->SetInternalFieldCount(1);
+    func->SetClassName(name);
+    shm_exporter::init_prototype(func);
+    exports->Set(name, func->GetFunction());
+
+    name = String::NewFromUtf8(isolate, "ShmSource");
+    func = FunctionTemplate::New(isolate, shm_source_constructor);
+    func->InstanceTemplate()->SetInternalFieldCount(1);
+    func->SetClassName(name);
+    shm_source::init_prototype(func);
+    exports->Set(name, func->GetFunction());
 }
 
 
@@ -9,6 +9,8 @@ namespace p1stream {
 // call. The struct is followed by an array of x264_nals_t, and then the
 // sequential payloads.
 struct video_frame_data {
+    video_mixer_base *mixer;
+
     int64_t pts;
     int64_t dts;
     bool keyframe;
@@ -30,15 +32,28 @@ static const char *simple_vertex_shader =
         "v_TexCoords = a_TexCoords * textureSize(u_Texture);\n"
     "}\n";
 
+// Samples BGRA textures, or I420 planes in three single channel textures when
+// u_Planar is set. The conversion is the inverse of the kernel below.
 static const char *simple_fragment_shader =
     "#version 150\n"
 
     "uniform sampler2DRect u_Texture;\n"
+    "uniform sampler2DRect u_TextureU;\n"
+    "uniform sampler2DRect u_TextureV;\n"
+    "uniform bool u_Planar;\n"
     "in vec2 v_TexCoords;\n"
     "out vec4 o_FragColor;\n"
 
     "void main(void) {\n"
-        "o_FragColor = texture(u_Texture, v_TexCoords);\n"
+        "if (!u_Planar) {\n"
+            "o_FragColor = texture(u_Texture, v_TexCoords);\n"
+        "}\n"
+        "else {\n"
+            "float y = 1.164 * (texture(u_Texture, v_TexCoords).r - 0.0627);\n"
+            "float u = texture(u_TextureU, v_TexCoords * 0.5).r - 0.5;\n"
+            "float v = texture(u_TextureV, v_TexCoords * 0.5).r - 0.5;\n"
+            "o_FragColor = vec4(y + 1.596 * v, y - 0.392 * u - 0.813 * v, y + 2.017 * u, 1.0);\n"
+        "}\n"
     "}\n";
 
 static const char *yuv_kernel_source =
@@ -87,6 +102,19 @@ static const GLsizei vbo_stride = 4 * sizeof(GLfloat);
 static const GLsizei vbo_size = 4 * vbo_stride;
 static const void *vbo_tex_coord_offset = (void *)(2 * sizeof(GLfloat));
 
+// Compiled OpenCL programs, shared between mixers using the same context.
+struct shared_cl_program {
+    cl_context cl;
+    cl_program program;
+    int refcount;
+};
+
+static lockable_mutex cl_programs_mutex;
+static std::list<shared_cl_program> cl_programs;
+
+static cl_program acquire_yuv_program(event_buffer &buffer, program_cache &cache, cl_context cl);
+static void release_yuv_program(cl_program program);
+
 static Local<Value> video_events_transform(Isolate *isolate, event &ev, buffer_slicer &slicer);
 static Local<Value> video_frame_to_js(Isolate *isolate, video_frame_data &frame, buffer_slicer &slicer);
 static void encoder_log_callback(void *priv, int level, const char *format, va_list ap);
@@ -94,7 +122,9 @@ static void encoder_log_callback(void *priv, int level, const char *format, va_l
 
 video_mixer_base::video_mixer_base() :
     buffer(this, video_events_transform, 1048576),  // 1 MiB event buffer
-    running(), clock_ctx(), cl(), out_pic(), clq(), tex_mem(), out_mem(), yuv_kernel(), enc()
+    running(), clock_ctx(), cl(), out_pic(), clq(), tex_mem(), out_mem(), yuv_program(), yuv_kernel(), enc(),
+    frames_pending(0), late_ticks(0), dropped_ticks(0),
+    init_time(), encoder_open_time(), first_frame_latency(), ticks(), frames_out(), bytes_out()
 {
 }
 
@@ -103,12 +133,14 @@ void video_mixer_base::init(const FunctionCallbackInfo<Value>& args)
     bool ok;
     cl_device_id device_id;
     cl_int cl_err;
-    cl_program yuv_program;
     GLenum gl_err;
     int i_ret;
+    video_clock *clock = nullptr;
     isolate = args.GetIsolate();
     Handle<Value> val;
 
+    init_time = system_time();
+
     if (args.Length() != 1 || !args[0]->IsObject()) {
         isolate->ThrowException(Exception::TypeError(
             String::NewFromUtf8(isolate, "Expected an object")));
@@ -132,6 +164,17 @@ void video_mixer_base::init(const FunctionCallbackInfo<Value>& args)
     }
     out_dimensions.height = val->Uint32Value();
 
+    val = params->Get(cache_dir_sym.Get(isolate));
+    if (val->IsString()) {
+        String::Utf8Value v(val);
+        cache.dir = *v;
+    }
+    else if (!val->IsUndefined()) {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "Invalid cacheDir")));
+        return;
+    }
+
     val = params->Get(on_event_sym.Get(isolate));
     if (!val->IsFunction()) {
         isolate->ThrowException(Exception::TypeError(
@@ -193,6 +236,9 @@ void video_mixer_base::init(const FunctionCallbackInfo<Value>& args)
 
     if (ok) {
         tex_u = glGetUniformLocation(program, "u_Texture");
+        tex_u_u = glGetUniformLocation(program, "u_TextureU");
+        tex_v_u = glGetUniformLocation(program, "u_TextureV");
+        planar_u = glGetUniformLocation(program, "u_Planar");
 
         tex_mem = clCreateFromGLTexture(cl, CL_MEM_READ_ONLY, GL_TEXTURE_RECTANGLE, 0, texture_, &cl_err);
         if (!(ok = (cl_err == CL_SUCCESS)))
@@ -206,22 +252,13 @@ void video_mixer_base::init(const FunctionCallbackInfo<Value>& args)
     }
 
     if (ok) {
-        yuv_program = clCreateProgramWithSource(cl, 1, &yuv_kernel_source, NULL, &cl_err);
-        if (!(ok = (cl_err == CL_SUCCESS)))
-            buffer.emitf(EV_LOG_ERROR, "clCreateProgramWithSource error 0x%x", cl_err);
-    }
-
-    if (ok) {
-        cl_err = clBuildProgram(yuv_program, 0, NULL, NULL, NULL, NULL);
-        if (!(ok = (cl_err == CL_SUCCESS))) {
-            buffer.emitf(EV_LOG_ERROR, "clBuildProgram error 0x%x", cl_err);
-            clReleaseProgram(yuv_program);
-        }
+        yuv_program = acquire_yuv_program(buffer, cache, cl);
+        ok = (yuv_program != NULL);
     }
 
+    // Kernel arguments are per mixer, so every mixer has its own kernel.
     if (ok) {
         yuv_kernel = clCreateKernel(yuv_program, "yuv", &cl_err);
-        clReleaseProgram(yuv_program);
         if (!(ok = (cl_err == CL_SUCCESS)))
             buffer.emitf(EV_LOG_ERROR, "clCreateKernel error 0x%x", cl_err);
     }
@@ -233,6 +270,9 @@ void video_mixer_base::init(const FunctionCallbackInfo<Value>& args)
         glBindBuffer(GL_ARRAY_BUFFER, vbo);
         glUseProgram(program);
         glUniform1i(tex_u, 0);
+        glUniform1i(tex_u_u, 1);
+        glUniform1i(tex_v_u, 2);
+        glUniform1i(planar_u, 0);
         glBindVertexArray(vao);
         glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, vbo_stride, 0);
         glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, vbo_stride, vbo_tex_coord_offset);
@@ -319,15 +359,20 @@ void video_mixer_base::init(const FunctionCallbackInfo<Value>& args)
         }
         else {
             auto obj = val.As<Object>();
-            auto clock = ObjectWrap::Unwrap<video_clock>(obj);
-            lock_handle lock(*clock);
-
-            clock_ctx = new video_clock_context_full(this, clock);
-            clock->link_video_clock(*clock_ctx);
+            clock = ObjectWrap::Unwrap<video_clock>(obj);
         }
     }
 
+    // Open the encoder now, rather than on the first tick, so that the first
+    // frames aren't late and headers are out before any frame.
     if (ok) {
+        int64_t open_start = system_time();
+
+        clock_ctx = new video_clock_context_full(this, clock);
+        fraction_t fps = clock->video_ticks_per_second(*clock_ctx);
+        enc_params.i_fps_num = fps.num;
+        enc_params.i_fps_den = fps.den;
+
         enc_params.i_timebase_num = 1;
         enc_params.i_timebase_den = 1000000000;
 
@@ -337,7 +382,35 @@ void video_mixer_base::init(const FunctionCallbackInfo<Value>& args)
         enc_params.i_width = out_dimensions.width;
         enc_params.i_height = out_dimensions.height;
 
-        running = true;
+        enc = x264_encoder_open(&enc_params);
+        if (!(ok = (enc != NULL)))
+            buffer.emitf(EV_LOG_ERROR, "x264_encoder_open error");
+
+        if (ok) {
+            x264_nal_t *nals;
+            int nals_len;
+            i_ret = x264_encoder_headers(enc, &nals, &nals_len);
+            if (!(ok = (i_ret >= 0)))
+                buffer.emitf(EV_LOG_ERROR, "x264_encoder_headers error");
+            else if (i_ret > 0)
+                buffer_nals(EV_VIDEO_HEADERS, nals, nals_len, NULL);
+        }
+
+        encoder_open_time = system_time() - open_start;
+    }
+
+    if (ok) {
+        // Ticks may already arrive on clock threads. Release the GL context,
+        // and publish our state to them through the lock.
+        deactivate_gl();
+        uploader.init(this);
+        {
+            lock_handle lock(*this);
+            running = true;
+        }
+
+        lock_handle lock(*clock);
+        clock->link_video_clock(*clock_ctx);
     }
     else {
         buffer.emit(EV_FAILURE);
@@ -346,20 +419,36 @@ void video_mixer_base::init(const FunctionCallbackInfo<Value>& args)
 
 void video_mixer_base::destroy()
 {
-    lock_handle lock(*this);
     cl_int cl_err;
 
-    running = false;
-
+    // Unlink from the clock first, without holding our own lock, because this
+    // waits for a running tick to finish.
     if (clock_ctx != nullptr) {
-        clock_ctx->clock()->unlink_video_clock(*clock_ctx);
+        auto *clock = clock_ctx->clock();
+        {
+            lock_handle lock(*clock);
+            clock->unlink_video_clock(*clock_ctx);
+        }
 
         delete clock_ctx;
         clock_ctx = nullptr;
     }
 
+    lock_handle lock(*this);
+
+    running = false;
+
     clear_sources();
 
+    // Tap and upload threads may be busy, and the upload thread takes our
+    // lock to emit events, so join them unlocked. Ticks no longer run, and
+    // taps can't be added once we're no longer running.
+    mutex.unlock();
+    clear_taps();
+    uploader.destroy();
+    mutex.lock();
+    frame_pool.clear();
+
     if (enc != NULL) {
         x264_encoder_close(enc);
         enc = NULL;
@@ -372,6 +461,11 @@ void video_mixer_base::destroy()
         yuv_kernel = NULL;
     }
 
+    if (yuv_program != NULL) {
+        release_yuv_program(yuv_program);
+        yuv_program = NULL;
+    }
+
     if (out_mem != NULL) {
         cl_err = clReleaseMemObject(out_mem);
         if (cl_err != CL_SUCCESS)
@@ -411,7 +505,7 @@ void video_mixer_base::destroy()
 
 lockable *video_mixer_base::lock()
 {
-    return clock_ctx ? clock_ctx->clock()->lock() : nullptr;
+    return mutex.lock();
 }
 
 void video_mixer_base::clear_hooks()
@@ -459,17 +553,66 @@ void video_mixer_base::set_hooks(const FunctionCallbackInfo<Value>& args)
     }
 }
 
+void video_mixer_base::stats(const FunctionCallbackInfo<Value>& args)
+{
+    lock_handle lock(*this);
+
+    auto obj = Object::New(isolate);
+    obj->Set(String::NewFromUtf8(isolate, "ticks"), Number::New(isolate, ticks));
+    obj->Set(String::NewFromUtf8(isolate, "frames"), Number::New(isolate, frames_out));
+    obj->Set(String::NewFromUtf8(isolate, "bytes"), Number::New(isolate, bytes_out));
+    obj->Set(String::NewFromUtf8(isolate, "lateTicks"), Number::New(isolate, late_ticks));
+    obj->Set(String::NewFromUtf8(isolate, "droppedTicks"), Number::New(isolate, dropped_ticks));
+    obj->Set(String::NewFromUtf8(isolate, "encoderOpenTime"), Number::New(isolate, encoder_open_time));
+    if (frames_out != 0)
+        obj->Set(String::NewFromUtf8(isolate, "firstFrameLatency"), Number::New(isolate, first_frame_latency));
+
+    auto stages = Object::New(isolate);
+    stages->Set(String::NewFromUtf8(isolate, "render"), render_latency.to_js(isolate));
+    stages->Set(String::NewFromUtf8(isolate, "convert"), convert_latency.to_js(isolate));
+    stages->Set(String::NewFromUtf8(isolate, "encode"), encode_latency.to_js(isolate));
+    stages->Set(String::NewFromUtf8(isolate, "total"), tick_latency.to_js(isolate));
+    obj->Set(String::NewFromUtf8(isolate, "stages"), stages);
+
+    auto taps = Array::New(isolate, tap_ctxes.size());
+    for (uint32_t i = 0; i < tap_ctxes.size(); i++) {
+        auto &ctx = *tap_ctxes[i];
+        lock_handle lock(ctx.mutex);
+        auto tap = Object::New(isolate);
+        tap->Set(String::NewFromUtf8(isolate, "delivered"), Number::New(isolate, ctx.delivered));
+        tap->Set(String::NewFromUtf8(isolate, "dropped"), Number::New(isolate, ctx.dropped));
+        taps->Set(i, tap);
+    }
+    obj->Set(String::NewFromUtf8(isolate, "taps"), taps);
+
+    auto sources = Array::New(isolate, source_ctxes.size());
+    for (uint32_t i = 0; i < source_ctxes.size(); i++)
+        sources->Set(i, source_ctxes[i].upload->stats_to_js(isolate));
+    obj->Set(String::NewFromUtf8(isolate, "sources"), sources);
+
+    args.GetReturnValue().Set(obj);
+}
+
 void video_mixer_base::clear_sources()
 {
     uint32_t len = source_ctxes.size();
-    GLuint textures[len];
+    GLuint textures[len * 3];
     size_t num_textures = 0;
     for (uint32_t i = 0; i < len; i++) {
         auto &ctx = source_ctxes[i];
         ctx.source()->unlink_video_source(ctx);
         if (running && ctx.has_texture())
             textures[num_textures++] = ctx.texture();
+        for (auto texture : ctx.plane_textures) {
+            if (running && texture != 0)
+                textures[num_textures++] = texture;
+        }
+
+        // The upload thread deletes the textures of the queue.
+        ctx.upload->closed = true;
     }
+    if (len != 0)
+        uploader.signal();
     source_ctxes.clear();
     if (num_textures != 0)
         glDeleteTextures(num_textures, textures);
@@ -494,6 +637,7 @@ void video_mixer_base::set_sources(const FunctionCallbackInfo<Value>& args)
     auto l_v1_sym = v1_sym.Get(isolate);
     auto l_u2_sym = u2_sym.Get(isolate);
     auto l_v2_sym = v2_sym.Get(isolate);
+    auto l_latency_sym = latency_sym.Get(isolate);
 
     std::vector<video_source_context_full> new_ctxes;
     for (uint32_t i = 0; i < len; i++) {
@@ -521,6 +665,10 @@ void video_mixer_base::set_sources(const FunctionCallbackInfo<Value>& args)
         ctx.v1 = obj->Get(l_v1_sym)->NumberValue();
         ctx.u2 = obj->Get(l_u2_sym)->NumberValue();
         ctx.v2 = obj->Get(l_v2_sym)->NumberValue();
+
+        // Latency offset for pushed frames, in milliseconds.
+        auto latency_val = obj->Get(l_latency_sym);
+        ctx.latency = latency_val->IsNumber() ? (int64_t) (latency_val->NumberValue() * 1000000) : 0;
     }
 
     len = new_ctxes.size();
@@ -534,8 +682,13 @@ void video_mixer_base::set_sources(const FunctionCallbackInfo<Value>& args)
     clear_sources();
     source_ctxes = new_ctxes;
 
-    for (auto &ctx : source_ctxes)
+    for (auto &ctx : source_ctxes) {
+        ctx.upload = uploader.create_queue();
+        ctx.upload->latency = ctx.latency;
         ctx.source()->link_video_source(ctx);
+    }
+
+    deactivate_gl();
 }
 
 void video_mixer_base::tick(frame_time_t time)
@@ -543,6 +696,11 @@ void video_mixer_base::tick(frame_time_t time)
     if (!running)
         return;
 
+    int64_t tick_start = system_time();
+    int64_t stage_start = tick_start;
+    int64_t stage_end;
+    ticks++;
+
     bool ok = activate_gl();
 
     // Render.
@@ -550,8 +708,13 @@ void video_mixer_base::tick(frame_time_t time)
 
     if (ok) {
         glClear(GL_COLOR_BUFFER_BIT);
-        for (auto &ctx : source_ctxes)
-            ctx.source()->produce_video_frame(ctx);
+        for (auto &ctx : source_ctxes) {
+            ctx.tick_time = time;
+            if (ctx.upload->active)
+                ctx.render_uploaded(time);
+            else
+                ctx.source()->produce_video_frame(ctx);
+        }
         glFinish();
         if (!(ok = ((gl_err = glGetError()) == GL_NO_ERROR)))
             buffer.emitf(EV_LOG_ERROR, "OpenGL error 0x%x", gl_err);
@@ -560,6 +723,10 @@ void video_mixer_base::tick(frame_time_t time)
     if (ok) {
         for (auto &ctx : hook_ctxes)
             ctx.hook()->video_post_render(ctx);
+
+        stage_end = system_time();
+        render_latency.record(stage_end - stage_start);
+        stage_start = stage_end;
     }
 
     // Convert colorspace.
@@ -569,6 +736,18 @@ void video_mixer_base::tick(frame_time_t time)
     int nals_len;
     x264_picture_t enc_pic;
 
+    // While taps are linked, convert into a pooled frame that can be shared
+    // with them. Otherwise, or if the pool is exhausted, use our own buffer.
+    std::shared_ptr<video_frame> tap_frame;
+    if (!tap_ctxes.empty())
+        tap_frame = acquire_frame();
+
+    x264_picture_t in_pic = out_pic;
+    if (tap_frame) {
+        for (int i = 0; i < 3; i++)
+            in_pic.img.plane[i] = tap_frame->planes[i];
+    }
+
     if (ok) {
         cl_err = clEnqueueAcquireGLObjects(clq, 1, &tex_mem, 0, NULL, NULL);
         if (!(ok = (cl_err == CL_SUCCESS)))
@@ -588,7 +767,7 @@ void video_mixer_base::tick(frame_time_t time)
     }
 
     if (ok) {
-        cl_err = clEnqueueReadBuffer(clq, out_mem, CL_FALSE, 0, out_size, out_pic.img.plane[0], 0, NULL, NULL);
+        cl_err = clEnqueueReadBuffer(clq, out_mem, CL_FALSE, 0, out_size, in_pic.img.plane[0], 0, NULL, NULL);
         if (!(ok = (cl_err == CL_SUCCESS)))
             buffer.emitf(EV_LOG_ERROR, "clEnqueueReadBuffer error 0x%x", cl_err);
     }
@@ -599,33 +778,161 @@ void video_mixer_base::tick(frame_time_t time)
             buffer.emitf(EV_LOG_ERROR, "clFinish error 0x%x", cl_err);
     }
 
-    // Encode.
-    if (ok && enc == NULL) {
-        fraction_t fps = clock_ctx->clock()->video_ticks_per_second(*clock_ctx);
-        enc_params.i_fps_num = fps.num;
-        enc_params.i_fps_den = fps.den;
-
-        enc = x264_encoder_open(&enc_params);
-        if (!(ok = (enc != NULL)))
-            buffer.emitf(EV_LOG_ERROR, "x264_encoder_open error");
+    if (ok) {
+        stage_end = system_time();
+        convert_latency.record(stage_end - stage_start);
+        stage_start = stage_end;
+    }
 
-        if (ok) {
-            i_ret = x264_encoder_headers(enc, &nals, &nals_len);
-            if (!(ok = (i_ret >= 0)))
-                buffer.emitf(EV_LOG_ERROR, "x264_encoder_headers error");
-            else if (i_ret > 0)
-                buffer_nals(EV_VIDEO_HEADERS, nals, nals_len, NULL);
+    // Taps run on their own threads, and only see every Nth frame.
+    if (ok) {
+        if (tap_frame)
+            tap_frame->time = time;
+        for (auto &ctx : tap_ctxes) {
+            if (++ctx->counter % ctx->interval != 0)
+                continue;
+            if (tap_frame) {
+                ctx->offer(tap_frame);
+            }
+            else {
+                lock_handle lock(ctx->mutex);
+                ctx->dropped++;
+            }
         }
     }
 
+    // Encode. The encoder copies the picture, so the buffer is free after.
     if (ok) {
-        out_pic.i_dts = out_pic.i_pts = time;
-        i_ret = x264_encoder_encode(enc, &nals, &nals_len, &out_pic, &enc_pic);
+        in_pic.i_dts = in_pic.i_pts = time;
+        i_ret = x264_encoder_encode(enc, &nals, &nals_len, &in_pic, &enc_pic);
         if (!(ok = (i_ret >= 0)))
             buffer.emitf(EV_LOG_ERROR, "x264_encoder_encode error");
         else if (i_ret > 0)
             buffer_nals(EV_VIDEO_FRAME, nals, nals_len, &enc_pic);
     }
+
+    if (ok) {
+        stage_end = system_time();
+        encode_latency.record(stage_end - stage_start);
+        tick_latency.record(stage_end - tick_start);
+    }
+
+    deactivate_gl();
+}
+
+static std::string cl_device_string(cl_device_id device_id, cl_device_info param)
+{
+    char str[256];
+    size_t size;
+    if (clGetDeviceInfo(device_id, param, sizeof(str), str, &size) != CL_SUCCESS || size == 0)
+        return "";
+    return std::string(str, size - 1);
+}
+
+// Get the compiled YUV conversion program for a context. Other mixers may
+// already have built it, otherwise try the on-disk cache, and finally fall
+// back to building from source.
+static cl_program acquire_yuv_program(event_buffer &buffer, program_cache &cache, cl_context cl)
+{
+    lock_handle lock(cl_programs_mutex);
+    cl_program program = NULL;
+    cl_device_id device_id;
+    cl_int cl_err;
+    bool ok;
+
+    for (auto &entry : cl_programs) {
+        if (entry.cl == cl) {
+            entry.refcount++;
+            return entry.program;
+        }
+    }
+
+    cl_err = clGetContextInfo(cl, CL_CONTEXT_DEVICES, sizeof(cl_device_id), &device_id, NULL);
+    if (!(ok = (cl_err == CL_SUCCESS)))
+        buffer.emitf(EV_LOG_ERROR, "clGetContextInfo error 0x%x", cl_err);
+
+    std::string key;
+    std::vector<char> binary;
+    if (ok) {
+        key = "cl\n" +
+            cl_device_string(device_id, CL_DEVICE_VENDOR) + "\n" +
+            cl_device_string(device_id, CL_DEVICE_NAME) + "\n" +
+            cl_device_string(device_id, CL_DEVICE_VERSION) + "\n" +
+            cl_device_string(device_id, CL_DRIVER_VERSION) + "\n" +
+            program_cache::hash(yuv_kernel_source);
+
+        if (cache.load(key, binary)) {
+            const unsigned char *binary_data = (const unsigned char *) binary.data();
+            size_t binary_size = binary.size();
+            cl_int status;
+            program = clCreateProgramWithBinary(cl, 1, &device_id,
+                &binary_size, &binary_data, &status, &cl_err);
+            if (cl_err == CL_SUCCESS && status == CL_SUCCESS)
+                cl_err = clBuildProgram(program, 0, NULL, NULL, NULL, NULL);
+            if (cl_err != CL_SUCCESS && program != NULL) {
+                clReleaseProgram(program);
+                program = NULL;
+            }
+        }
+    }
+
+    if (ok && program == NULL) {
+        program = clCreateProgramWithSource(cl, 1, &yuv_kernel_source, NULL, &cl_err);
+        if (!(ok = (cl_err == CL_SUCCESS)))
+            buffer.emitf(EV_LOG_ERROR, "clCreateProgramWithSource error 0x%x", cl_err);
+
+        if (ok) {
+            cl_err = clBuildProgram(program, 0, NULL, NULL, NULL, NULL);
+            if (!(ok = (cl_err == CL_SUCCESS))) {
+                buffer.emitf(EV_LOG_ERROR, "clBuildProgram error 0x%x", cl_err);
+                clReleaseProgram(program);
+            }
+        }
+
+        size_t binary_size = 0;
+        if (ok) {
+            cl_err = clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES,
+                sizeof(size_t), &binary_size, NULL);
+            if (cl_err != CL_SUCCESS)
+                binary_size = 0;
+        }
+
+        if (binary_size != 0) {
+            binary.resize(binary_size);
+            unsigned char *binary_data = (unsigned char *) binary.data();
+            cl_err = clGetProgramInfo(program, CL_PROGRAM_BINARIES,
+                sizeof(binary_data), &binary_data, NULL);
+            if (cl_err == CL_SUCCESS)
+                cache.store(key, binary_data, binary_size);
+        }
+    }
+
+    if (!ok)
+        return NULL;
+
+    shared_cl_program entry;
+    entry.cl = cl;
+    entry.program = program;
+    entry.refcount = 1;
+    cl_programs.push_back(entry);
+    return program;
+}
+
+static void release_yuv_program(cl_program program)
+{
+    lock_handle lock(cl_programs_mutex);
+
+    for (auto it = cl_programs.begin(); it != cl_programs.end(); it++) {
+        if (it->program == program) {
+            if (--it->refcount == 0) {
+                cl_int cl_err = clReleaseProgram(program);
+                if (cl_err != CL_SUCCESS)
+                    fprintf(stderr, "clReleaseProgram error 0x%x\n", cl_err);
+                cl_programs.erase(it);
+            }
+            return;
+        }
+    }
 }
 
 void video_mixer_base::buffer_nals(uint32_t id, x264_nal_t *nals, int nals_len, x264_picture_t *pic)
@@ -641,7 +948,16 @@ void video_mixer_base::buffer_nals(uint32_t id, x264_nal_t *nals, int nals_len,
     if (ev == NULL)
         return;
 
+    if (id == EV_VIDEO_FRAME) {
+        if (frames_out == 0)
+            first_frame_latency = system_time() - init_time;
+        frames_pending++;
+        frames_out++;
+        bytes_out += payload_size;
+    }
+
     auto &frame = *(video_frame_data *) ev->data;
+    frame.mixer = this;
     if (pic != NULL) {
         frame.pts = pic->i_pts;
         frame.dts = pic->i_dts;
@@ -664,8 +980,12 @@ static Local<Value> video_events_transform(Isolate *isolate, event &ev, buffer_s
 {
     switch (ev.id) {
         case EV_VIDEO_HEADERS:
-        case EV_VIDEO_FRAME:
             return video_frame_to_js(isolate, *(video_frame_data *) ev.data, slicer);
+        case EV_VIDEO_FRAME: {
+            auto &frame = *(video_frame_data *) ev.data;
+            frame.mixer->frames_pending--;
+            return video_frame_to_js(isolate, frame, slicer);
+        }
         default:
             return Undefined(isolate);
     }
@@ -736,8 +1056,64 @@ GLuint video_mixer_base::build_shader(GLuint type, const char *source)
     return shader;
 }
 
+// Try to restore the GL program from a cached binary.
+static bool load_program_binary(program_cache &cache, const std::string &key, GLuint program)
+{
+    std::vector<char> data;
+    if (!cache.load(key, data) || data.size() <= sizeof(GLenum))
+        return false;
+
+    GLenum format;
+    memcpy(&format, data.data(), sizeof(GLenum));
+    glProgramBinary(program, format, data.data() + sizeof(GLenum), data.size() - sizeof(GLenum));
+
+    GLint success = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+
+    // The driver may reject the binary, which is not an error.
+    return glGetError() == GL_NO_ERROR && success == GL_TRUE;
+}
+
+static void store_program_binary(program_cache &cache, const std::string &key, GLuint program)
+{
+    GLint size = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &size);
+    if (glGetError() != GL_NO_ERROR || size <= 0)
+        return;
+
+    std::vector<char> data(sizeof(GLenum) + size);
+    GLenum format;
+    glGetProgramBinary(program, size, NULL, &format, data.data() + sizeof(GLenum));
+    if (glGetError() != GL_NO_ERROR)
+        return;
+
+    memcpy(data.data(), &format, sizeof(GLenum));
+    cache.store(key, data.data(), data.size());
+}
+
 bool video_mixer_base::build_program()
 {
+    // Program binaries need GL 4.1 or ARB_get_program_binary. Without either,
+    // querying the formats raises an error, which we clear here.
+    GLint num_formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_formats);
+    bool use_cache = (glGetError() == GL_NO_ERROR && num_formats > 0 && !cache.dir.empty());
+
+    std::string key;
+    if (use_cache) {
+        key = std::string("gl\n") +
+            (const char *) glGetString(GL_VENDOR) + "\n" +
+            (const char *) glGetString(GL_RENDERER) + "\n" +
+            (const char *) glGetString(GL_VERSION) + "\n" +
+            program_cache::hash(simple_vertex_shader) + "\n" +
+            program_cache::hash(simple_fragment_shader);
+
+        if (load_program_binary(cache, key, program))
+            return true;
+
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+
     GLuint vertex_shader = build_shader(GL_VERTEX_SHADER, simple_vertex_shader);
     if (vertex_shader == 0)
         return false;
@@ -776,6 +1152,9 @@ bool video_mixer_base::build_program()
         return false;
     }
 
+    if (use_cache)
+        store_program_binary(cache, key, program);
+
     return true;
 }
 
@@ -793,12 +1172,22 @@ void video_mixer_base::init_prototype(Handle<FunctionTemplate> func)
         auto mixer = ObjectWrap::Unwrap<video_mixer_base>(args.This());
         mixer->set_hooks(args);
     });
+    NODE_SET_PROTOTYPE_METHOD(func, "setTaps", [](const FunctionCallbackInfo<Value>& args) {
+        auto mixer = ObjectWrap::Unwrap<video_mixer_base>(args.This());
+        mixer->set_taps(args);
+    });
+    NODE_SET_PROTOTYPE_METHOD(func, "stats", [](const FunctionCallbackInfo<Value>& args) {
+        auto mixer = ObjectWrap::Unwrap<video_mixer_base>(args.This());
+        mixer->stats(args);
+    });
 }
 
 
 void video_clock_context::tick(frame_time_t time)
 {
-    ((video_mixer_base *) mixer_)->tick(time);
+    auto *mixer = (video_mixer_base *) mixer_;
+    lock_handle lock(*mixer);
+    mixer->tick(time);
 }
 
 void video_source::link_video_source(video_source_context &ctx)
@@ -838,6 +1227,44 @@ void video_source_context::render_buffer(dimensions_t dimensions, void *data)
     render_texture();
 }
 
+void video_source_context_full::render_i420(dimensions_t dimensions,
+    const uint8_t *const planes[3], const uint32_t strides[3])
+{
+    auto &mixer = *(video_mixer_base *) mixer_;
+
+    for (int i = 0; i < 3; i++) {
+        GLuint texture;
+        if (i == 0) {
+            texture = this->texture();
+        }
+        else {
+            auto &plane_texture = plane_textures[i - 1];
+            if (plane_texture == 0)
+                glGenTextures(1, &plane_texture);
+            texture = plane_texture;
+        }
+
+        // Chroma of odd dimensions rounds up, as in Y4M.
+        uint32_t width = i == 0 ? dimensions.width : (dimensions.width + 1) / 2;
+        uint32_t height = i == 0 ? dimensions.height : (dimensions.height + 1) / 2;
+
+        glActiveTexture(GL_TEXTURE0 + i);
+        glBindTexture(GL_TEXTURE_RECTANGLE, texture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, strides[i]);
+        glTexImage2D(GL_TEXTURE_RECTANGLE, 0, GL_R8, width, height, 0,
+                     GL_RED, GL_UNSIGNED_BYTE, planes[i]);
+    }
+
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glActiveTexture(GL_TEXTURE0);
+
+    glUniform1i(mixer.planar_u, 1);
+    render_texture();
+    glUniform1i(mixer.planar_u, 0);
+}
+
 static void encoder_log_callback(void *priv, int level, const char *format, va_list ap)
 {
     auto &mixer = *(video_mixer_base *) priv;
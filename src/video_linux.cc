@@ -1,35 +1,72 @@
-// FIXME: This code is outdated, and was never fully tested.
+// FIXME: This code was never fully tested.
 
 #include "p1stream_priv_linux.h"
 
-#include <string.h>
-
 namespace p1stream {
 
+static const EGLint context_attribs[] = {
+    EGL_CONTEXT_MAJOR_VERSION_KHR, 3,
+    EGL_CONTEXT_MINOR_VERSION_KHR, 2,
+    EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR,
+    EGL_NONE
+};
 
-bool video_mixer_linux::platform_init(Handle<Object> params)
+// The shared device, protected by the mutex.
+static lockable_mutex device_mutex;
+static egl_device *shared_device;
+
+
+egl_device *egl_device::acquire(event_buffer &buffer)
+{
+    lock_handle lock(device_mutex);
+
+    if (shared_device == nullptr) {
+        auto *device = new egl_device();
+        if (!device->init(buffer)) {
+            device->destroy();
+            delete device;
+            return nullptr;
+        }
+        shared_device = device;
+    }
+
+    shared_device->refcount++;
+    return shared_device;
+}
+
+void egl_device::release()
+{
+    lock_handle lock(device_mutex);
+
+    if (--refcount == 0) {
+        destroy();
+        shared_device = nullptr;
+        delete this;
+    }
+}
+
+bool egl_device::init(event_buffer &buffer)
 {
     bool ok;
     EGLBoolean egl_ret;
-    EGLConfig egl_config;
     cl_int cl_err;
 
-    // FIXME: Multiple video mixers will conflict.
-    // We need to manage displays.
-    egl_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
-    if (!(ok = (egl_display != EGL_NO_DISPLAY)))
-        strcpy(last_error, "No EGL display");
+    display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if (!(ok = (display != EGL_NO_DISPLAY)))
+        buffer.emitf(EV_LOG_ERROR, "No EGL display");
 
     if (ok) {
-        egl_ret = eglInitialize(egl_display, NULL, NULL);
-        if (!(ok = (egl_ret == EGL_TRUE)))
-            sprintf(last_error, "eglInitialize error 0x%x", eglGetError());
+        egl_ret = eglInitialize(display, NULL, NULL);
+        if (!(ok = (egl_ret == EGL_TRUE))) {
+            buffer.emitf(EV_LOG_ERROR, "eglInitialize error 0x%x", eglGetError());
+            display = EGL_NO_DISPLAY;
+        }
     }
 
     if (ok) {
         egl_ret = eglBindAPI(EGL_OPENGL_API);
         if (!(ok = (egl_ret == EGL_TRUE)))
-            sprintf(last_error, "eglBindApi error 0x%x", eglGetError());
+            buffer.emitf(EV_LOG_ERROR, "eglBindApi error 0x%x", eglGetError());
     }
 
     if (ok) {
@@ -41,35 +78,84 @@ bool video_mixer_linux::platform_init(Handle<Object> params)
             EGL_NONE
         };
         EGLint num_config;
-        egl_ret = eglChooseConfig(egl_display, attribs, &egl_config, 1, &num_config);
+        egl_ret = eglChooseConfig(display, attribs, &config, 1, &num_config);
         if (!(ok = (egl_ret == EGL_TRUE)))
-            sprintf(last_error, "eglChooseConfig error 0x%x", eglGetError());
+            buffer.emitf(EV_LOG_ERROR, "eglChooseConfig error 0x%x", eglGetError());
         else if (!(ok = (num_config > 0)))
-            strcpy(last_error, "eglChooseConfig returned no suitable configurations");
+            buffer.emitf(EV_LOG_ERROR, "eglChooseConfig returned no suitable configurations");
     }
 
     if (ok) {
-        EGLint attribs[] = {
-            EGL_CONTEXT_MAJOR_VERSION_KHR, 3,
-            EGL_CONTEXT_MINOR_VERSION_KHR, 2,
-            EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR,
-            EGL_NONE
-        };
-        egl_context = eglCreateContext(egl_display,
-            egl_config, EGL_NO_CONTEXT, attribs);
-        if (!(ok = (egl_context != EGL_NO_CONTEXT)))
-            sprintf(last_error, "eglCreateContext error 0x%x", eglGetError());
+        root_context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attribs);
+        if (!(ok = (root_context != EGL_NO_CONTEXT)))
+            buffer.emitf(EV_LOG_ERROR, "eglCreateContext error 0x%x", eglGetError());
     }
 
     if (ok) {
         cl_context_properties props[] = {
-            CL_EGL_DISPLAY_KHR, (cl_context_properties) egl_display,
-            CL_GL_CONTEXT_KHR, (cl_context_properties) egl_context,
+            CL_EGL_DISPLAY_KHR, (cl_context_properties) display,
+            CL_GL_CONTEXT_KHR, (cl_context_properties) root_context,
             0
         };
         cl = clCreateContext(props, 0, NULL, NULL, NULL, &cl_err);
         if (!(ok = (cl_err == CL_SUCCESS)))
-            sprintf(last_error, "clCreateContext error 0x%x", cl_err);
+            buffer.emitf(EV_LOG_ERROR, "clCreateContext error 0x%x", cl_err);
+    }
+
+    return ok;
+}
+
+void egl_device::destroy()
+{
+    EGLBoolean egl_ret;
+
+    if (cl != nullptr) {
+        cl_int cl_err = clReleaseContext(cl);
+        if (cl_err != CL_SUCCESS)
+            fprintf(stderr, "clReleaseContext error 0x%x\n", cl_err);
+        cl = nullptr;
+    }
+
+    if (root_context != EGL_NO_CONTEXT) {
+        egl_ret = eglDestroyContext(display, root_context);
+        if (egl_ret == EGL_FALSE)
+            fprintf(stderr, "eglDestroyContext error 0x%x\n", eglGetError());
+        root_context = EGL_NO_CONTEXT;
+    }
+
+    if (display != EGL_NO_DISPLAY) {
+        egl_ret = eglTerminate(display);
+        if (egl_ret == EGL_FALSE)
+            fprintf(stderr, "eglTerminate error 0x%x\n", eglGetError());
+        display = EGL_NO_DISPLAY;
+    }
+}
+
+
+bool video_mixer_linux::platform_init(Handle<Object> params)
+{
+    bool ok;
+    cl_int cl_err;
+    GLenum gl_err;
+
+    device = egl_device::acquire(buffer);
+    ok = (device != nullptr);
+
+    if (ok) {
+        egl_context = eglCreateContext(device->display,
+            device->config, device->root_context, context_attribs);
+        if (!(ok = (egl_context != EGL_NO_CONTEXT)))
+            buffer.emitf(EV_LOG_ERROR, "eglCreateContext error 0x%x", eglGetError());
+    }
+
+    if (ok) {
+        // Common code releases our reference.
+        cl = device->cl;
+        cl_err = clRetainContext(cl);
+        if (!(ok = (cl_err == CL_SUCCESS))) {
+            buffer.emitf(EV_LOG_ERROR, "clRetainContext error 0x%x", cl_err);
+            cl = nullptr;
+        }
     }
 
     if (ok) {
@@ -83,7 +169,7 @@ bool video_mixer_linux::platform_init(Handle<Object> params)
             GL_RGBA8, out_dimensions.width, out_dimensions.height, 0,
             GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, NULL);
         if (!(ok = ((gl_err = glGetError()) == GL_NO_ERROR)))
-            sprintf(last_error, "OpenGL error 0x%x", gl_err);
+            buffer.emitf(EV_LOG_ERROR, "OpenGL error 0x%x", gl_err);
     }
 
     return ok;
@@ -94,32 +180,91 @@ void video_mixer_linux::platform_destroy()
     EGLBoolean egl_ret;
 
     if (egl_context != EGL_NO_CONTEXT) {
-        egl_ret = eglDestroyContext(egl_display, egl_context);
+        egl_ret = eglDestroyContext(device->display, egl_context);
         if (egl_ret == EGL_FALSE)
-            fprintf(stderr, "eglDestroyContext error 0x%x", eglGetError());
+            buffer.emitf(EV_LOG_ERROR, "eglDestroyContext error 0x%x", eglGetError());
         egl_context = EGL_NO_CONTEXT;
     }
 
-    if (egl_display != EGL_NO_DISPLAY) {
-        egl_ret = eglTerminate(egl_display);
-        if (egl_ret == EGL_FALSE)
-            fprintf(stderr, "eglTerminate error 0x%x", eglGetError());
-        egl_display = EGL_NO_DISPLAY;
+    if (device != nullptr) {
+        device->release();
+        device = nullptr;
     }
 }
 
+// The API binding is per thread, and ticks may run on any clock thread, so
+// always bind it before switching contexts.
 bool video_mixer_linux::activate_gl()
 {
     bool ok;
     EGLBoolean egl_ret;
 
-    egl_ret = eglMakeCurrent(egl_display,
-        EGL_NO_SURFACE, EGL_NO_SURFACE, egl_context);
-    if (!(ok = egl_ret == EGL_TRUE))
-        sprintf(last_error, "eglMakeCurrent error 0x%x", eglGetError());
+    egl_ret = eglBindAPI(EGL_OPENGL_API);
+    if (!(ok = (egl_ret == EGL_TRUE)))
+        buffer.emitf(EV_LOG_ERROR, "eglBindApi error 0x%x", eglGetError());
+
+    if (ok) {
+        egl_ret = eglMakeCurrent(device->display,
+            EGL_NO_SURFACE, EGL_NO_SURFACE, egl_context);
+        if (!(ok = (egl_ret == EGL_TRUE)))
+            buffer.emitf(EV_LOG_ERROR, "eglMakeCurrent error 0x%x", eglGetError());
+    }
 
     return ok;
 }
 
+void video_mixer_linux::deactivate_gl()
+{
+    if (device == nullptr)
+        return;
+
+    eglBindAPI(EGL_OPENGL_API);
+    EGLBoolean egl_ret = eglMakeCurrent(device->display,
+        EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (egl_ret == EGL_FALSE)
+        buffer.emitf(EV_LOG_ERROR, "eglMakeCurrent error 0x%x", eglGetError());
+}
+
+bool video_mixer_linux::upload_gl_init()
+{
+    bool ok;
+    EGLBoolean egl_ret;
+
+    egl_ret = eglBindAPI(EGL_OPENGL_API);
+    if (!(ok = (egl_ret == EGL_TRUE)))
+        buffer.emitf(EV_LOG_ERROR, "eglBindApi error 0x%x", eglGetError());
+
+    if (ok) {
+        upload_context = eglCreateContext(device->display,
+            device->config, device->root_context, context_attribs);
+        if (!(ok = (upload_context != EGL_NO_CONTEXT)))
+            buffer.emitf(EV_LOG_ERROR, "eglCreateContext error 0x%x", eglGetError());
+    }
+
+    if (ok) {
+        egl_ret = eglMakeCurrent(device->display,
+            EGL_NO_SURFACE, EGL_NO_SURFACE, upload_context);
+        if (!(ok = (egl_ret == EGL_TRUE)))
+            buffer.emitf(EV_LOG_ERROR, "eglMakeCurrent error 0x%x", eglGetError());
+    }
+
+    if (!ok)
+        upload_gl_destroy();
+
+    return ok;
+}
+
+void video_mixer_linux::upload_gl_destroy()
+{
+    if (upload_context == EGL_NO_CONTEXT)
+        return;
+
+    eglMakeCurrent(device->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    EGLBoolean egl_ret = eglDestroyContext(device->display, upload_context);
+    if (egl_ret == EGL_FALSE)
+        buffer.emitf(EV_LOG_ERROR, "eglDestroyContext error 0x%x", eglGetError());
+    upload_context = EGL_NO_CONTEXT;
+}
+
 
 }  // namespace p1stream
@@ -135,6 +135,43 @@ bool video_mixer_mac::activate_gl()
     return true;
 }
 
+void video_mixer_mac::deactivate_gl()
+{
+    CGLError cgl_err = CGLSetCurrentContext(NULL);
+    if (cgl_err != kCGLNoError)
+        buffer.emitf(EV_LOG_ERROR, "CGLSetCurrentContext error 0x%x", cgl_err);
+}
+
+bool video_mixer_mac::upload_gl_init()
+{
+    CGLError cgl_err;
+
+    cgl_err = CGLCreateContext(CGLGetPixelFormat(cgl_context_), cgl_context_, &upload_context);
+    if (cgl_err != kCGLNoError) {
+        buffer.emitf(EV_LOG_ERROR, "CGLCreateContext error 0x%x", cgl_err);
+        upload_context = NULL;
+        return false;
+    }
+
+    cgl_err = CGLSetCurrentContext(upload_context);
+    if (cgl_err != kCGLNoError) {
+        buffer.emitf(EV_LOG_ERROR, "CGLSetCurrentContext error 0x%x", cgl_err);
+        upload_gl_destroy();
+        return false;
+    }
+
+    return true;
+}
+
+void video_mixer_mac::upload_gl_destroy()
+{
+    if (upload_context != NULL) {
+        CGLSetCurrentContext(NULL);
+        CGLReleaseContext(upload_context);
+        upload_context = NULL;
+    }
+}
+
 
 void video_source_context::render_iosurface(IOSurfaceRef surface)
 {
@@ -0,0 +1,211 @@
+#include "p1stream_priv.h"
+
+namespace p1stream {
+
+// Maximum number of frames shared with taps at once. When all are in use, taps
+// miss frames until one is released.
+static const size_t max_pool_frames = 4;
+
+
+void video_tap::link_video_tap(video_tap_context &ctx)
+{
+}
+
+void video_tap::unlink_video_tap(video_tap_context &ctx)
+{
+}
+
+
+void video_tap_context::start()
+{
+    running = true;
+    uv_cond_init(&cond);
+    uv_thread_create(&thread, thread_cb, this);
+}
+
+void video_tap_context::stop()
+{
+    if (!running)
+        return;
+
+    {
+        lock_handle lock(mutex);
+        running = false;
+        uv_cond_signal(&cond);
+    }
+
+    uv_thread_join(&thread);
+    uv_cond_destroy(&cond);
+    pending.reset();
+}
+
+void video_tap_context::offer(std::shared_ptr<const video_frame> frame)
+{
+    lock_handle lock(mutex);
+    if (pending)
+        dropped++;
+    pending = frame;
+    uv_cond_signal(&cond);
+}
+
+void video_tap_context::thread_cb(void *arg)
+{
+    ((video_tap_context *) arg)->loop();
+}
+
+void video_tap_context::loop()
+{
+    lock_handle lock(mutex);
+    while (true) {
+        while (running && !pending)
+            uv_cond_wait(&cond, &mutex.mutex);
+        if (!running)
+            break;
+
+        std::shared_ptr<const video_frame> frame;
+        frame.swap(pending);
+
+        mutex.unlock();
+        tap->video_tap_frame(*this, frame);
+        // Release before relocking, so the mixer can reuse the frame early.
+        frame.reset();
+        mutex.lock();
+
+        delivered++;
+    }
+}
+
+
+// Share a pooled frame. The deleter runs once the last tap is done with it,
+// and only marks it free. It also keeps the frame alive, in case a tap still
+// holds it when the pool is cleared.
+static std::shared_ptr<video_frame> share_frame(const std::shared_ptr<video_frame> &frame)
+{
+    frame->in_use.store(true, std::memory_order_relaxed);
+    return std::shared_ptr<video_frame>(frame.get(), [frame](video_frame *ptr) {
+        ptr->in_use.store(false, std::memory_order_release);
+    });
+}
+
+// Find a pooled frame nothing else references, or allocate one.
+std::shared_ptr<video_frame> video_mixer_base::acquire_frame()
+{
+    for (auto &frame : frame_pool) {
+        if (!frame->in_use.load(std::memory_order_acquire))
+            return share_frame(frame);
+    }
+
+    if (frame_pool.size() == max_pool_frames)
+        return nullptr;
+
+    auto frame = std::make_shared<video_frame>();
+    uint32_t width = out_dimensions.width;
+    uint32_t height = out_dimensions.height;
+    frame->dimensions = out_dimensions;
+    frame->data.resize(out_size);
+    frame->planes[0] = frame->data.data();
+    frame->planes[1] = frame->planes[0] + width * height;
+    frame->planes[2] = frame->planes[1] + width * height / 4;
+    frame->strides[0] = width;
+    frame->strides[1] = width / 2;
+    frame->strides[2] = width / 2;
+    frame_pool.push_back(frame);
+    return share_frame(frame);
+}
+
+// Stopping waits for a running tap callback, so the caller should not hold
+// the lock if it can avoid it.
+static void stop_taps(std::vector<std::unique_ptr<video_tap_context>> &ctxes)
+{
+    for (auto &ctx : ctxes) {
+        ctx->stop();
+        ctx->tap->unlink_video_tap(*ctx);
+    }
+    ctxes.clear();
+}
+
+// Takes the lock itself, so callers must not hold it.
+void video_mixer_base::clear_taps()
+{
+    std::vector<std::unique_ptr<video_tap_context>> old_ctxes;
+    {
+        lock_handle lock(*this);
+        std::swap(old_ctxes, tap_ctxes);
+    }
+    stop_taps(old_ctxes);
+}
+
+void video_mixer_base::set_taps(const FunctionCallbackInfo<Value>& args)
+{
+    if (args.Length() != 1 || !args[0]->IsArray()) {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "Expected an array")));
+        return;
+    }
+    auto arr = args[0].As<Array>();
+    uint32_t len = arr->Length();
+
+    auto l_tap_sym = tap_sym.Get(isolate);
+    auto l_interval_sym = interval_sym.Get(isolate);
+
+    std::vector<std::unique_ptr<video_tap_context>> new_ctxes;
+    for (uint32_t i = 0; i < len; i++) {
+        auto val = arr->Get(i);
+        if (!val->IsObject()) {
+            isolate->ThrowException(Exception::TypeError(
+                String::NewFromUtf8(isolate, "Expected only objects in the array")));
+            return;
+        }
+        auto obj = val.As<Object>();
+
+        auto tap_val = obj->Get(l_tap_sym);
+        if (!tap_val->IsObject()) {
+            isolate->ThrowException(Exception::TypeError(
+                String::NewFromUtf8(isolate, "Invalid tap")));
+            return;
+        }
+        auto *tap = ObjectWrap::Unwrap<video_tap>(tap_val.As<Object>());
+
+        uint32_t interval = 1;
+        auto interval_val = obj->Get(l_interval_sym);
+        if (!interval_val->IsUndefined()) {
+            if (!interval_val->IsUint32() || interval_val->Uint32Value() == 0) {
+                isolate->ThrowException(Exception::TypeError(
+                    String::NewFromUtf8(isolate, "Invalid interval")));
+                return;
+            }
+            interval = interval_val->Uint32Value();
+        }
+
+        new_ctxes.emplace_back(new video_tap_context(this, tap, interval));
+    }
+
+    // Parameters checked, from here on we no longer throw exceptions.
+    // Ticks stop offering frames to the old taps as soon as we swap.
+    std::vector<std::unique_ptr<video_tap_context>> old_ctxes;
+    {
+        lock_handle lock(*this);
+        if (!running)
+            return;
+        std::swap(old_ctxes, tap_ctxes);
+    }
+
+    stop_taps(old_ctxes);
+
+    for (auto &ctx : new_ctxes) {
+        ctx->tap->link_video_tap(*ctx);
+        ctx->start();
+    }
+
+    {
+        lock_handle lock(*this);
+        if (running)
+            std::swap(new_ctxes, tap_ctxes);
+    }
+
+    // Only non-empty if we were destroyed in the meantime.
+    stop_taps(new_ctxes);
+}
+
+
+}  // namespace p1stream
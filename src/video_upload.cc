@@ -0,0 +1,354 @@
+#include "p1stream_priv.h"
+
+namespace p1stream {
+
+// How long the upload thread sleeps when idle. Pushes wake it up early.
+static const uint64_t idle_interval = 100000000;  // 100ms
+
+
+void video_uploader::init(video_mixer_base *mixer_)
+{
+    mixer = mixer_;
+    uv_cond_init(&cond);
+}
+
+void video_uploader::destroy()
+{
+    if (mixer == nullptr)
+        return;
+
+    {
+        lock_handle lock(mutex);
+        stopped = true;
+        running = false;
+        uv_cond_signal(&cond);
+    }
+
+    if (started)
+        uv_thread_join(&thread);
+    uv_cond_destroy(&cond);
+    queues.clear();
+    mixer = nullptr;
+}
+
+std::shared_ptr<video_upload_queue> video_uploader::create_queue()
+{
+    auto queue = std::make_shared<video_upload_queue>();
+    lock_handle lock(mutex);
+    if (!stopped)
+        queues.push_back(queue);
+    return queue;
+}
+
+void video_uploader::signal()
+{
+    lock_handle lock(mutex);
+    if (stopped)
+        return;
+
+    // Before the thread exists, queues hold no GL objects, so closed ones can
+    // simply be dropped.
+    if (!started) {
+        bool active = false;
+        for (auto it = queues.begin(); it != queues.end();) {
+            if ((*it)->closed) {
+                it = queues.erase(it);
+            }
+            else {
+                active = active || (*it)->active;
+                it++;
+            }
+        }
+        if (!active)
+            return;
+
+        started = true;
+        running = true;
+        uv_thread_create(&thread, thread_cb, this);
+    }
+
+    pending = true;
+    uv_cond_signal(&cond);
+}
+
+void video_uploader::thread_cb(void *arg)
+{
+    ((video_uploader *) arg)->loop();
+}
+
+// The mixer lock is only taken to emit events, and never while holding our
+// mutex or a queue mutex, because ticks take those with the mixer lock held.
+void video_uploader::loop()
+{
+    bool ok;
+    {
+        lock_handle mixer_lock(*mixer);
+        ok = mixer->upload_gl_init();
+    }
+    if (!ok) {
+        lock_handle lock(mutex);
+        stopped = true;
+        running = false;
+        queues.clear();
+        return;
+    }
+
+    lock_handle lock(mutex);
+    while (running) {
+        pending = false;
+
+        // The list may change while we're unlocked, but items are kept alive
+        // by our reference. Anything missed is caught on the next pass.
+        for (size_t i = 0; i < queues.size(); i++) {
+            auto queue = queues[i];
+
+            mutex.unlock();
+            bool closed = queue->closed;
+            if (closed)
+                cleanup(*queue);
+            else
+                while (upload(*queue));
+            mutex.lock();
+
+            if (closed) {
+                for (auto it = queues.begin(); it != queues.end(); it++) {
+                    if (*it == queue) {
+                        queues.erase(it);
+                        break;
+                    }
+                }
+                i--;
+            }
+        }
+
+        if (running && !pending)
+            uv_cond_timedwait(&cond, &mutex.mutex, idle_interval);
+    }
+    mutex.unlock();
+
+    for (auto &queue : queues)
+        cleanup(*queue);
+
+    {
+        lock_handle mixer_lock(*mixer);
+        mixer->upload_gl_destroy();
+    }
+    mutex.lock();
+}
+
+// Upload the oldest staged frame of a queue. Returns false if there was none.
+bool video_uploader::upload(video_upload_queue &queue)
+{
+    uint32_t tail = queue.staging_tail.load(std::memory_order_relaxed);
+    if (tail == queue.staging_head.load(std::memory_order_acquire))
+        return false;
+
+    auto &frame = queue.staging[tail % video_upload_queue::num_staging];
+
+    // Find a free slot. If there is none, replace the oldest frame that is
+    // waiting to be rendered.
+    video_upload_queue::slot *slot = nullptr;
+    {
+        lock_handle lock(queue.mutex);
+        for (auto &s : queue.slots) {
+            if (s.state == video_upload_queue::slot_free) {
+                slot = &s;
+                break;
+            }
+            if (s.state == video_upload_queue::slot_ready &&
+                (slot == nullptr || s.time < slot->time))
+                slot = &s;
+        }
+
+        if (slot != nullptr) {
+            if (slot->state == video_upload_queue::slot_ready) {
+                queue.dropped++;
+                if (slot->fence != NULL) {
+                    glDeleteSync(slot->fence);
+                    slot->fence = NULL;
+                }
+            }
+            slot->state = video_upload_queue::slot_uploading;
+        }
+    }
+
+    // Every slot is current or uploading, which can't happen with a single
+    // upload thread, but don't spin if it does.
+    if (slot == nullptr) {
+        queue.staging_tail.store(tail + 1, std::memory_order_release);
+        lock_handle lock(queue.mutex);
+        queue.dropped++;
+        return true;
+    }
+
+    if (slot->texture == 0)
+        glGenTextures(1, &slot->texture);
+
+    glBindTexture(GL_TEXTURE_RECTANGLE, slot->texture);
+    if (slot->dimensions.width == frame.dimensions.width &&
+        slot->dimensions.height == frame.dimensions.height) {
+        glTexSubImage2D(GL_TEXTURE_RECTANGLE, 0, 0, 0, frame.dimensions.width, frame.dimensions.height,
+                        GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, frame.data.data());
+    }
+    else {
+        glTexImage2D(GL_TEXTURE_RECTANGLE, 0, GL_RGBA8, frame.dimensions.width, frame.dimensions.height, 0,
+                     GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, frame.data.data());
+        slot->dimensions = frame.dimensions;
+    }
+
+    GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+
+    // The texture has its own copy now, so the staging buffer can be reused.
+    frame_time_t time = frame.time;
+    queue.staging_tail.store(tail + 1, std::memory_order_release);
+
+    GLenum gl_err = glGetError();
+    {
+        lock_handle lock(queue.mutex);
+        if (gl_err != GL_NO_ERROR) {
+            if (fence != NULL)
+                glDeleteSync(fence);
+            slot->state = video_upload_queue::slot_free;
+            slot->dimensions = dimensions_t();
+            queue.dropped++;
+        }
+        else {
+            slot->fence = fence;
+            slot->time = time;
+            slot->state = video_upload_queue::slot_ready;
+            queue.uploaded++;
+        }
+    }
+
+    if (gl_err != GL_NO_ERROR) {
+        lock_handle mixer_lock(*mixer);
+        mixer->buffer.emitf(EV_LOG_ERROR, "OpenGL error 0x%x during upload", gl_err);
+    }
+    return true;
+}
+
+void video_uploader::cleanup(video_upload_queue &queue)
+{
+    lock_handle lock(queue.mutex);
+
+    for (auto &slot : queue.slots) {
+        if (slot.fence != NULL) {
+            glDeleteSync(slot.fence);
+            slot.fence = NULL;
+        }
+        if (slot.texture != 0) {
+            glDeleteTextures(1, &slot.texture);
+            slot.texture = 0;
+        }
+        slot.state = video_upload_queue::slot_free;
+    }
+}
+
+Local<Object> video_upload_queue::stats_to_js(Isolate *isolate)
+{
+    lock_handle lock(mutex);
+
+    auto obj = Object::New(isolate);
+    obj->Set(String::NewFromUtf8(isolate, "pushed"), Number::New(isolate, pushed));
+    obj->Set(String::NewFromUtf8(isolate, "overflows"), Number::New(isolate, overflows));
+    obj->Set(String::NewFromUtf8(isolate, "uploaded"), Number::New(isolate, uploaded));
+    obj->Set(String::NewFromUtf8(isolate, "dropped"), Number::New(isolate, dropped));
+    obj->Set(String::NewFromUtf8(isolate, "repeats"), Number::New(isolate, repeats));
+    return obj;
+}
+
+
+void video_source_context_full::push_buffer(frame_time_t time, dimensions_t dimensions, const void *data)
+{
+    auto &queue = *upload;
+    if (queue.closed)
+        return;
+
+    uint32_t head = queue.staging_head.load(std::memory_order_relaxed);
+    uint32_t tail = queue.staging_tail.load(std::memory_order_acquire);
+    if (head - tail == video_upload_queue::num_staging) {
+        queue.overflows++;
+        return;
+    }
+
+    // Buffers only grow, so steady state doesn't allocate.
+    auto &frame = queue.staging[head % video_upload_queue::num_staging];
+    size_t size = dimensions.width * dimensions.height * 4;
+    frame.data.resize(size);
+    memcpy(frame.data.data(), data, size);
+    frame.time = time;
+    frame.dimensions = dimensions;
+    queue.staging_head.store(head + 1, std::memory_order_release);
+    queue.pushed++;
+
+    queue.active = true;
+    ((video_mixer_base *) mixer_)->uploader.signal();
+}
+
+void video_source_context_full::render_uploaded(frame_time_t time)
+{
+    typedef video_upload_queue q;
+    auto &queue = *upload;
+    frame_time_t target = time - queue.latency;
+    GLuint texture = 0;
+
+    {
+        lock_handle lock(queue.mutex);
+
+        q::slot *current = nullptr;
+        for (auto &slot : queue.slots) {
+            if (slot.state == q::slot_current)
+                current = &slot;
+        }
+
+        // Pick the frame nearest to the target, among the current frame and
+        // newer frames the GPU is done uploading. Checking fences doesn't
+        // block.
+        q::slot *best = current;
+        for (auto &slot : queue.slots) {
+            if (slot.state != q::slot_ready)
+                continue;
+            if (slot.fence != NULL) {
+                GLenum ret = glClientWaitSync(slot.fence, 0, 0);
+                if (ret != GL_ALREADY_SIGNALED && ret != GL_CONDITION_SATISFIED)
+                    continue;
+                glDeleteSync(slot.fence);
+                slot.fence = NULL;
+            }
+            if (current != nullptr && slot.time <= current->time)
+                continue;
+            if (best == nullptr || llabs(slot.time - target) <= llabs(best->time - target))
+                best = &slot;
+        }
+
+        if (best != nullptr) {
+            // Frames older than the selected one will never be rendered.
+            for (auto &slot : queue.slots) {
+                if (slot.state == q::slot_ready && slot.fence == NULL && slot.time < best->time) {
+                    slot.state = q::slot_free;
+                    queue.dropped++;
+                }
+            }
+
+            if (best == current) {
+                queue.repeats++;
+            }
+            else {
+                if (current != nullptr)
+                    current->state = q::slot_free;
+                best->state = q::slot_current;
+            }
+
+            texture = best->texture;
+        }
+    }
+
+    if (texture != 0) {
+        glBindTexture(GL_TEXTURE_RECTANGLE, texture);
+        render_texture();
+    }
+}
+
+
+}  // namespace p1stream
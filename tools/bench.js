@@ -0,0 +1,218 @@
+#!/usr/bin/env iojs
+
+// Headless pipeline benchmark. Runs the mixers with synthetic sources and an
+// offline clock, and prints results as JSON to stdout.
+//
+//     tools/bench.js [--frames N] [--size WxH ...] [--preset NAME ...]
+//     tools/bench.js --kernels
+//
+// Every combination of size and preset runs in a fresh child process, so that
+// the peak RSS reported is for that run only.
+//
+// With `--kernels`, only the audio kernel variants are timed instead, in
+// nanoseconds per sample.
+
+var path = require('path');
+var childProcess = require('child_process');
+
+var nativePath = path.join(__dirname, '..', 'build', 'Release', 'bench.node');
+
+// Parse command line arguments.
+function parseArgs(argv) {
+    var opts = { frames: 600, sizes: [], presets: [], rate: [1, 30], kernels: false };
+    for (var i = 0; i < argv.length; i++) {
+        var arg = argv[i];
+        var val = argv[i + 1];
+        switch (arg) {
+            case '--frames':
+                opts.frames = parseInt(val, 10);
+                i++;
+                break;
+            case '--size':
+                var m = /^(\d+)x(\d+)$/.exec(val);
+                if (!m)
+                    throw new Error("Invalid size '" + val + "'");
+                opts.sizes.push([parseInt(m[1], 10), parseInt(m[2], 10)]);
+                i++;
+                break;
+            case '--preset':
+                opts.presets.push(val);
+                i++;
+                break;
+            case '--kernels':
+                opts.kernels = true;
+                break;
+            case '--rate':
+                opts.rate = val.split('/').map(Number);
+                i++;
+                break;
+            default:
+                throw new Error("Unknown argument '" + arg + "'");
+        }
+    }
+    if (!opts.sizes.length)
+        opts.sizes.push([1280, 720]);
+    if (!opts.presets.length)
+        opts.presets.push('veryfast');
+    return opts;
+}
+
+// Perform a single run in this process, and call back with results.
+function runOne(run, cb) {
+    var native = require(nativePath);
+
+    var bytes = 0;
+    var failed = false;
+    function onEvent(id, arg) {
+        switch (id) {
+            case native.EV_LOG_WARN:
+            case native.EV_LOG_ERROR:
+            case native.EV_LOG_FATAL:
+                console.error(arg);
+                break;
+            case native.EV_FAILURE:
+                failed = true;
+                break;
+            case native.EV_AUDIO_FRAME:
+                bytes += arg.buf.length;
+                break;
+        }
+    }
+
+    var clock = new native.OfflineClock({
+        numerator: run.rate[0],
+        denominator: run.rate[1],
+        limit: run.frames,
+        paused: true
+    });
+    var videoSource = new native.BenchVideoSource({
+        width: run.width,
+        height: run.height
+    });
+    var audioSource = new native.BenchAudioSource({});
+    var videoMixer = new native.VideoMixer({
+        width: run.width,
+        height: run.height,
+        x264Preset: run.preset,
+        clock: clock,
+        onEvent: onEvent
+    });
+    var audioMixer = new native.AudioMixer({
+        onEvent: onEvent
+    });
+
+    videoMixer.setSources([{
+        source: videoSource,
+        x1: -1, y1: -1, x2: 1, y2: 1,
+        u1: 0, v1: 0, u2: 1, v2: 1
+    }]);
+    audioMixer.setSources([{
+        source: audioSource,
+        volume: 1
+    }]);
+
+    clock.resume();
+    var timer = setInterval(function() {
+        var clockStats = clock.stats();
+        if (!clockStats.done && !failed)
+            return;
+
+        clearInterval(timer);
+        var mixerStats = videoMixer.stats();
+        var seconds = clockStats.elapsed / 1e9;
+
+        videoMixer.destroy();
+        audioMixer.destroy();
+        videoSource.destroy();
+        audioSource.destroy();
+        clock.destroy();
+
+        var videoBytes = mixerStats.bytes;
+        cb(null, {
+            width: run.width,
+            height: run.height,
+            preset: run.preset,
+            failed: failed,
+            frames: clockStats.ticks,
+            encodedFrames: mixerStats.frames,
+            elapsed: clockStats.elapsed,
+            fps: clockStats.ticks / seconds,
+            videoBytes: videoBytes,
+            audioBytes: bytes,
+            bytesPerSecond: (videoBytes + bytes) / seconds,
+            encoderOpenTime: mixerStats.encoderOpenTime,
+            firstFrameLatency: mixerStats.firstFrameLatency,
+            peakRss: native.peakRss(),
+            stages: mixerStats.stages
+        });
+    }, 50);
+}
+
+// Run all combinations, each in a child process.
+function runAll(opts) {
+    var runs = [];
+    opts.sizes.forEach(function(size) {
+        opts.presets.forEach(function(preset) {
+            runs.push({
+                width: size[0],
+                height: size[1],
+                preset: preset,
+                frames: opts.frames,
+                rate: opts.rate
+            });
+        });
+    });
+
+    var results = [];
+    (function next() {
+        var run = runs.shift();
+        if (!run)
+            return done();
+
+        var child = childProcess.fork(__filename, ['--child']);
+        child.on('message', function(result) {
+            results.push(result);
+        });
+        child.on('exit', function(code) {
+            if (code !== 0)
+                results.push({ width: run.width, height: run.height, preset: run.preset, failed: true });
+            next();
+        });
+        child.send(run);
+    })();
+
+    function done() {
+        process.stdout.write(JSON.stringify({
+            version: require('../package.json').version,
+            platform: process.platform,
+            arch: process.arch,
+            time: new Date().toISOString(),
+            results: results
+        }, null, 2) + '\n');
+    }
+}
+
+if (process.argv[2] === '--child') {
+    process.once('message', function(run) {
+        runOne(run, function(err, result) {
+            process.send(result, function() {
+                process.exit(0);
+            });
+        });
+    });
+}
+else {
+    var opts = parseArgs(process.argv.slice(2));
+    if (opts.kernels) {
+        var kernels = require(nativePath).benchAudioKernels();
+        var scalar = kernels[0];
+        kernels.forEach(function(k) {
+            k.mixSpeedup = scalar.mix / k.mix;
+            k.convertSpeedup = scalar.convert / k.convert;
+        });
+        process.stdout.write(JSON.stringify({ kernels: kernels }, null, 2) + '\n');
+    }
+    else {
+        runAll(opts);
+    }
+}
@@ -72,7 +72,7 @@ module.directive('mixerPreview', function($window, $parse) {
                 if (ua === 'p1stream-mac')
                     videoEl = createWebDocumentView(mixerId);
                 else
-                    videoEl = createVideo(mixerId);
+                    videoEl = createPreviewImage(mixerId);
                 videoEl.style.width = '100%';
                 videoEl.style.height = '100%';
 
@@ -88,11 +88,10 @@ module.directive('mixerPreview', function($window, $parse) {
         return el;
     }
 
-    function createVideo(mixerId) {
-        var el = doc.createElement('VIDEO');
-        el.src = '/api/mixers/' + mixerId + '.mkv';
-        el.muted = el.defaultMuted = true;
-        el.autoplay = true;
+    // Low-rate MJPEG stream, which is much cheaper than the full stream.
+    function createPreviewImage(mixerId) {
+        var el = doc.createElement('IMG');
+        el.src = '/api/mixers/' + mixerId + '.mjpeg';
         return el;
     }
 });